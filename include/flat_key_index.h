@@ -0,0 +1,145 @@
+#pragma once
+
+#include <cassert>
+#include <cstddef>
+#include <cstdint>
+#include <functional>
+#include <limits>
+#include <vector>
+
+// Flat open-addressing hash index from keys to state ids. Keys and state ids
+// are stored in two parallel arrays with linear probing, so a lookup touches
+// contiguous memory and no per-key nodes are allocated. Erased slots are marked
+// with tombstones, which are cleaned up on rehashing. State ids are stored as
+// 32-bit integers as in SparseVector.
+template <typename KeyType, typename Hash = std::hash<KeyType>>
+class FlatKeyIndex {
+ public:
+  static constexpr size_t kNotFound = std::numeric_limits<size_t>::max();
+
+  // Returns the state id of the key or kNotFound
+  size_t Find(const KeyType& key) const {
+    if (states_.empty()) {
+      return kNotFound;
+    }
+
+    for (size_t slot = GetHomeSlot(key);; slot = (slot + 1) & mask_) {
+      if (states_[slot] == kEmptySlot) {
+        return kNotFound;
+      }
+
+      if (states_[slot] != kErasedSlot && keys_[slot] == key) {
+        return states_[slot];
+      }
+    }
+  }
+
+  // Inserts the key, which should not be in the index yet
+  void Insert(const KeyType& key, size_t state) {
+    assert(state < kErasedSlot);
+    assert(Find(key) == kNotFound);
+
+    // Maximal load factor (including tombstones) is 3/4
+    if (4 * (num_keys_ + num_erased_ + 1) > 3 * states_.size()) {
+      Rehash();
+    }
+
+    size_t slot = GetHomeSlot(key);
+
+    while (states_[slot] != kEmptySlot && states_[slot] != kErasedSlot) {
+      slot = (slot + 1) & mask_;
+    }
+
+    if (states_[slot] == kErasedSlot) {
+      num_erased_--;
+    }
+
+    keys_[slot] = key;
+    states_[slot] = static_cast<IndexT>(state);
+    num_keys_++;
+  }
+
+  // Erases the key, returns false if it is not in the index
+  bool Erase(const KeyType& key) {
+    if (states_.empty()) {
+      return false;
+    }
+
+    for (size_t slot = GetHomeSlot(key);; slot = (slot + 1) & mask_) {
+      if (states_[slot] == kEmptySlot) {
+        return false;
+      }
+
+      if (states_[slot] != kErasedSlot && keys_[slot] == key) {
+        states_[slot] = kErasedSlot;
+        num_keys_--;
+        num_erased_++;
+        return true;
+      }
+    }
+  }
+
+  size_t GetSize() const { return num_keys_; }
+
+ private:
+  typedef uint32_t IndexT;
+
+  static constexpr IndexT kEmptySlot = std::numeric_limits<IndexT>::max();
+  static constexpr IndexT kErasedSlot = kEmptySlot - 1;
+
+  static const size_t kMinCapacity = 16;
+
+  size_t GetHomeSlot(const KeyType& key) const {
+    // Hashes are mixed with the Fibonacci multiplier, because std::hash is
+    // usually identity for integers, and the high bits are taken
+    const uint64_t hash =
+        static_cast<uint64_t>(hasher_(key)) * 0x9E3779B97F4A7C15ull;
+
+    return static_cast<size_t>(hash >> 32) & mask_;
+  }
+
+  // Grows the table twice if it is at least half full with keys, otherwise
+  // only cleans up the tombstones
+  void Rehash() {
+    size_t capacity = states_.empty() ? kMinCapacity : states_.size();
+
+    if (2 * (num_keys_ + 1) > capacity) {
+      capacity *= 2;
+    }
+
+    assert(capacity <= (size_t(1) << 32));
+
+    std::vector<KeyType> keys(capacity);
+    std::vector<IndexT> states(capacity, kEmptySlot);
+
+    keys_.swap(keys);
+    states_.swap(states);
+    mask_ = capacity - 1;
+    num_keys_ = 0;
+    num_erased_ = 0;
+
+    for (size_t i = 0; i < states.size(); ++i) {
+      if (states[i] != kEmptySlot && states[i] != kErasedSlot) {
+        Insert(keys[i], states[i]);
+      }
+    }
+  }
+
+  std::vector<KeyType> keys_;
+  std::vector<IndexT> states_;
+  size_t mask_ = 0;
+  size_t num_keys_ = 0;
+  size_t num_erased_ = 0;
+  Hash hasher_;
+};
+
+template <typename KeyType, typename Hash>
+constexpr size_t FlatKeyIndex<KeyType, Hash>::kNotFound;
+
+template <typename KeyType, typename Hash>
+constexpr typename FlatKeyIndex<KeyType, Hash>::IndexT
+    FlatKeyIndex<KeyType, Hash>::kEmptySlot;
+
+template <typename KeyType, typename Hash>
+constexpr typename FlatKeyIndex<KeyType, Hash>::IndexT
+    FlatKeyIndex<KeyType, Hash>::kErasedSlot;
\ No newline at end of file
@@ -0,0 +1,104 @@
+#pragma once
+
+#include <algorithm>
+#include <cassert>
+#include <cstddef>
+#include <cstdint>
+#include <functional>
+#include <limits>
+#include <vector>
+
+// Count-min sketch of the keys access frequencies with 8-bit saturating
+// counters. Each key is counted in one counter of each of kDepth rows, and its
+// frequency is estimated as the minimum of these counters, so the estimate is
+// never less than the true count (until the counters are halved). Once the
+// number of increments reaches the sample size, all the counters are halved,
+// so the frequencies of the keys, which are not accessed anymore, fade away.
+template <typename KeyType, typename Hash = std::hash<KeyType>>
+class FrequencySketch {
+ public:
+  // Width is rounded up to the power of two. Sample size is a multiple of the
+  // width, so each counter is halved before it saturates on average.
+  explicit FrequencySketch(size_t width)
+      : width_mask_(RoundUpToPowerOfTwo(std::max<size_t>(width, 1)) - 1),
+        sample_size_(kSampleSizePerCounter * (width_mask_ + 1)),
+        counters_(kDepth * (width_mask_ + 1), 0) {}
+
+  void Increment(const KeyType& key) {
+    const uint64_t hash = GetHash(key);
+
+    for (size_t row = 0; row < kDepth; ++row) {
+      uint8_t& counter = counters_[GetIndex(hash, row)];
+
+      if (counter != std::numeric_limits<uint8_t>::max()) {
+        ++counter;
+      }
+    }
+
+    if (++num_increments_ == sample_size_) {
+      Halve();
+    }
+  }
+
+  uint8_t Estimate(const KeyType& key) const {
+    const uint64_t hash = GetHash(key);
+    uint8_t estimate = std::numeric_limits<uint8_t>::max();
+
+    for (size_t row = 0; row < kDepth; ++row) {
+      estimate = std::min(estimate, counters_[GetIndex(hash, row)]);
+    }
+
+    return estimate;
+  }
+
+  size_t GetWidth() const { return width_mask_ + 1; }
+
+ private:
+  static constexpr size_t kDepth = 4;
+  static constexpr size_t kSampleSizePerCounter = 10;
+
+  static size_t RoundUpToPowerOfTwo(size_t value) {
+    size_t result = 1;
+
+    while (result < value) {
+      result <<= 1;
+    }
+
+    return result;
+  }
+
+  // Hash is mixed with the multiplicative hashing, since std::hash is identity
+  // for integers
+  uint64_t GetHash(const KeyType& key) const {
+    return static_cast<uint64_t>(hash_(key)) * 0x9E3779B97F4A7C15ull;
+  }
+
+  // Row indices are derived from the two halves of the hash with double
+  // hashing: h1 + row * h2
+  size_t GetIndex(uint64_t hash, size_t row) const {
+    const uint64_t h1 = hash >> 32;
+    const uint64_t h2 = (hash & 0xFFFFFFFFull) | 1;
+
+    return row * (width_mask_ + 1) + ((h1 + row * h2) & width_mask_);
+  }
+
+  void Halve() {
+    for (auto& counter : counters_) {
+      counter >>= 1;
+    }
+
+    num_increments_ /= 2;
+  }
+
+  Hash hash_;
+  size_t width_mask_;
+  size_t sample_size_;
+  size_t num_increments_ = 0;
+  std::vector<uint8_t> counters_;
+};
+
+template <typename KeyType, typename Hash>
+constexpr size_t FrequencySketch<KeyType, Hash>::kDepth;
+
+template <typename KeyType, typename Hash>
+constexpr size_t FrequencySketch<KeyType, Hash>::kSampleSizePerCounter;
@@ -0,0 +1,136 @@
+#pragma once
+
+#include <algorithm>
+#include <cassert>
+#include <cstddef>
+#include <functional>
+#include <limits>
+#include <utility>
+#include <vector>
+
+// Binary heap of ids (e.g. Markov chain states) with the position of each id
+// tracked in an array indexed by ids, so any id is erased in O(log(size))
+// time. Ids are ordered with the given
+// comparator as in std::make_heap: the greatest id is on the top.
+template <typename Compare = std::less<size_t>>
+class IndexedHeap {
+ public:
+  explicit IndexedHeap(const Compare& compare = Compare())
+      : compare_(compare) {}
+
+  bool Contains(size_t id) const {
+    return id < positions_.size() && positions_[id] != kNotInHeap;
+  }
+
+  bool IsEmpty() const { return heap_.empty(); }
+
+  size_t GetSize() const { return heap_.size(); }
+
+  size_t Top() const {
+    assert(!heap_.empty());
+
+    return heap_.front();
+  }
+
+  void Push(size_t id) {
+    assert(!Contains(id));
+
+    if (id >= positions_.size()) {
+      // Positions grow geometrically, so heap allocations are amortized
+      positions_.resize(std::max(id + 1, 2 * positions_.size()), kNotInHeap);
+    }
+
+    positions_[id] = heap_.size();
+    heap_.push_back(id);
+    SiftUp(heap_.size() - 1);
+  }
+
+  size_t Pop() {
+    const size_t id = Top();
+    Erase(id);
+
+    return id;
+  }
+
+  void Erase(size_t id) {
+    assert(Contains(id));
+
+    const size_t position = positions_[id];
+    const size_t last_id = heap_.back();
+
+    heap_.pop_back();
+    positions_[id] = kNotInHeap;
+
+    if (last_id == id) {
+      return;
+    }
+
+    // Move the last id to the place of the erased one and restore the heap
+    // property in either direction
+    heap_[position] = last_id;
+    positions_[last_id] = position;
+
+    SiftDown(position);
+    SiftUp(positions_[last_id]);
+  }
+
+  void Clear() {
+    for (const auto& id : heap_) {
+      positions_[id] = kNotInHeap;
+    }
+
+    heap_.clear();
+  }
+
+ private:
+  static constexpr size_t kNotInHeap = std::numeric_limits<size_t>::max();
+
+  void SiftUp(size_t position) {
+    while (position > 0) {
+      const size_t parent = (position - 1) / 2;
+
+      if (!compare_(heap_[parent], heap_[position])) {
+        return;
+      }
+
+      Swap(parent, position);
+      position = parent;
+    }
+  }
+
+  void SiftDown(size_t position) {
+    while (true) {
+      const size_t left = 2 * position + 1;
+      const size_t right = left + 1;
+      size_t greatest = position;
+
+      if (left < heap_.size() && compare_(heap_[greatest], heap_[left])) {
+        greatest = left;
+      }
+
+      if (right < heap_.size() && compare_(heap_[greatest], heap_[right])) {
+        greatest = right;
+      }
+
+      if (greatest == position) {
+        return;
+      }
+
+      Swap(greatest, position);
+      position = greatest;
+    }
+  }
+
+  void Swap(size_t position1, size_t position2) {
+    std::swap(heap_[position1], heap_[position2]);
+    positions_[heap_[position1]] = position1;
+    positions_[heap_[position2]] = position2;
+  }
+
+  Compare compare_;
+  std::vector<size_t> heap_;
+  std::vector<size_t> positions_;
+};
+
+template <typename Compare>
+constexpr size_t IndexedHeap<Compare>::kNotInHeap;
@@ -1,21 +1,81 @@
 #pragma once
 
 #include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cmath>
+#include <cstdint>
+#include <cstdio>
+#include <fstream>
+#include <limits>
+#include <memory>
+#include <mutex>
 #include <numeric>
 #include <string>
-#include <unordered_map>
+#include <thread>
+#include <type_traits>
+#include <utility>
 #include <vector>
 
+#include "flat_key_index.h"
+#include "frequency_sketch.h"
+#include "indexed_heap.h"
+#include "math/context_model.h"
 #include "math/evolving_markov_chain.h"
+#include "math/sparse_forecast_engine.h"
+#include "snapshot.h"
+#include "spsc_queue.h"
 
+// Delegate, which is notified when the items are loaded to and unloaded from
+// memory. Cache also accepts any other delegate type with the same methods as
+// a template parameter, in which case the calls are not virtual.
 template <typename KeyType>
 class CacheDelegate {
  public:
   virtual void AdmitItem(const KeyType& key) const = 0;
 
   virtual void EvictItem(const KeyType& key) const = 0;
+
+  // Called instead of AdmitItem for the items loaded to memory ahead of time
+  // (see MarkovChainCacheConfig::prefetch_max_items), so the backing store may
+  // load them asynchronously. Does nothing by default.
+  virtual void PrefetchItem(const KeyType&) const {}
+};
+
+// Results of processing the batch of requests. Buffers are reused when the
+// same result is passed to the batch processing methods again.
+template <typename KeyType>
+struct CacheBatchResult {
+  // hits[i] is 1 if the i-th requested item was in cache (get requests only)
+  std::vector<uint8_t> hits;
+
+  // Keys of the items loaded to and unloaded from memory during the batch
+  // processing in the order of these operations
+  std::vector<KeyType> admitted_keys;
+  std::vector<KeyType> evicted_keys;
+
+  // Keys of the items prefetched after the batch (get requests only)
+  std::vector<KeyType> prefetched_keys;
+};
+
+// Prefetch statistics (see MarkovChainCacheConfig::prefetch_max_items)
+struct CachePrefetchStats {
+  // Number and total size of the prefetched items
+  size_t num_prefetched_items = 0;
+  double prefetched_bytes = 0;
+
+  // Number of the prefetched items, which were requested while in cache
+  size_t num_prefetch_hits = 0;
+
+  // Total size of the prefetched items, which were unloaded from cache before
+  // being requested
+  double wasted_bytes = 0;
 };
 
+// Forecast length template parameter value, which means that the forecast
+// length is taken from the cache config at runtime
+constexpr size_t kRuntimeForecastLength = 0;
+
 struct MarkovChainCacheConfig {
   float cache_capacity = 512;
   std::string stats_accumulator_type = "transitions";
@@ -23,17 +83,149 @@ struct MarkovChainCacheConfig {
 
   // Cache parameter for regulating Markov chain forecast length
   size_t forecast_length = 1;
+
+  // Long (>1) forecasts truncation parameters: after each forecast step states
+  // with probabilities below forecast_epsilon are dropped and at most
+  // forecast_max_states most probable states are kept (0 means no limit). See
+  // SparseForecastEngine for the accuracy guarantees.
+  float forecast_epsilon = 0;
+  size_t forecast_max_states = 0;
+
+  // Asynchronous model updates: the request path only enqueues the observed
+  // transitions into a bounded lock-free queue, and a background learner thread
+  // applies them to the Markov chain in batches of at most learner_batch_size
+  // transitions. Eviction decisions are made with a slightly stale, but
+  // consistent model. Transitions are dropped if the queue is full.
+  bool async_model_updates = false;
+  size_t transitions_queue_capacity = 1 << 16;
+  size_t learner_batch_size = 1024;
+
+  // Cap on the number of tracked items (0 means no limit). When the cap is
+  // reached, retired_states_fraction of the cap of the least accessed items,
+  // which are not in cache, are retired: their keys are forgotten and their
+  // Markov chain states are reused for the new items. Thus, the memory
+  // footprint and the prediction cost stay bounded. The cap is exceeded only
+  // if there are no items to retire. States of the deleted items are also
+  // removed from Markov chain in batches: once their number reaches
+  // retired_states_fraction of the number of states.
+  size_t max_states = 0;
+  float retired_states_fraction = 0.125;
+
+  // Exponential decay of the transitions statistics, so the model adapts to
+  // the changing access patterns: statistics collected decay_half_life ago
+  // weigh twice less than the fresh ones (0 means no decay). Half-life is
+  // measured in requests ("requests") or in the units of time set with
+  // `SetTime` ("timestamps").
+  float decay_half_life = 0;
+  std::string decay_time_unit = "requests";
+
+  // Eviction watermarks. Cache capacity is the high watermark: items are
+  // evicted when it is exceeded. Eviction then frees the space down to
+  // eviction_low_watermark fraction of the capacity, so the cost of ranking
+  // the items in cache is amortized over the following misses (1 means that
+  // only the required space is freed).
+  float eviction_low_watermark = 1;
+
+  // Predictive prefetch: after each get request at most prefetch_max_items
+  // items, which are not in cache, but are likely to be requested next, are
+  // loaded ahead of time (0 disables prefetch). Only the items with the
+  // transition probability of at least prefetch_probability_threshold are
+  // prefetched, and at most prefetch_budget bytes are prefetched per request
+  // (0 means no limit). Predictions are given by the observed transitions from
+  // the requested item, so nothing is prefetched until it has enough
+  // statistics (see accesses_threshold). Prefetched item replaces only the
+  // items, which are cheaper than it, and delegate is notified with
+  // PrefetchItem instead of AdmitItem.
+  size_t prefetch_max_items = 0;
+  float prefetch_probability_threshold = 0.25f;
+  float prefetch_budget = 0;
+
+  // Admission filter: the item missed on a get request is loaded only if it is
+  // not cheaper than the items it would replace, just like in
+  // `ProcessSetRequest`, otherwise it bypasses the cache. Costs are predicted
+  // from the previously requested item, so the misses the model does not
+  // predict (e.g. one-hit wonders) do not push the useful items out. Access
+  // frequencies of the keys are also counted in the count-min sketch of
+  // admission_sketch_width counters per row (see FrequencySketch, 0 means
+  // kDefaultAdmissionSketchWidth), and the items missed after the items with
+  // few observations (see accesses_threshold) are admitted only if they were
+  // requested more often than each of the items they would replace, as in
+  // TinyLFU. Without the sketch such items would never be admitted, which
+  // freezes the cache on the workloads with a poorly predictable part, so the
+  // sketch is always enabled with the filter. Batched get requests are not
+  // filtered.
+  bool admission_filter = false;
+  size_t admission_sketch_width = 0;
+
+  // Higher order model: transitions are also counted for the contexts of
+  // model_order last requested items (1 means the first order model only), so
+  // the items, which are predictable only from several previous requests, are
+  // predicted as well. Contexts are hashed into the bounded table of
+  // context_table_size slots, and at most context_max_successors items
+  // observed after each context are kept (see ContextModel). One step
+  // forecasts are given by the successors of the current context, if it has
+  // enough statistics (see accesses_threshold), then by the transitions from
+  // the previously requested item and then by stats accumulator. Long (>1)
+  // forecasts do not use contexts. The context table is not saved to
+  // snapshots.
+  size_t model_order = 1;
+  size_t context_table_size = 1 << 16;
+  size_t context_max_successors = 16;
+
+  // Bounded rows of the transitions stats: at most max_successors most
+  // observed items are kept for each item (0 means no limit), and the rest of
+  // transitions from it are accounted in its residual mass, which is spread
+  // over all the items by stats accumulator (see EvolvingMarkovChain). Thus,
+  // the model takes O(number of items * max_successors) memory. Eviction
+  // ranking by the transitions row of the hot item treats the items outside
+  // the row as never observed after it, as for the unbounded rows, so the
+  // residual mass affects only full predictions (batches and long forecasts).
+  size_t max_successors = 0;
+
+  // Width of the counters in the transitions stats: 0 for floats, 8 or 16 for
+  // compact integer counters. Each stored successor takes 5 or 6 bytes instead
+  // of 8, since its 32-bit index is kept as is (see SparseVector), plus the
+  // spare capacity of the row arrays as before. Compact counters are aged by
+  // halving, which replaces the lazy decay, and each row is halved before its
+  // counters saturate, so the rows of frequently requested items adapt
+  // faster. accesses_threshold should not exceed a half of the counter
+  // maximum.
+  size_t counter_bits = 0;
 };
 
-template <typename KeyType>
+// Markov chain based cache. Default template parameters give the cache
+// configured at runtime. Policies may be fixed at compile time instead, so the
+// corresponding checks and virtual calls are resolved statically:
+// Accumulator - one of the concrete stats accumulators, in which case the
+// stats accumulator type from config is ignored;
+// ForecastLength - forecast length, which overrides the one from config;
+// Delegate - delegate type, which is not necessarily derived from
+// CacheDelegate (e.g. a final class). PrefetchItem is optional for such types,
+// the prefetched items are reported with AdmitItem without it.
+template <typename KeyType, typename Accumulator = StatsAccumulator,
+          size_t ForecastLength = kRuntimeForecastLength,
+          typename Delegate = CacheDelegate<KeyType>>
 class MarkovChainCache {
  public:
+  // Returns true if the item is in cache. Keys of the retired and deleted
+  // items are not known to the cache, so such items are not loaded to cache and
+  // should be set again (see `Contains`).
   bool ProcessGetRequest(const KeyType& key) {
-    assert(key_to_state_map_.count(key) != 0);
+    const size_t state = key_to_state_index_.Find(key);
+
+    if (state == KeyToStateIndex::kNotFound) {
+      return false;
+    }
 
-    if (items_in_cache_sizes_.count(key) != 0) {
+    if (frequency_sketch_) {
+      frequency_sketch_->Increment(key);
+    }
+
+    if (IsInCache(state)) {
       // Element is already in cache, nothing to do
-      UpdateTransitionStats(key);
+      RegisterPrefetchHit(state);
+      UpdateTransitionStats(state);
+      Prefetch(state, nullptr);
       return true;
     }
 
@@ -41,197 +233,1710 @@ class MarkovChainCache {
     // `ProcessSetRequest` method, so check the detailed comments on logic in
     // `ProcessSetRequest`.
 
-    const float item_size = items_not_in_cache_sizes_.at(key);
+    const float item_size = item_sizes_[state];
     const float space_to_free =
         (current_cache_size_ + item_size) - cfg_.cache_capacity;
 
     if (space_to_free > 0) {
-      const size_t markov_chain_current_state = key_to_state_map_[key];
-      const size_t markov_chain_num_states = markov_chain_.GetNumStates();
+      // Admission filter compares the costs predicted from the previous state,
+      // i.e. the ones the missed item had before it was requested
+      const size_t prev_state = GetPrevState();
+      const bool is_filtered =
+          cfg_.admission_filter && prev_state != kNotResident;
+      const bool is_sketch_filtered =
+          is_filtered && IsSketchAdmission(prev_state);
+
+      if (is_filtered && !is_sketch_filtered &&
+          !IsAdmittedByModel(prev_state, state, space_to_free)) {
+        UpdateTransitionStats(state);
+        Prefetch(state, nullptr);
+        return false;
+      }
+
+      const float eviction_target = GetEvictionTarget(space_to_free);
+
+      std::vector<size_t>& eviction_candidates = workspace_.eviction_candidates;
+      eviction_candidates.clear();
 
-      Vector<float> costs(markov_chain_num_states, FillType::kZeros);
-      Vector<float> wrapped_item_sizes(item_sizes_.data(), item_sizes_.size());
+      // The item becomes the last one in the context
+      const uint64_t context = GetNextContext(state);
 
-      if (cfg_.forecast_length == 1) {
-        markov_chain_.PredictNextState(markov_chain_current_state, &costs);
+      std::unique_lock<std::mutex> model_lock = LockModel();
+      const SparseVector<float>* row = FindOneStepForecastRow(state, context);
+
+      if (row) {
+        CollectRowEvictionCandidates(*row, eviction_target, false, kMaxCost,
+                                     &eviction_candidates);
+        model_lock = {};
       } else {
-        Vector<float> state(markov_chain_num_states, FillType::kZeros);
-        state(markov_chain_current_state) = 1;
+        model_lock = {};
 
-        for (size_t i = 0; i < cfg_.forecast_length; ++i) {
-          state = markov_chain_.PredictNextState(state);
-          costs.AddElements(state);
-        }
-      }
+        std::vector<size_t>& predicted_states = workspace_.predicted_states;
+        predicted_states.assign(resident_states_.begin(),
+                                resident_states_.end());
 
-      costs.MulElements(wrapped_item_sizes);
+        PredictProbabilities(state, context, predicted_states,
+                             &workspace_.predicted_probabilities);
 
-      std::vector<size_t> eviction_candidate_states(costs.GetSize());
-      std::iota(eviction_candidate_states.begin(),
-                eviction_candidate_states.end(), 0);
+        std::vector<EvictionCandidate>& eviction_candidates_heap =
+            workspace_.eviction_candidates_heap;
+        BuildEvictionCandidatesHeap(workspace_.predicted_probabilities.data(),
+                                    &eviction_candidates_heap);
 
-      std::sort(eviction_candidate_states.begin(),
-                eviction_candidate_states.end(),
-                [&](size_t i, size_t j) { return costs(i) < costs(j); });
+        float size_accumulator = 0;
 
-      Evict(space_to_free, eviction_candidate_states);
+        while (size_accumulator < eviction_target &&
+               !eviction_candidates_heap.empty()) {
+          const EvictionCandidate candidate =
+              PopEvictionCandidate(&eviction_candidates_heap);
 
-      items_not_in_cache_sizes_.erase(key);
-    }
+          eviction_candidates.push_back(candidate.second);
+          size_accumulator += item_sizes_[candidate.second];
+        }
+      }
 
-    if (delegate_) {
-      delegate_->AdmitItem(key);
+      if (is_sketch_filtered &&
+          !IsAdmittedBySketch(key, eviction_candidates, space_to_free)) {
+        RestoreResidentStatesOrder();
+        UpdateTransitionStats(state);
+        Prefetch(state, nullptr);
+        return false;
+      }
+
+      Evict(eviction_target, eviction_candidates);
+      RestoreResidentStatesOrder();
     }
 
-    items_in_cache_sizes_[key] = item_size;
-    current_cache_size_ += item_size;
-    UpdateTransitionStats(key);
+    Admit(state);
+    UpdateTransitionStats(state);
+    Prefetch(state, nullptr);
 
     return false;
   }
 
+  // Saves the new item or overwrites the existing one. Overwritten item keeps
+  // its transitions statistics, but it is unloaded from cache (if it is there)
+  // and then saved as a new one with the new size.
   void ProcessSetRequest(const KeyType& key, float item_size) {
     assert(item_size <= cfg_.cache_capacity);
     assert(item_size > 0);
 
-    // We register the new state corresponding to th element which we are saving
-    // now beforehand to determine if we could save it on disk right away
-    // without a need to free space in cache.
-    AddNewState(key, item_size);
+    size_t state = key_to_state_index_.Find(key);
+    const bool is_new_item = state == KeyToStateIndex::kNotFound;
+
+    if (is_new_item) {
+      // We register the new state corresponding to th element which we are
+      // saving now beforehand to determine if we could save it on disk right
+      // away without a need to free space in cache.
+      state = AddNewState(key, item_size);
+    } else {
+      if (IsInCache(state)) {
+        Evict(state);
+      }
+
+      item_sizes_[state] = item_size;
+    }
 
     const float space_to_free =
         (current_cache_size_ + item_size) - cfg_.cache_capacity;
 
     if (space_to_free > 0) {
-      const size_t markov_chain_num_states = markov_chain_.GetNumStates();
-      const size_t markov_chain_current_state =
-          !prev_requested_item_key_state_ ? 0 : *prev_requested_item_key_state_;
-
-      Vector<float> costs(markov_chain_num_states, FillType::kZeros);
-      Vector<float> wrapped_item_sizes(item_sizes_.data(), item_sizes_.size());
-
-      if (cfg_.forecast_length == 1) {
-        // In this case we are able to use the more efficient way to make a
-        // prediction
-        markov_chain_.PredictNextState(markov_chain_current_state, &costs);
-
-        // (markov_chain_num_states - 1) state is the state corresponding to the
-        // dataset being saved. Transition probability to it is apparently zero,
-        // but most likely we don't want to instantly move it to disk. Instead,
-        // we "fix" the probability with a probability given by stats
-        // accumulator.
-        costs(markov_chain_num_states - 1) =
-            markov_chain_.GetTransitionProbabilityFromAccumulator(
-                markov_chain_current_state, markov_chain_num_states - 1);
+      const size_t markov_chain_current_state = GetPrevState();
+
+      // Elements are being unloaded in the ascending order of their costs
+      // until the required number of bytes is freed. There might be a
+      // situation when the cost of replacing the element currently being saved
+      // is that small, so it is a candidate to replace. In such case there is
+      // no sense of replacing any elements from cache, so we just place the
+      // freshly added element to disk right away. Thus, we only collect the
+      // elements which are cheaper than the one being saved (in case of equal
+      // costs the element being saved goes first). If there are enough such
+      // elements, they are unloaded down to the low watermark.
+      const float eviction_target = GetEvictionTarget(space_to_free);
+
+      std::vector<size_t>& eviction_candidates = workspace_.eviction_candidates;
+      eviction_candidates.clear();
+
+      const float size_accumulator = CollectCheaperEvictionCandidates(
+          markov_chain_current_state, context_, state, is_new_item,
+          eviction_target, &eviction_candidates);
+
+      if (size_accumulator <= space_to_free) {
+        RestoreResidentStatesOrder();
+        return;
+      }
+
+      Evict(eviction_target, eviction_candidates);
+      RestoreResidentStatesOrder();
+    }
+
+    Admit(state);
+  }
+
+  // Processes the batch of get requests. Hits are resolved against the cache
+  // contents at the beginning of the batch and transitions are registered in
+  // the order of requests. Then the missed items are loaded with the single
+  // eviction plan made with the single prediction from the state of the last
+  // requested item, instead of one per miss. Repeatedly missed items are
+  // loaded once. If the missed items do not fit into the cache altogether, the
+  // most recently requested ones are loaded. Delegate is notified as usual.
+  void ProcessGetBatch(const KeyType* keys, size_t num_keys,
+                       CacheBatchResult<KeyType>* result) {
+    assert(num_keys == 0 || keys);
+    assert(result);
+
+    result->hits.assign(num_keys, 0);
+    result->admitted_keys.clear();
+    result->evicted_keys.clear();
+    result->prefetched_keys.clear();
+
+    // 1. Resolve hits and register transitions
+
+    std::vector<size_t>& missed_states = workspace_.batch_states;
+    missed_states.clear();
+
+    for (size_t i = 0; i < num_keys; ++i) {
+      const size_t state = key_to_state_index_.Find(keys[i]);
+
+      if (state == KeyToStateIndex::kNotFound) {
+        continue;
+      }
+
+      if (frequency_sketch_) {
+        frequency_sketch_->Increment(keys[i]);
+      }
+
+      if (IsInCache(state)) {
+        result->hits[i] = 1;
+        RegisterPrefetchHit(state);
       } else {
-        // Fill the vector representing current state
-        Vector<float> state(markov_chain_num_states, FillType::kZeros);
-        state(markov_chain_current_state) = 1;
-
-        // Make predictions regarding forecast_length, and sum the
-        // probabilities. It is not that formal, but we interpret this as a
-        // cumulative cost of replacing by mistake.
-        for (size_t i = 0; i < cfg_.forecast_length; ++i) {
-          state = markov_chain_.PredictNextState(state);
-          costs.AddElements(state);
-        }
+        missed_states.push_back(state);
       }
 
-      // Weight probabilities by the corresponding element sizes
-      costs.MulElements(wrapped_item_sizes);
+      UpdateTransitionStats(state);
+    }
 
-      // Sort costs in the ascending order
-      std::vector<size_t> eviction_candidates(costs.GetSize());
-      std::iota(eviction_candidates.begin(), eviction_candidates.end(), 0);
+    // 2. Choose the items to load starting from the most recently requested
+    // ones
 
-      const size_t markov_chain_state_for_saving_item = key_to_state_map_[key];
-      std::sort(eviction_candidates.begin(), eviction_candidates.end(),
-                [&](size_t i, size_t j) {
-                  return costs(i) < costs(j) ||
-                         (costs(i) == costs(j) &&
-                          i == markov_chain_state_for_saving_item);
-                });
+    std::vector<size_t>& states_to_admit = workspace_.batch_states_to_admit;
+    std::vector<uint8_t>& batch_states_mask = workspace_.batch_states_mask;
+    states_to_admit.clear();
+    batch_states_mask.resize(item_sizes_.size());
 
-      // Elements are being unloaded according to their indexes in the `ind`
-      // vector until the required number of bytes is freed. There might be a
-      // situation when the cost of replacing the element currently being saved
-      // is that small, so it is a candidate to replace. In such case there is
-      // no sense of replacing any elements from cache, so we just place the
-      // freshly added element to disk right away
+    float admitted_size = 0;
+
+    for (auto it = missed_states.rbegin(); it != missed_states.rend(); ++it) {
+      if (batch_states_mask[*it] ||
+          admitted_size + item_sizes_[*it] > cfg_.cache_capacity) {
+        continue;
+      }
+
+      batch_states_mask[*it] = 1;
+      states_to_admit.push_back(*it);
+      admitted_size += item_sizes_[*it];
+    }
+
+    for (const auto& state : states_to_admit) {
+      batch_states_mask[state] = 0;
+    }
+
+    if (states_to_admit.empty()) {
+      Prefetch(GetPrevState(), result);
+      return;
+    }
+
+    // 3. Free space for all of them at once
+
+    const float space_to_free =
+        (current_cache_size_ + admitted_size) - cfg_.cache_capacity;
+
+    if (space_to_free > 0) {
+      std::vector<size_t>& predicted_states = workspace_.predicted_states;
+      predicted_states.assign(resident_states_.begin(), resident_states_.end());
+
+      PredictProbabilities(GetPrevState(), context_, predicted_states,
+                           &workspace_.predicted_probabilities);
+
+      std::vector<EvictionCandidate>& eviction_candidates_heap =
+          workspace_.eviction_candidates_heap;
+      BuildEvictionCandidatesHeap(workspace_.predicted_probabilities.data(),
+                                  &eviction_candidates_heap);
+
+      const float eviction_target = GetEvictionTarget(space_to_free);
+
+      std::vector<size_t>& eviction_candidates = workspace_.eviction_candidates;
+      eviction_candidates.clear();
       float size_accumulator = 0;
 
-      for (const auto& i : eviction_candidates) {
-        const KeyType& tmp_key = state_to_key_map_[i];
+      while (size_accumulator < eviction_target &&
+             !eviction_candidates_heap.empty()) {
+        const EvictionCandidate candidate =
+            PopEvictionCandidate(&eviction_candidates_heap);
+
+        eviction_candidates.push_back(candidate.second);
+        size_accumulator += item_sizes_[candidate.second];
+      }
+
+      Evict(eviction_target, eviction_candidates);
+      CollectEvictedKeys(eviction_candidates, result);
+    }
+
+    for (const auto& state : states_to_admit) {
+      Admit(state);
+      result->admitted_keys.push_back(state_to_key_map_[state]);
+    }
+
+    Prefetch(GetPrevState(), result);
+  }
+
+  // Processes the batch of set requests. All the items are saved or
+  // overwritten first, and then the single prediction from the state of the
+  // previously requested item is made for the items in cache and the saved
+  // ones. Saved items are considered in the descending order of their costs,
+  // and each of them is loaded if it is not cheaper than the items it would
+  // replace, just like in `ProcessSetRequest`. The items loaded during the
+  // batch are not replaced by the cheaper ones. If the same key is repeated,
+  // the last size is used. Delegate is notified as usual.
+  void ProcessSetBatch(const KeyType* keys, const float* item_sizes,
+                       size_t num_keys, CacheBatchResult<KeyType>* result) {
+    assert(num_keys == 0 || (keys && item_sizes));
+    assert(result);
+
+    result->hits.clear();
+    result->admitted_keys.clear();
+    result->evicted_keys.clear();
+    result->prefetched_keys.clear();
+
+    // 1. Save the new items and overwrite the existing ones. The new items are
+    // not loaded yet, so they are retired beforehand to prevent retiring the
+    // items of this batch.
+
+    if (cfg_.max_states != 0) {
+      size_t num_new_items = 0;
+
+      for (size_t i = 0; i < num_keys; ++i) {
+        num_new_items +=
+            key_to_state_index_.Find(keys[i]) == KeyToStateIndex::kNotFound;
+      }
+
+      while (key_to_state_index_.GetSize() + num_new_items > cfg_.max_states &&
+             RetireStates() != 0) {
+        // Retire until there is enough room or nothing to retire
+      }
+    }
+
+    std::vector<BatchItem>& batch_items = workspace_.batch_items;
+    batch_items.clear();
+
+    for (size_t i = 0; i < num_keys; ++i) {
+      assert(item_sizes[i] <= cfg_.cache_capacity);
+      assert(item_sizes[i] > 0);
+
+      size_t state = key_to_state_index_.Find(keys[i]);
+      const bool is_new_item = state == KeyToStateIndex::kNotFound;
 
-        if (items_in_cache_sizes_.count(tmp_key) != 0) {
-          size_accumulator += items_in_cache_sizes_[tmp_key];
+      if (is_new_item) {
+        state = RegisterNewItem(keys[i], item_sizes[i]);
+      } else {
+        if (IsInCache(state)) {
+          Evict(state);
+          result->evicted_keys.push_back(keys[i]);
         }
 
-        if (tmp_key == key) {
-          break;
+        item_sizes_[state] = item_sizes[i];
+      }
+
+      batch_items.push_back({state, is_new_item, 0});
+    }
+
+    // Repeated items are merged, the first occurrence tells whether the item
+    // is new
+    std::stable_sort(batch_items.begin(), batch_items.end(),
+                     [](const BatchItem& lhs, const BatchItem& rhs) {
+                       return lhs.state < rhs.state;
+                     });
+    batch_items.erase(
+        std::unique(batch_items.begin(), batch_items.end(),
+                    [](const BatchItem& lhs, const BatchItem& rhs) {
+                      return lhs.state == rhs.state;
+                    }),
+        batch_items.end());
+
+    // 2. Predict the probabilities for the items in cache and the saved items,
+    // which go last. Probabilities of the new items are fixed as in
+    // `ProcessSetRequest`.
+
+    const size_t markov_chain_current_state = GetPrevState();
+
+    std::vector<size_t>& predicted_states = workspace_.predicted_states;
+    predicted_states.assign(resident_states_.begin(), resident_states_.end());
+
+    for (const auto& item : batch_items) {
+      predicted_states.push_back(item.state);
+    }
+
+    std::vector<float>& predicted_probabilities =
+        workspace_.predicted_probabilities;
+    PredictProbabilities(markov_chain_current_state, context_,
+                         predicted_states, &predicted_probabilities);
+
+    {
+      std::unique_lock<std::mutex> model_lock = LockModel();
+
+      for (size_t i = 0; i < batch_items.size(); ++i) {
+        BatchItem& item = batch_items[i];
+        float probability =
+            predicted_probabilities[resident_states_.size() + i];
+
+        if (item.is_new && GetForecastLength() == 1 &&
+            markov_chain_current_state != kNotResident) {
+          probability = markov_chain_.GetTransitionProbabilityFromAccumulator(
+              markov_chain_current_state, item.state);
         }
+
+        // Without the current state the saved items are loaded in any case
+        // (see CollectCheaperEvictionCandidates)
+        item.cost = markov_chain_current_state != kNotResident
+                        ? probability * item_sizes_[item.state]
+                        : kMaxCost;
       }
+    }
 
-      if (size_accumulator <= space_to_free) {
-        items_not_in_cache_sizes_[key] = item_size;
-        return;
+    std::sort(batch_items.begin(), batch_items.end(),
+              [](const BatchItem& lhs, const BatchItem& rhs) {
+                return lhs.cost > rhs.cost ||
+                       (lhs.cost == rhs.cost && lhs.state < rhs.state);
+              });
+
+    // 3. Load the saved items replacing the cheaper items in cache
+
+    std::vector<EvictionCandidate>& eviction_candidates_heap =
+        workspace_.eviction_candidates_heap;
+    BuildEvictionCandidatesHeap(predicted_probabilities.data(),
+                                &eviction_candidates_heap);
+
+    std::vector<size_t>& eviction_candidates = workspace_.eviction_candidates;
+    std::vector<EvictionCandidate>& popped_candidates =
+        workspace_.popped_eviction_candidates;
+
+    for (const auto& item : batch_items) {
+      const float space_to_free =
+          (current_cache_size_ + item_sizes_[item.state]) -
+          cfg_.cache_capacity;
+
+      if (space_to_free > 0) {
+        const float eviction_target = GetEvictionTarget(space_to_free);
+
+        eviction_candidates.clear();
+        popped_candidates.clear();
+        float size_accumulator = 0;
+
+        while (size_accumulator <= eviction_target &&
+               !eviction_candidates_heap.empty() &&
+               eviction_candidates_heap.front().first < item.cost) {
+          const EvictionCandidate candidate =
+              PopEvictionCandidate(&eviction_candidates_heap);
+
+          popped_candidates.push_back(candidate);
+          eviction_candidates.push_back(candidate.second);
+          size_accumulator += item_sizes_[candidate.second];
+        }
+
+        if (size_accumulator > space_to_free) {
+          Evict(eviction_target, eviction_candidates);
+          CollectEvictedKeys(eviction_candidates, result);
+        }
+
+        // Candidates, which are still in cache, are returned to the heap for
+        // the next items
+        for (const auto& candidate : popped_candidates) {
+          if (IsInCache(candidate.second)) {
+            PushEvictionCandidate(candidate, &eviction_candidates_heap);
+          }
+        }
+
+        if (size_accumulator <= space_to_free) {
+          continue;
+        }
       }
 
-      Evict(space_to_free, eviction_candidates);
+      Admit(item.state);
+      result->admitted_keys.push_back(state_to_key_map_[item.state]);
+    }
+  }
+
+  // Deletes the item. If it is in cache, it is unloaded without notifying the
+  // delegate, since the item does not exist anymore. Its Markov chain state is
+  // reused for the new items after being removed from the model (this is done
+  // in batches). Returns false if the item is unknown.
+  bool ProcessDeleteRequest(const KeyType& key) {
+    const size_t state = key_to_state_index_.Find(key);
+
+    if (state == KeyToStateIndex::kNotFound) {
+      return false;
     }
 
-    if (delegate_) {
-      delegate_->AdmitItem(key);
+    if (IsInCache(state)) {
+      current_cache_size_ -= item_sizes_[state];
+      RemoveResidentState(state);
     }
 
-    items_in_cache_sizes_[key] = item_size;
-    current_cache_size_ += item_size;
+    ForgetItem(state);
+
+    const size_t batch_size = std::max<size_t>(
+        kMinStatesRemovalBatchSize,
+        cfg_.retired_states_fraction * markov_chain_.GetNumStates());
+
+    if (states_to_remove_.size() >= batch_size) {
+      // Queued transitions may refer to the removed states, so they are
+      // applied beforehand
+      WaitForModelUpdates();
+
+      std::unique_lock<std::mutex> model_lock = LockModel();
+      RemovePendingStates();
+    }
+
+    return true;
   }
 
   void Flush() {
-    items_not_in_cache_sizes_.insert(items_in_cache_sizes_.begin(),
-                                     items_in_cache_sizes_.end());
-    items_in_cache_sizes_.clear();
     current_cache_size_ = 0;
+
+    for (const auto& state : resident_states_) {
+      resident_states_positions_[state] = kNotResident;
+      prefetched_states_mask_[state] = 0;
+    }
+
+    resident_states_.clear();
+    resident_states_by_number_.Clear();
+  }
+
+  // Sets the current time, e.g. the timestamp of the request being processed.
+  // Time should not decrease. Used for the statistics decay measured in
+  // timestamps, otherwise it is ignored.
+  void SetTime(double time) {
+    assert(time >= current_time_);
+
+    if (decay_per_time_unit_ != 0) {
+      // Long enough pause erases the history almost completely, the factor is
+      // bounded to keep the model weights finite
+      pending_decay_factor_ = std::max(
+          kMinDecayFactor,
+          static_cast<float>(pending_decay_factor_ *
+                             std::exp2(-(time - current_time_) *
+                                       decay_per_time_unit_)));
+    }
+
+    current_time_ = time;
+  }
+
+  // Returns true if the item is tracked by the cache, i.e. it was set and was
+  // neither retired nor deleted
+  bool Contains(const KeyType& key) const {
+    return key_to_state_index_.Find(key) != KeyToStateIndex::kNotFound;
+  }
+
+  size_t GetNumTrackedItems() const { return key_to_state_index_.GetSize(); }
+
+  // Returns the number of Markov chain states including the states of retired
+  // and deleted items, which are reserved for reuse
+  size_t GetNumStates() const { return markov_chain_.GetNumStates(); }
+
+  // Blocks until all the enqueued transitions are applied to the model. Does
+  // nothing if the model is updated synchronously.
+  void WaitForModelUpdates() const {
+    while (num_applied_transitions_.load(std::memory_order_acquire) !=
+           num_enqueued_transitions_) {
+      std::this_thread::yield();
+    }
+  }
+
+  // Returns the number of transitions dropped because of the transitions queue
+  // overflow in asynchronous model updates mode
+  size_t GetNumDroppedTransitions() const { return num_dropped_transitions_; }
+
+  const CachePrefetchStats& GetPrefetchStats() const { return prefetch_stats_; }
+
+  // Saves the learned model to the binary snapshot file (see snapshot.h):
+  // Markov chain statistics, keys and sizes of the tracked items and the
+  // pending decay. Items in cache are not saved, since their data does not
+  // survive the restart anyway. The snapshot is written to a temporary file,
+  // which is then renamed, so the existing snapshot is replaced atomically.
+  // Keys are written as is, so they should be trivially copyable. Returns
+  // false if the file can not be written.
+  bool SaveSnapshot(const std::string& path) {
+    static_assert(std::is_trivially_copyable<KeyType>::value,
+                  "Snapshots require trivially copyable keys");
+
+    const std::string temporary_path = path + ".tmp";
+    std::ofstream stream(temporary_path, std::ios::binary | std::ios::trunc);
+    SnapshotWriter writer(&stream);
+
+    WaitForModelUpdates();
+
+    writer.Write(kSnapshotMagic);
+    writer.Write(kSnapshotVersion);
+    writer.Write<uint32_t>(sizeof(size_t));
+    writer.Write<uint32_t>(sizeof(KeyType));
+
+    // Retired and deleted items keep their keys in the state to key map, so
+    // the tracked ones are marked explicitly
+    std::vector<uint8_t> tracked_states_mask(state_to_key_map_.size());
+
+    for (size_t state = 0; state < state_to_key_map_.size(); ++state) {
+      tracked_states_mask[state] =
+          key_to_state_index_.Find(state_to_key_map_[state]) == state;
+    }
+
+    writer.WriteVector(state_to_key_map_);
+    writer.WriteVector(item_sizes_);
+    writer.WriteVector(tracked_states_mask);
+    writer.WriteVector(states_to_remove_);
+    writer.Write<uint8_t>(prev_requested_item_key_state_ != nullptr);
+    writer.Write<uint64_t>(
+        !prev_requested_item_key_state_ ? 0 : *prev_requested_item_key_state_);
+    writer.Write(current_time_);
+    writer.Write(pending_decay_factor_);
+
+    std::unique_lock<std::mutex> model_lock = LockModel();
+    markov_chain_.Save(&writer);
+    model_lock = {};
+
+    stream.close();
+
+    if (!writer.IsOk() || !stream) {
+      std::remove(temporary_path.c_str());
+      return false;
+    }
+
+    return std::rename(temporary_path.c_str(), path.c_str()) == 0;
+  }
+
+  // Loads the model saved with SaveSnapshot, so the cache resumes with the
+  // learned transitions instead of learning them from scratch. The file is
+  // memory mapped, so the model is copied from the page cache directly without
+  // intermediate buffering. Cache should not have processed any requests yet
+  // and should have the same stats accumulator type as the saved one (the rest
+  // of config is not required to match). All the loaded items are on disk.
+  // Returns false if the file is missing, was written by another snapshot
+  // version or platform, or is malformed, in which case the cache is left
+  // empty.
+  bool LoadSnapshot(const std::string& path) {
+    static_assert(std::is_trivially_copyable<KeyType>::value,
+                  "Snapshots require trivially copyable keys");
+    assert(markov_chain_.GetNumStates() == 0);
+
+    MappedFile file;
+
+    if (!file.Open(path)) {
+      return false;
+    }
+
+    SnapshotReader reader(file.GetData(), file.GetSize());
+
+    uint32_t magic = 0;
+    uint32_t version = 0;
+    uint32_t size_t_size = 0;
+    uint32_t key_size = 0;
+
+    if (!reader.Read(&magic) || magic != kSnapshotMagic ||
+        !reader.Read(&version) || version != kSnapshotVersion ||
+        !reader.Read(&size_t_size) || size_t_size != sizeof(size_t) ||
+        !reader.Read(&key_size) || key_size != sizeof(KeyType)) {
+      return false;
+    }
+
+    // Items metadata is read to the local buffers and applied only after Markov
+    // chain is loaded successfully
+    std::vector<KeyType> state_to_key_map;
+    std::vector<float> item_sizes;
+    std::vector<uint8_t> tracked_states_mask;
+    std::vector<size_t> states_to_remove;
+    uint8_t has_prev_state = 0;
+    uint64_t prev_state = 0;
+    double current_time = 0;
+    float pending_decay_factor = 0;
+
+    if (!reader.ReadVector(&state_to_key_map) ||
+        !reader.ReadVector(&item_sizes) ||
+        !reader.ReadVector(&tracked_states_mask) ||
+        !reader.ReadVector(&states_to_remove) ||
+        !reader.Read(&has_prev_state) || !reader.Read(&prev_state) ||
+        !reader.Read(&current_time) || !reader.Read(&pending_decay_factor)) {
+      return false;
+    }
+
+    const size_t num_states = state_to_key_map.size();
+
+    if (item_sizes.size() != num_states ||
+        tracked_states_mask.size() != num_states ||
+        (has_prev_state && prev_state >= num_states) ||
+        !(pending_decay_factor > 0)) {
+      return false;
+    }
+
+    for (const auto& state : states_to_remove) {
+      if (state >= num_states || tracked_states_mask[state]) {
+        return false;
+      }
+    }
+
+    KeyToStateIndex key_to_state_index;
+
+    for (size_t state = 0; state < num_states; ++state) {
+      if (!tracked_states_mask[state]) {
+        continue;
+      }
+
+      const KeyType& key = state_to_key_map[state];
+
+      if (!(item_sizes[state] > 0) ||
+          key_to_state_index.Find(key) != KeyToStateIndex::kNotFound) {
+        return false;
+      }
+
+      key_to_state_index.Insert(key, state);
+    }
+
+    // Markov chain goes next, its number of states is checked beforehand on
+    // a copy of the reader, so nothing is modified if it does not match
+    SnapshotReader chain_reader = reader;
+    uint64_t chain_num_states = 0;
+
+    if (!chain_reader.Read(&chain_num_states) ||
+        chain_num_states != num_states) {
+      return false;
+    }
+
+    std::unique_lock<std::mutex> model_lock = LockModel();
+
+    if (!markov_chain_.Load(&reader)) {
+      return false;
+    }
+
+    model_lock = {};
+
+    key_to_state_index_ = std::move(key_to_state_index);
+    state_to_key_map_.swap(state_to_key_map);
+    item_sizes_.swap(item_sizes);
+    states_to_remove_.swap(states_to_remove);
+    resident_states_positions_.assign(num_states, kNotResident);
+    prefetched_states_mask_.assign(num_states, 0);
+    workspace_.row_states_mask.resize(
+        std::max(item_sizes_.size(), item_sizes_.capacity()));
+
+    if (has_prev_state) {
+      prev_requested_item_key_state_ = new KeyType;
+      *prev_requested_item_key_state_ = prev_state;
+    }
+
+    current_time_ = current_time;
+    pending_decay_factor_ = pending_decay_factor;
+
+    return true;
   }
 
   explicit MarkovChainCache(const MarkovChainCacheConfig& cfg,
-                            CacheDelegate<KeyType>* delegate = nullptr)
+                            Delegate* delegate = nullptr)
       : cfg_(cfg),
-        markov_chain_(cfg.stats_accumulator_type, cfg.accesses_threshold),
-        delegate_(delegate) {}
+        markov_chain_(cfg.stats_accumulator_type, cfg.accesses_threshold,
+                      cfg.max_successors, cfg.counter_bits),
+        forecast_engine_(cfg.forecast_epsilon, cfg.forecast_max_states),
+        delegate_(delegate) {
+    if (ForecastLength != kRuntimeForecastLength) {
+      cfg_.forecast_length = ForecastLength;
+    }
+
+    assert(cfg_.forecast_length > 0);
+    assert(cfg_.model_order > 0);
+    assert(cfg_.eviction_low_watermark > 0);
+    assert(cfg_.eviction_low_watermark <= 1);
+    assert(cfg_.prefetch_probability_threshold >= 0);
+    assert(cfg_.prefetch_budget >= 0);
+    assert(cfg_.decay_half_life >= 0);
+    assert(cfg_.decay_time_unit == "requests" ||
+           cfg_.decay_time_unit == "timestamps");
+
+    if (cfg_.decay_half_life > 0) {
+      if (cfg_.decay_time_unit == "requests") {
+        decay_per_request_factor_ = std::exp2(-1 / cfg_.decay_half_life);
+      } else {
+        decay_per_time_unit_ = 1 / cfg_.decay_half_life;
+      }
+    }
+
+    if (cfg_.async_model_updates) {
+      assert(cfg_.learner_batch_size > 0);
+
+      transitions_queue_.reset(
+          new SpscQueue<Transition>(cfg_.transitions_queue_capacity));
+      learner_thread_ = std::thread(&MarkovChainCache::RunLearner, this);
+    }
+
+    if (cfg_.model_order > 1) {
+      context_model_.reset(new ContextModel(cfg_.context_table_size,
+                                            cfg_.context_max_successors,
+                                            cfg_.accesses_threshold));
+      recent_states_.reserve(cfg_.model_order + 1);
+    }
+
+    if (cfg_.admission_filter) {
+      frequency_sketch_.reset(new FrequencySketch<KeyType>(
+          cfg_.admission_sketch_width != 0 ? cfg_.admission_sketch_width
+                                           : kDefaultAdmissionSketchWidth));
+    }
+  }
 
-  ~MarkovChainCache() { delete prev_requested_item_key_state_; }
+  ~MarkovChainCache() {
+    if (learner_thread_.joinable()) {
+      stop_learner_.store(true, std::memory_order_release);
+      learner_thread_.join();
+    }
+
+    delete prev_requested_item_key_state_;
+  }
 
  private:
+  // Eviction candidate is a pair of the cost of replacing the item by mistake
+  // and the state corresponding to the item.
+  typedef std::pair<float, size_t> EvictionCandidate;
+
+  // Retirement candidate is a pair of the number of accesses to the item and
+  // the state corresponding to the item.
+  typedef std::pair<float, size_t> RetirementCandidate;
+
+  // Item saved during the batch processing: its state, whether it is new and
+  // its cost of replacing by mistake.
+  struct BatchItem {
+    size_t state;
+    bool is_new;
+    float cost;
+  };
+
+  // Heap comparator, which places the cheapest candidate on the top of heap.
+  // Costs are often equal (e.g. zero for all the items, which were never
+  // observed after the current one), in such case the items registered later
+  // are evicted first, so the order of eviction is deterministic.
+  static bool EvictLater(const EvictionCandidate& lhs,
+                         const EvictionCandidate& rhs) {
+    return lhs.first > rhs.first ||
+           (lhs.first == rhs.first && lhs.second < rhs.second);
+  }
+
+  static constexpr size_t kNotResident = std::numeric_limits<size_t>::max();
+
+  static constexpr float kMaxCost = std::numeric_limits<float>::infinity();
+
+  // Deleted items states are removed from Markov chain in batches of at least
+  // this size
+  static const size_t kMinStatesRemovalBatchSize = 16;
+
+  // Width of the admission filter frequency sketch, if it is not configured
+  static const size_t kDefaultAdmissionSketchWidth = 4096;
+
+  static constexpr float kMinDecayFactor = 1e-6f;
+
+  // Learner thread sleeps for this time if there are no transitions to apply
+  static constexpr std::chrono::microseconds kLearnerIdleSleep{100};
+
+  // Transition observed on the request path, which is waiting to be applied
+  // to the model by the learner thread. Statistics are decayed by the given
+  // factor before the transition is registered. Context is the hash of the
+  // context preceding the transition (see MarkovChainCacheConfig::model_order).
+  struct Transition {
+    size_t from;
+    size_t to;
+    float decay_factor;
+    uint64_t context;
+  };
+
   // Markov chain stuff
-  void UpdateTransitionStats(const KeyType& key) {
-    assert(key_to_state_map_.count(key) != 0);
+  void UpdateTransitionStats(size_t state) {
+    const size_t prev_state = GetPrevState();
 
     if (!prev_requested_item_key_state_) {
-      markov_chain_.RegisterTransition(
-          !prev_requested_item_key_state_ ? 0 : *prev_requested_item_key_state_,
-          key_to_state_map_[key]);
       prev_requested_item_key_state_ = new KeyType;
+    }
+
+    *prev_requested_item_key_state_ = state;
+
+    const uint64_t context = context_;
+
+    if (context_model_) {
+      context_ = GetNextContext(state);
+      recent_states_.push_back(state);
+
+      if (recent_states_.size() == cfg_.model_order) {
+        recent_states_.erase(recent_states_.begin());
+      }
+    }
+
+    pending_decay_factor_ *= decay_per_request_factor_;
+
+    // The first request has no transition to it, its decay is applied with
+    // the next one
+    if (prev_state == kNotResident) {
+      return;
+    }
+
+    if (!transitions_queue_) {
+      ApplyTransition({prev_state, state, pending_decay_factor_, context});
+    } else if (transitions_queue_->TryPush(
+                   {prev_state, state, pending_decay_factor_, context})) {
+      num_enqueued_transitions_++;
     } else {
-      markov_chain_.RegisterTransition(*prev_requested_item_key_state_,
-                                       key_to_state_map_[key]);
+      // Decay of the dropped transition is applied with the next one
+      num_dropped_transitions_++;
+      return;
+    }
+
+    pending_decay_factor_ = 1;
+  }
+
+  void ApplyTransition(const Transition& transition) {
+    if (transition.decay_factor != 1) {
+      markov_chain_.Decay(transition.decay_factor);
+
+      if (context_model_) {
+        context_model_->Decay(transition.decay_factor);
+      }
+    }
+
+    markov_chain_.RegisterTransition(transition.from, transition.to);
+
+    if (transition.context != ContextModel::kNoContext) {
+      context_model_->RegisterTransition(transition.context, transition.to);
+    }
+  }
+
+  // Returns the hash of the context, which the given state completes if it is
+  // requested next: the last model_order - 1 requested states followed by it.
+  // Returns ContextModel::kNoContext if the context model is disabled or there
+  // were not enough requests yet.
+  uint64_t GetNextContext(size_t state) const {
+    if (!context_model_ || recent_states_.size() + 1 < cfg_.model_order) {
+      return ContextModel::kNoContext;
+    }
+
+    return ContextModel::HashContext(recent_states_.data(),
+                                     recent_states_.size(), state);
+  }
+
+  // Returns the amount of space to free, when the given amount of space is
+  // required: the cache is emptied down to the low watermark, so that the
+  // following misses do not require evictions for a while
+  float GetEvictionTarget(float space_to_free) const {
+    return std::min(cfg_.cache_capacity,
+                    space_to_free + (1 - cfg_.eviction_low_watermark) *
+                                        cfg_.cache_capacity);
+  }
+
+  // Returns the forecast length, which is a compile time constant unless it is
+  // configured at runtime
+  size_t GetForecastLength() const {
+    return ForecastLength != kRuntimeForecastLength ? ForecastLength
+                                                    : cfg_.forecast_length;
+  }
+
+  // Locks the model in asynchronous model updates mode, so it is not modified
+  // by the learner thread while being read or extended on the request path.
+  // Returns an empty lock otherwise.
+  std::unique_lock<std::mutex> LockModel() {
+    if (!transitions_queue_) {
+      return {};
     }
 
-    *prev_requested_item_key_state_ = key_to_state_map_[key];
+    return std::unique_lock<std::mutex>(model_mutex_);
   }
 
-  void AddNewState(const KeyType& key, float size) {
-    assert(key_to_state_map_.count(key) == 0);
+  // Learner thread loop: applies enqueued transitions to the model in batches
+  // until stopped. The remaining transitions are applied before exiting.
+  void RunLearner() {
+    std::vector<Transition> batch(cfg_.learner_batch_size);
+
+    while (true) {
+      // Stop flag is read before draining the queue, so all the transitions
+      // enqueued before stopping are applied
+      const bool stop = stop_learner_.load(std::memory_order_acquire);
+      const size_t batch_size =
+          transitions_queue_->TryPopBatch(batch.data(), batch.size());
+
+      if (batch_size == 0) {
+        if (stop) {
+          return;
+        }
+
+        std::this_thread::sleep_for(kLearnerIdleSleep);
+        continue;
+      }
+
+      {
+        std::lock_guard<std::mutex> model_lock(model_mutex_);
+
+        for (size_t i = 0; i < batch_size; ++i) {
+          ApplyTransition(batch[i]);
+        }
+      }
+
+      num_applied_transitions_.fetch_add(batch_size, std::memory_order_release);
+    }
+  }
+
+  size_t AddNewState(const KeyType& key, float size) {
+    if (cfg_.max_states != 0 &&
+        key_to_state_index_.GetSize() >= cfg_.max_states) {
+      RetireStates();
+    }
+
+    return RegisterNewItem(key, size);
+  }
+
+  // Registers the new item without retiring the other ones
+  size_t RegisterNewItem(const KeyType& key, float size) {
+    assert(key_to_state_index_.Find(key) == KeyToStateIndex::kNotFound);
     assert(size > 0);
 
-    key_to_state_map_[key] = markov_chain_.AddState();
-    state_to_key_map_.push_back(key);
-    item_sizes_.push_back(size);
+    std::unique_lock<std::mutex> model_lock = LockModel();
+    const size_t state = markov_chain_.AddState();
+    model_lock = {};
+
+    key_to_state_index_.Insert(key, state);
+
+    if (state < state_to_key_map_.size()) {
+      // Markov chain reuses the state of the retired item
+      assert(!IsInCache(state));
+
+      state_to_key_map_[state] = key;
+      item_sizes_[state] = size;
+    } else {
+      state_to_key_map_.push_back(key);
+      item_sizes_.push_back(size);
+      resident_states_positions_.push_back(kNotResident);
+      prefetched_states_mask_.push_back(0);
+      workspace_.row_states_mask.resize(
+          std::max(item_sizes_.size(), item_sizes_.capacity()));
+    }
+
+    return state;
+  }
+
+  // Retires the least accessed items, which are not in cache. The previously
+  // requested item is never retired, since the next transition starts from
+  // its state. Ties are broken in favor of retiring the older items. Returns
+  // the number of retired items.
+  size_t RetireStates() {
+    // Queued transitions may refer to the retired states, so they are applied
+    // beforehand
+    WaitForModelUpdates();
+
+    std::unique_lock<std::mutex> model_lock = LockModel();
+
+    const size_t prev_state = GetPrevState();
+
+    std::vector<RetirementCandidate>& candidates =
+        workspace_.retirement_candidates;
+    candidates.clear();
+
+    // States of the deleted items, which are waiting for removal, have zero
+    // sizes
+    for (size_t state = 0; state < markov_chain_.GetNumStates(); ++state) {
+      if (!markov_chain_.IsStateRemoved(state) && item_sizes_[state] > 0 &&
+          !IsInCache(state) && state != prev_state) {
+        candidates.emplace_back(markov_chain_.GetStateAccessesCount(state),
+                                state);
+      }
+    }
+
+    const size_t num_retired = std::min(
+        candidates.size(),
+        std::max<size_t>(1, cfg_.max_states * cfg_.retired_states_fraction));
+
+    if (num_retired == 0) {
+      return 0;
+    }
+
+    std::nth_element(candidates.begin(), candidates.begin() + num_retired - 1,
+                     candidates.end());
+
+    for (size_t i = 0; i < num_retired; ++i) {
+      ForgetItem(candidates[i].second);
+    }
+
+    RemovePendingStates();
+
+    return num_retired;
+  }
+
+  // Forgets the key and the size of the item, which is not in cache, and
+  // schedules its state for removal from Markov chain
+  void ForgetItem(size_t state) {
+    assert(!IsInCache(state));
+
+    key_to_state_index_.Erase(state_to_key_map_[state]);
+    state_to_key_map_[state] = KeyType();
+    item_sizes_[state] = 0;
+    states_to_remove_.push_back(state);
+  }
+
+  // Removes the states of the retired and deleted items from Markov chain, so
+  // they are reused for the new items. The state of the previously requested
+  // item is kept until the next call, since the next transition starts from
+  // it. Model updates should be waited for and model should be locked.
+  void RemovePendingStates() {
+    const size_t prev_state = GetPrevState();
+    const auto prev_state_it =
+        std::find(states_to_remove_.begin(), states_to_remove_.end(),
+                  prev_state);
+    const bool keep_prev_state = prev_state_it != states_to_remove_.end();
+
+    if (keep_prev_state) {
+      std::swap(*prev_state_it, states_to_remove_.back());
+      states_to_remove_.pop_back();
+    }
+
+    markov_chain_.RemoveStates(states_to_remove_.data(),
+                               states_to_remove_.size());
+
+    if (context_model_) {
+      context_model_->RemoveStates(states_to_remove_.data(),
+                                   states_to_remove_.size());
+    }
+    states_to_remove_.clear();
+
+    if (keep_prev_state) {
+      states_to_remove_.push_back(prev_state);
+    }
+  }
+
+  // Returns the state of the previously requested item or kNotResident if
+  // there were no get requests yet. Only the get requests make transitions,
+  // so the states retired or deleted before the first one are never used.
+  size_t GetPrevState() const {
+    return !prev_requested_item_key_state_ ? kNotResident
+                                           : *prev_requested_item_key_state_;
+  }
+
+  // Returns the view of costs buffer of the given size. Buffer is reused
+  // between requests and grows geometrically with the number of states, so
+  // heap allocations are amortized.
+  Vector<float> GetCostsBuffer(size_t size) {
+    if (workspace_.costs.size() < size) {
+      workspace_.costs.resize(std::max(size, 2 * workspace_.costs.size()));
+    }
+
+    return {workspace_.costs.data(), size};
+  }
+
+  // Appends the keys of the items, which were unloaded from memory, to the
+  // batch result
+  void CollectEvictedKeys(const std::vector<size_t>& eviction_candidates,
+                          CacheBatchResult<KeyType>* result) const {
+    for (const auto& state : eviction_candidates) {
+      if (!IsInCache(state)) {
+        result->evicted_keys.push_back(state_to_key_map_[state]);
+      }
+    }
+  }
+
+  // Notifies the delegate about the prefetched item. The delegates without
+  // PrefetchItem (it is optional for the types not derived from CacheDelegate)
+  // are notified with AdmitItem instead. The last argument selects the first
+  // overload, when it is viable.
+  template <typename D>
+  static auto NotifyPrefetch(D* delegate, const KeyType& key, int)
+      -> decltype(delegate->PrefetchItem(key), void()) {
+    delegate->PrefetchItem(key);
+  }
+
+  template <typename D>
+  static void NotifyPrefetch(D* delegate, const KeyType& key, long) {
+    delegate->AdmitItem(key);
+  }
+
+  // Loads the item from disk to memory
+  void Admit(size_t state) {
+    if (delegate_) {
+      delegate_->AdmitItem(state_to_key_map_[state]);
+    }
+
+    current_cache_size_ += item_sizes_[state];
+    AddResidentState(state);
+  }
+
+  // Resident states bookkeeping
+  bool IsInCache(size_t state) const {
+    return resident_states_positions_[state] != kNotResident;
+  }
+
+  void AddResidentState(size_t state) {
+    assert(resident_states_positions_[state] == kNotResident);
+
+    resident_states_positions_[state] = resident_states_.size();
+    resident_states_.push_back(state);
+    resident_states_by_number_.Push(state);
+
+    // The buffers of CollectRowEvictionCandidates grow together with the set
+    // of items in cache, since the row states might become hot long after the
+    // cache is warmed up
+    const size_t capacity = resident_states_.capacity();
+    workspace_.eviction_candidates.reserve(capacity);
+    workspace_.row_eviction_candidates_heap.reserve(capacity);
+    workspace_.popped_resident_states.reserve(capacity);
+  }
+
+  void RemoveResidentState(size_t state) {
+    assert(resident_states_positions_[state] != kNotResident);
+
+    // Move the last resident state to the place of the removed one
+    const size_t position = resident_states_positions_[state];
+    resident_states_[position] = resident_states_.back();
+    resident_states_positions_[resident_states_.back()] = position;
+    resident_states_.pop_back();
+    resident_states_positions_[state] = kNotResident;
+    prefetched_states_mask_[state] = 0;
+
+    if (resident_states_by_number_.Contains(state)) {
+      resident_states_by_number_.Erase(state);
+    }
+  }
+
+  // Predicts the probabilities of transitions from the current state to the
+  // given states, or the cumulative probabilities of reaching them for long
+  // (>1) forecasts. One step forecast is computed for the given states only,
+  // without materializing the probabilities for all the states. If there is
+  // no current state (kNotResident), nothing is predicted and all the
+  // probabilities are zero.
+  void PredictProbabilities(size_t current_state, uint64_t context,
+                            const std::vector<size_t>& states,
+                            std::vector<float>* probabilities) {
+    assert(probabilities);
+
+    probabilities->resize(states.size());
+
+    if (current_state == kNotResident) {
+      std::fill(probabilities->begin(), probabilities->end(), 0.0f);
+      return;
+    }
+
+    std::unique_lock<std::mutex> model_lock = LockModel();
+
+    if (GetForecastLength() == 1) {
+      const SparseVector<float>* context_row = FindHotContextRow(context);
+
+      if (context_row) {
+        for (size_t i = 0; i < states.size(); ++i) {
+          (*probabilities)[i] = (*context_row)(states[i]);
+        }
+
+        return;
+      }
+
+      markov_chain_.PredictNextState(current_state, states.data(),
+                                     states.size(), probabilities->data());
+      return;
+    }
+
+    // Make predictions regarding forecast_length, and sum the probabilities.
+    // It is not that formal, but we interpret this as a cumulative cost of
+    // replacing by mistake.
+    Vector<float> costs = GetCostsBuffer(markov_chain_.GetNumStates());
+    forecast_engine_.Forecast(markov_chain_, current_state,
+                              GetForecastLength(), &costs);
+
+    for (size_t i = 0; i < states.size(); ++i) {
+      (*probabilities)[i] = costs(states[i]);
+    }
+  }
+
+  // Returns the successors of the context (see ContextModel::FindHotRow) or
+  // nullptr if the context model is disabled. Model should be locked.
+  const SparseVector<float>* FindHotContextRow(uint64_t context) const {
+    return context_model_ ? context_model_->FindHotRow(context) : nullptr;
+  }
+
+  // Returns the row, which gives one step prediction from the current state
+  // and its context: the successors of the context, if it is hot, or the
+  // transitions row of the current state, if it is hot (see
+  // EvolvingMarkovChain::GetTransitionsRow). Returns nullptr if the prediction
+  // is given by stats accumulator. Model should be locked.
+  const SparseVector<float>* FindHotRow(size_t current_state,
+                                        uint64_t context) const {
+    const SparseVector<float>* context_row = FindHotContextRow(context);
+
+    if (context_row) {
+      return context_row;
+    }
+
+    if (current_state == kNotResident ||
+        !markov_chain_.IsHotState(current_state)) {
+      return nullptr;
+    }
+
+    return &markov_chain_.GetTransitionsRow(current_state);
+  }
+
+  // Returns the hot row (see FindHotRow) if it gives the whole forecast, i.e.
+  // the forecast length is 1, otherwise returns nullptr. Model should be
+  // locked.
+  const SparseVector<float>* FindOneStepForecastRow(size_t current_state,
+                                                    uint64_t context) const {
+    return GetForecastLength() == 1 ? FindHotRow(current_state, context)
+                                    : nullptr;
+  }
+
+  // Collects the items in cache, which are cheaper than the given item, as
+  // eviction candidates in the ascending order of their costs predicted from
+  // the current state, until their total size exceeds space_to_free. If the
+  // item is new, its probability is fixed with stats accumulator (see
+  // ProcessSetRequest). Returns the total size of the collected items.
+  // RestoreResidentStatesOrder should be called afterwards.
+  float CollectCheaperEvictionCandidates(size_t current_state, uint64_t context,
+                                         size_t state, bool is_new_item,
+                                         float space_to_free,
+                                         std::vector<size_t>* candidates) {
+    assert(candidates);
+
+    const float item_size = item_sizes_[state];
+    float size_accumulator = 0;
+
+    std::unique_lock<std::mutex> model_lock = LockModel();
+    const SparseVector<float>* hot_row =
+        FindOneStepForecastRow(current_state, context);
+
+    if (hot_row) {
+      const SparseVector<float>& row = *hot_row;
+
+      // The probability of the new item is fixed with stats accumulator the
+      // same way as for the full prediction below
+      const float saving_item_probability =
+          is_new_item ? markov_chain_.GetTransitionProbabilityFromAccumulator(
+                            current_state, state)
+                      : row(state);
+
+      size_accumulator = CollectRowEvictionCandidates(
+          row, space_to_free, true, saving_item_probability * item_size,
+          candidates);
+      model_lock = {};
+    } else {
+      model_lock = {};
+
+      // Probabilities are predicted for the items in cache and for the item
+      // being saved, which goes last
+      std::vector<size_t>& predicted_states = workspace_.predicted_states;
+      predicted_states.assign(resident_states_.begin(), resident_states_.end());
+      predicted_states.push_back(state);
+
+      std::vector<float>& predicted_probabilities =
+          workspace_.predicted_probabilities;
+      PredictProbabilities(current_state, context, predicted_states,
+                           &predicted_probabilities);
+
+      // `state` is the state corresponding to the dataset being saved. If it
+      // is new, transition probability to it is apparently zero, but most
+      // likely we don't want to instantly move it to disk. Instead, we "fix"
+      // the probability with a probability given by stats accumulator. Long
+      // (>1) forecasts are not fixed.
+      if (is_new_item && GetForecastLength() == 1 &&
+          current_state != kNotResident) {
+        model_lock = LockModel();
+
+        predicted_probabilities.back() =
+            markov_chain_.GetTransitionProbabilityFromAccumulator(
+                current_state, state);
+
+        model_lock = {};
+      }
+
+      // Arrange the items in cache by their costs. Probabilities are weighted
+      // by the corresponding element sizes only for these items.
+      std::vector<EvictionCandidate>& eviction_candidates_heap =
+          workspace_.eviction_candidates_heap;
+      BuildEvictionCandidatesHeap(predicted_probabilities.data(),
+                                  &eviction_candidates_heap);
+
+      // Without the current state nothing is predicted, so the item being
+      // saved replaces the items in cache in the order of ties
+      const float saving_item_cost =
+          current_state != kNotResident
+              ? predicted_probabilities.back() * item_size
+              : kMaxCost;
+
+      while (size_accumulator <= space_to_free &&
+             !eviction_candidates_heap.empty() &&
+             eviction_candidates_heap.front().first < saving_item_cost) {
+        const EvictionCandidate candidate =
+            PopEvictionCandidate(&eviction_candidates_heap);
+
+        candidates->push_back(candidate.second);
+        size_accumulator += item_sizes_[candidate.second];
+      }
+    }
+
+    return size_accumulator;
+  }
+
+  // Returns true if the admission of the item missed after the previously
+  // requested one is decided by the frequency sketch, i.e. the sketch is
+  // enabled and the previous state and its context have too few observations
+  // to predict anything (see MarkovChainCacheConfig::admission_filter)
+  bool IsSketchAdmission(size_t prev_state) {
+    if (!frequency_sketch_) {
+      return false;
+    }
+
+    std::unique_lock<std::mutex> model_lock = LockModel();
+
+    return !FindHotRow(prev_state, context_);
+  }
+
+  // Returns true if the item missed after the previously requested one is not
+  // cheaper than the items in cache it would replace
+  bool IsAdmittedByModel(size_t prev_state, size_t state, float space_to_free) {
+    std::vector<size_t>& eviction_candidates = workspace_.eviction_candidates;
+    eviction_candidates.clear();
+
+    const float size_accumulator = CollectCheaperEvictionCandidates(
+        prev_state, context_, state, false, space_to_free,
+        &eviction_candidates);
+    RestoreResidentStatesOrder();
+
+    return size_accumulator > space_to_free;
+  }
+
+  // Returns true if the key was requested more often than each of the eviction
+  // candidates, which are required to free space_to_free
+  bool IsAdmittedBySketch(const KeyType& key,
+                          const std::vector<size_t>& eviction_candidates,
+                          float space_to_free) const {
+    const uint8_t frequency = frequency_sketch_->Estimate(key);
+    float freed_space = 0;
+
+    for (const auto& state : eviction_candidates) {
+      if (freed_space >= space_to_free) {
+        break;
+      }
+
+      if (frequency_sketch_->Estimate(state_to_key_map_[state]) >= frequency) {
+        return false;
+      }
+
+      freed_space += item_sizes_[state];
+    }
+
+    return true;
+  }
+
+  // Collects the cheapest items in cache as eviction candidates in the
+  // ascending order of their costs, when the probabilities are given by the
+  // transitions row. Only the items from this row have non-zero costs, so the
+  // rest of items are taken from resident_states_by_number_ in the same order
+  // as from the heap of all the eviction candidates (see EvictLater), but
+  // without computing their costs. Thus, the cost of collecting k items is
+  // O((k + row nnz) * log(number of items in cache)) instead of
+  // O(number of items in cache). Items are collected while their total size is
+  // below space_to_free (or does not exceed it if `inclusive` is true) and
+  // they are cheaper than max_cost. The excluded item (if any) is never
+  // collected. Returns the total size of the collected items.
+  // RestoreResidentStatesOrder should be called afterwards.
+  float CollectRowEvictionCandidates(const SparseVector<float>& row,
+                                     float space_to_free, bool inclusive,
+                                     float max_cost,
+                                     std::vector<size_t>* candidates,
+                                     size_t excluded_state = kNotResident) {
+    assert(candidates);
+
+    std::vector<EvictionCandidate>& row_candidates_heap =
+        workspace_.row_eviction_candidates_heap;
+    std::vector<uint8_t>& row_states_mask = workspace_.row_states_mask;
+    std::vector<size_t>& popped_states = workspace_.popped_resident_states;
+
+    assert(row_states_mask.size() >= item_sizes_.size());
+
+    row_candidates_heap.clear();
+    popped_states.clear();
+
+    const SparseVector<float>::IndexT* row_indices = row.GetIndices();
+    const float* row_values = row.GetValues();
+
+    for (size_t i = 0; i < row.GetNumNonZeros(); ++i) {
+      const size_t state = row_indices[i];
+
+      if (IsInCache(state) && state != excluded_state) {
+        row_candidates_heap.emplace_back(row_values[i] * item_sizes_[state],
+                                         state);
+        row_states_mask[state] = 1;
+      }
+    }
+
+    std::make_heap(row_candidates_heap.begin(), row_candidates_heap.end(),
+                   EvictLater);
+
+    float size_accumulator = 0;
+
+    while (inclusive ? size_accumulator <= space_to_free
+                     : size_accumulator < space_to_free) {
+      // Items from the row are skipped here, since they are in the row heap
+      while (!resident_states_by_number_.IsEmpty() &&
+             (row_states_mask[resident_states_by_number_.Top()] ||
+              resident_states_by_number_.Top() == excluded_state)) {
+        popped_states.push_back(resident_states_by_number_.Pop());
+      }
+
+      const bool has_zero_cost_candidate =
+          !resident_states_by_number_.IsEmpty();
+      const EvictionCandidate zero_cost_candidate(
+          0, has_zero_cost_candidate ? resident_states_by_number_.Top() : 0);
+
+      const bool take_zero_cost_candidate =
+          has_zero_cost_candidate &&
+          (row_candidates_heap.empty() ||
+           EvictLater(row_candidates_heap.front(), zero_cost_candidate));
+
+      if (!take_zero_cost_candidate && row_candidates_heap.empty()) {
+        break;
+      }
+
+      const EvictionCandidate candidate = take_zero_cost_candidate
+                                              ? zero_cost_candidate
+                                              : row_candidates_heap.front();
+
+      if (candidate.first >= max_cost) {
+        break;
+      }
+
+      if (take_zero_cost_candidate) {
+        popped_states.push_back(resident_states_by_number_.Pop());
+      } else {
+        PopEvictionCandidate(&row_candidates_heap);
+      }
+
+      candidates->push_back(candidate.second);
+      size_accumulator += item_sizes_[candidate.second];
+    }
+
+    for (size_t i = 0; i < row.GetNumNonZeros(); ++i) {
+      row_states_mask[row_indices[i]] = 0;
+    }
+
+    return size_accumulator;
+  }
+
+  // Returns the items, which were taken by CollectRowEvictionCandidates and
+  // are still in cache, to resident_states_by_number_
+  void RestoreResidentStatesOrder() {
+    for (const auto& state : workspace_.popped_resident_states) {
+      if (IsInCache(state)) {
+        resident_states_by_number_.Push(state);
+      }
+    }
+
+    workspace_.popped_resident_states.clear();
+  }
+
+  // Prefetches the items, which are likely to be requested after the current
+  // one (see MarkovChainCacheConfig::prefetch_max_items). The most probable
+  // items within the budget are chosen and then loaded in the descending order
+  // of their costs, so the items prefetched earlier are never replaced by the
+  // later ones. The current item is never replaced. Keys of the evicted and
+  // prefetched items are added to the batch result, if it is given.
+  void Prefetch(size_t current_state, CacheBatchResult<KeyType>* result) {
+    if (cfg_.prefetch_max_items == 0 || current_state == kNotResident) {
+      return;
+    }
+
+    // Predictions are made for the context of the current item
+    assert(current_state == GetPrevState());
+
+    // Prefetch candidate is a pair of the cost of not loading the item and the
+    // state corresponding to the item
+    std::vector<EvictionCandidate>& prefetch_candidates =
+        workspace_.prefetch_candidates;
+    prefetch_candidates.clear();
+
+    std::unique_lock<std::mutex> model_lock = LockModel();
+
+    // Predictions of stats accumulator are too vague to load anything ahead of
+    // time, so only the observed transitions are used
+    const SparseVector<float>* hot_row = FindHotRow(current_state, context_);
+
+    if (!hot_row) {
+      return;
+    }
+
+    const SparseVector<float>& row = *hot_row;
+    const SparseVector<float>::IndexT* row_indices = row.GetIndices();
+    const float* row_values = row.GetValues();
+
+    const float row_sum =
+        std::accumulate(row_values, row_values + row.GetNumNonZeros(), 0.0f);
+    const float min_value = cfg_.prefetch_probability_threshold * row_sum;
+
+    // Retired and deleted items have zero sizes
+    for (size_t i = 0; i < row.GetNumNonZeros(); ++i) {
+      const size_t state = row_indices[i];
+
+      if (row_values[i] > 0 && row_values[i] >= min_value &&
+          !IsInCache(state) && item_sizes_[state] > 0) {
+        prefetch_candidates.emplace_back(row_values[i], state);
+      }
+    }
+
+    model_lock = {};
+
+    // Choose the most probable candidates, which fit into the budget
+    const size_t num_most_probable =
+        std::min(cfg_.prefetch_max_items, prefetch_candidates.size());
+    std::partial_sort(prefetch_candidates.begin(),
+                      prefetch_candidates.begin() + num_most_probable,
+                      prefetch_candidates.end(), EvictLater);
+    prefetch_candidates.resize(num_most_probable);
+
+    float budget = cfg_.prefetch_budget != 0 ? cfg_.prefetch_budget
+                                             : cfg_.cache_capacity;
+    size_t num_candidates = 0;
+
+    for (const auto& candidate : prefetch_candidates) {
+      const float item_size = item_sizes_[candidate.second];
+
+      if (item_size <= budget) {
+        budget -= item_size;
+        prefetch_candidates[num_candidates++] = {candidate.first * item_size,
+                                                 candidate.second};
+      }
+    }
+
+    prefetch_candidates.resize(num_candidates);
+    std::sort(prefetch_candidates.begin(), prefetch_candidates.end(),
+              EvictLater);
+
+    std::vector<size_t>& eviction_candidates = workspace_.eviction_candidates;
+
+    for (const auto& candidate : prefetch_candidates) {
+      const size_t state = candidate.second;
+      const float space_to_free =
+          (current_cache_size_ + item_sizes_[state]) - cfg_.cache_capacity;
+
+      if (space_to_free > 0) {
+        eviction_candidates.clear();
+
+        model_lock = LockModel();
+
+        // The row may be displaced by the learner thread in the meantime
+        hot_row = FindHotRow(current_state, context_);
+
+        if (!hot_row) {
+          return;
+        }
+
+        const float size_accumulator = CollectRowEvictionCandidates(
+            *hot_row, space_to_free, false, candidate.first,
+            &eviction_candidates, current_state);
+        model_lock = {};
+
+        if (size_accumulator < space_to_free) {
+          RestoreResidentStatesOrder();
+          continue;
+        }
+
+        Evict(space_to_free, eviction_candidates);
+        RestoreResidentStatesOrder();
+
+        if (result) {
+          CollectEvictedKeys(eviction_candidates, result);
+        }
+      }
+
+      if (delegate_) {
+        NotifyPrefetch(delegate_, state_to_key_map_[state], 0);
+      }
+
+      current_cache_size_ += item_sizes_[state];
+      AddResidentState(state);
+      prefetched_states_mask_[state] = 1;
+
+      prefetch_stats_.num_prefetched_items++;
+      prefetch_stats_.prefetched_bytes += item_sizes_[state];
+
+      if (result) {
+        result->prefetched_keys.push_back(state_to_key_map_[state]);
+      }
+    }
+  }
+
+  // Counts the request of the prefetched item in cache
+  void RegisterPrefetchHit(size_t state) {
+    if (prefetched_states_mask_[state]) {
+      prefetched_states_mask_[state] = 0;
+      prefetch_stats_.num_prefetch_hits++;
+    }
+  }
+
+  // Counts the eviction of the prefetched item, which was not requested
+  void RegisterPrefetchMiss(size_t state) {
+    if (prefetched_states_mask_[state]) {
+      prefetch_stats_.wasted_bytes += item_sizes_[state];
+    }
+  }
+
+  // Arranges the items in cache into a min-heap by their costs of replacing
+  // by mistake, which are the predicted probabilities weighted by the item
+  // sizes. Probabilities are given in the order of resident states list. Only
+  // the items in cache are considered, so the heap is built in O(number of
+  // items in cache) time, and the cheapest items are then extracted one by one
+  // until enough space is freed.
+  void BuildEvictionCandidatesHeap(const float* probabilities,
+                                   std::vector<EvictionCandidate>* heap) const {
+    assert(probabilities);
+    assert(heap);
+
+    heap->clear();
+    heap->reserve(resident_states_.size());
+
+    for (size_t i = 0; i < resident_states_.size(); ++i) {
+      const size_t state = resident_states_[i];
+      heap->emplace_back(probabilities[i] * item_sizes_[state], state);
+    }
+
+    std::make_heap(heap->begin(), heap->end(), EvictLater);
+  }
+
+  static void PushEvictionCandidate(const EvictionCandidate& candidate,
+                                    std::vector<EvictionCandidate>* heap) {
+    assert(heap);
+
+    heap->push_back(candidate);
+    std::push_heap(heap->begin(), heap->end(), EvictLater);
+  }
+
+  static EvictionCandidate PopEvictionCandidate(
+      std::vector<EvictionCandidate>* heap) {
+    assert(heap);
+    assert(!heap->empty());
+
+    std::pop_heap(heap->begin(), heap->end(), EvictLater);
+    const EvictionCandidate candidate = heap->back();
+    heap->pop_back();
+
+    return candidate;
+  }
+
+  // Unloads the single item from memory to disk
+  void Evict(size_t state) {
+    assert(IsInCache(state));
+
+    if (delegate_) {
+      delegate_->EvictItem(state_to_key_map_[state]);
+    }
+
+    RegisterPrefetchMiss(state);
+    current_cache_size_ -= item_sizes_[state];
+    RemoveResidentState(state);
   }
 
   // Frees require amount of bytes by unloading some elements from memory to
-  // disk
+  // disk. Items are unloaded in the given order, all of them should be in
+  // cache.
   void Evict(float space_to_free,
              const std::vector<size_t>& items_to_evict_states) {
     assert(space_to_free <= cfg_.cache_capacity);
@@ -240,22 +1945,16 @@ class MarkovChainCache {
     float spaceFreed = 0;
 
     for (const auto& state : items_to_evict_states) {
-      const KeyType& item_key = state_to_key_map_[state];
-
-      if (items_in_cache_sizes_.count(item_key) == 0) {
-        // DS is already on disk, skip this entry
-        continue;
-      }
+      assert(IsInCache(state));
 
-      const float tmp_size = item_sizes_[key_to_state_map_[item_key]];
-      items_not_in_cache_sizes_[item_key] = tmp_size;
-      spaceFreed += tmp_size;
+      spaceFreed += item_sizes_[state];
 
       if (delegate_) {
-        delegate_->EvictItem(item_key);
+        delegate_->EvictItem(state_to_key_map_[state]);
       }
 
-      items_in_cache_sizes_.erase(item_key);
+      RegisterPrefetchMiss(state);
+      RemoveResidentState(state);
 
       if (spaceFreed >= space_to_free) {
         current_cache_size_ -= spaceFreed;
@@ -268,24 +1967,130 @@ class MarkovChainCache {
 
   MarkovChainCacheConfig cfg_;
 
-  std::unordered_map<KeyType, float> items_in_cache_sizes_;
-  std::unordered_map<KeyType, float> items_not_in_cache_sizes_;
-
-  EvolvingMarkovChain markov_chain_;
+  BasicEvolvingMarkovChain<Accumulator> markov_chain_;
+  SparseForecastEngine forecast_engine_;
 
   float current_cache_size_ = 0;
 
-  // We use this vector for storing element sizes, because we multiply
-  // transitions probabilities by element sizes in element wise fashion in order
-  // to obtain the costs of replacing by mistake. This vector allows to do it
-  // without copying data. itemsInCacheSizes map is only used for O(1) search.
+  // We use this vector for storing element sizes indexed by states, because we
+  // multiply transitions probabilities by element sizes in order to obtain the
+  // costs of replacing by mistake.
   std::vector<float> item_sizes_;
 
-  std::unordered_map<KeyType, size_t> key_to_state_map_;
+  // Flat index is used instead of std::unordered_map, so the key lookup on
+  // every request does not chase node pointers. All the other item metadata is
+  // stored in arrays indexed by states.
+  typedef FlatKeyIndex<KeyType> KeyToStateIndex;
+  KeyToStateIndex key_to_state_index_;
   std::vector<KeyType> state_to_key_map_;
 
-  CacheDelegate<KeyType>* delegate_ = nullptr;
+  // States corresponding to the items in cache. This list allows to consider
+  // only the items in cache when choosing the ones to evict, instead of
+  // iterating over all the states ever registered. Positions vector contains
+  // the index of the state in the list or kNotResident, so it is also used to
+  // check whether the item is in cache: moving an item between memory and
+  // disk does not require any map insertions or erasures.
+  std::vector<size_t> resident_states_;
+  std::vector<size_t> resident_states_positions_;
+
+  // States corresponding to the items in cache ordered by their numbers, the
+  // greatest on the top. Items with equal costs are evicted in this order, so
+  // the items with zero costs are evicted without computing their costs (see
+  // CollectRowEvictionCandidates).
+  IndexedHeap<> resident_states_by_number_;
+
+  // Mask of the prefetched items, which were not requested since being loaded,
+  // indexed by states
+  std::vector<uint8_t> prefetched_states_mask_;
+  CachePrefetchStats prefetch_stats_;
+
+  // Access frequencies of the keys for the admission filter, only allocated if
+  // the sketch is enabled
+  std::unique_ptr<FrequencySketch<KeyType>> frequency_sketch_;
+
+  // Scratch buffers, which are reused between requests, so steady-state
+  // request processing does not allocate memory.
+  struct Workspace {
+    std::vector<float> costs;
+    std::vector<size_t> predicted_states;
+    std::vector<float> predicted_probabilities;
+    std::vector<EvictionCandidate> eviction_candidates_heap;
+    std::vector<size_t> eviction_candidates;
+    std::vector<RetirementCandidate> retirement_candidates;
+    std::vector<size_t> batch_states;
+    std::vector<size_t> batch_states_to_admit;
+    std::vector<uint8_t> batch_states_mask;
+    std::vector<BatchItem> batch_items;
+    std::vector<EvictionCandidate> popped_eviction_candidates;
+    std::vector<EvictionCandidate> row_eviction_candidates_heap;
+    std::vector<uint8_t> row_states_mask;
+    std::vector<size_t> popped_resident_states;
+    std::vector<EvictionCandidate> prefetch_candidates;
+  } workspace_;
+
+  // States of the retired and deleted items, which are waiting to be removed
+  // from Markov chain
+  std::vector<size_t> states_to_remove_;
+
+  Delegate* delegate_ = nullptr;
 
   // This field store the actual state of cache in terms of Markov chain
   KeyType* prev_requested_item_key_state_ = nullptr;
+
+  // Higher order model stuff (see MarkovChainCacheConfig::model_order), only
+  // allocated if the model order is above 1. Recent states are the last
+  // model_order - 1 requested states, the previously requested one goes last,
+  // and the context is the hash of the last model_order requested states.
+  std::unique_ptr<ContextModel> context_model_;
+  std::vector<size_t> recent_states_;
+  uint64_t context_ = ContextModel::kNoContext;
+
+  // Asynchronous model updates stuff. Model mutex guards the Markov chain
+  // against concurrent modification by the learner thread. Transitions queue
+  // is only allocated in asynchronous mode.
+  std::unique_ptr<SpscQueue<Transition>> transitions_queue_;
+  std::thread learner_thread_;
+  std::mutex model_mutex_;
+  std::atomic<bool> stop_learner_{false};
+  std::atomic<size_t> num_applied_transitions_{0};
+  size_t num_enqueued_transitions_ = 0;
+  size_t num_dropped_transitions_ = 0;
+
+  // Statistics decay stuff. Decay is accumulated in the pending factor and
+  // applied to the model along with the next transition.
+  double current_time_ = 0;
+  float decay_per_request_factor_ = 1;
+  double decay_per_time_unit_ = 0;
+  float pending_decay_factor_ = 1;
 };
+
+template <typename KeyType, typename Accumulator, size_t ForecastLength,
+          typename Delegate>
+constexpr size_t MarkovChainCache<KeyType, Accumulator, ForecastLength,
+                                  Delegate>::kNotResident;
+
+template <typename KeyType, typename Accumulator, size_t ForecastLength,
+          typename Delegate>
+constexpr float MarkovChainCache<KeyType, Accumulator, ForecastLength,
+                                 Delegate>::kMaxCost;
+
+template <typename KeyType, typename Accumulator, size_t ForecastLength,
+          typename Delegate>
+const size_t MarkovChainCache<KeyType, Accumulator, ForecastLength,
+                              Delegate>::kMinStatesRemovalBatchSize;
+
+template <typename KeyType, typename Accumulator, size_t ForecastLength,
+          typename Delegate>
+const size_t MarkovChainCache<KeyType, Accumulator, ForecastLength,
+                              Delegate>::kDefaultAdmissionSketchWidth;
+
+template <typename KeyType, typename Accumulator, size_t ForecastLength,
+          typename Delegate>
+constexpr float MarkovChainCache<KeyType, Accumulator, ForecastLength,
+                                 Delegate>::kMinDecayFactor;
+
+template <typename KeyType, typename Accumulator, size_t ForecastLength,
+          typename Delegate>
+constexpr std::chrono::microseconds
+    MarkovChainCache<KeyType, Accumulator, ForecastLength,
+                     Delegate>::kLearnerIdleSleep;
\ No newline at end of file
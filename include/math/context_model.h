@@ -0,0 +1,82 @@
+#pragma once
+
+#include <cassert>
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+#include "sparse_vector.h"
+
+// Higher order extension of the Markov chain: the states observed after the
+// contexts, i.e. the sequences of the last requested states, are counted in a
+// bounded table. Contexts are identified by their hashes (see HashContext), and
+// each hash is mapped to a single slot of the table. A context, which collides
+// with the one in the slot, decreases its counter by the transition weight and
+// takes the slot over once the counter drops to zero, so the frequently
+// observed contexts are not displaced by the rare ones. Each slot keeps at most
+// the given number of successors: the least observed one is replaced by the
+// new one. Thus, the memory footprint is bounded by the table size and the
+// lookups take O(1) time.
+class ContextModel {
+ public:
+  // Hash of the empty context
+  static constexpr uint64_t kNoContext = 0;
+
+  // table_size - number of slots, rounded up to the power of two.
+  // max_successors - maximal number of successors kept for each context.
+  // accesses_threshold - number of transitions observed from the context
+  // required to use its successors for predictions.
+  ContextModel(size_t table_size, size_t max_successors,
+               size_t accesses_threshold);
+
+  // Returns the hash of the given sequence of states followed by the last
+  // state, which is never equal to kNoContext
+  static uint64_t HashContext(const size_t* states, size_t num_states,
+                              size_t last_state);
+
+  // Registers the transition from the context to the state
+  void RegisterTransition(uint64_t context, size_t state);
+
+  // Returns the non-normalized numbers of transitions observed from the
+  // context, if it has enough statistics, otherwise returns nullptr
+  const SparseVector<float>* FindHotRow(uint64_t context) const;
+
+  // Decays the collected statistics by the given factor from (0, 1] lazily,
+  // the same way as EvolvingMarkovChain::Decay does
+  void Decay(float factor);
+
+  // Erases the transitions to the given states, so their numbers may be
+  // reused for the new states
+  void RemoveStates(const size_t* states, size_t num_states);
+
+  size_t GetTableSize() const { return slots_.size(); }
+
+ private:
+  struct Slot {
+    uint64_t context = kNoContext;
+    float accesses_count = 0;
+    SparseVector<float> successors;
+  };
+
+  Slot& GetSlot(uint64_t context) {
+    return slots_[context & (slots_.size() - 1)];
+  }
+
+  const Slot& GetSlot(uint64_t context) const {
+    return slots_[context & (slots_.size() - 1)];
+  }
+
+  // Applies the pending decay to the statistics and resets the transition
+  // weight to 1
+  void RescaleStats();
+
+  size_t max_successors_;
+  size_t accesses_threshold_;
+  std::vector<Slot> slots_;
+
+  // Weight of the newly registered transitions (see EvolvingMarkovChain)
+  float transition_weight_ = 1;
+
+  // Scratch buffer for the sorted removed states
+  std::vector<size_t> removed_states_;
+};
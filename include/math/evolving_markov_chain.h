@@ -1,25 +1,88 @@
 #pragma once
 
 #include <cassert>
+#include <cstdint>
 #include <string>
 #include <vector>
 
 #include "matrix.h"
+#include "snapshot.h"
+#include "sparse_vector.h"
 #include "stats_accumulators.h"
 #include "vector.h"
 
-class EvolvingMarkovChain {
+// Markov chain with growing state space. Accumulator is the type of stats
+// accumulator: either the StatsAccumulator interface, in which case the
+// implementation is chosen at runtime, or one of the concrete (final)
+// implementations, in which case the accumulator calls are resolved at compile
+// time. The chain is explicitly instantiated for all of them.
+template <typename Accumulator>
+class BasicEvolvingMarkovChain {
  public:
-  // statsAccumulatorType - type of stats accumulator ("states" | "transitions")
+  // statsAccumulatorType - type of stats accumulator ("states" |
+  // "transitions"), ignored if the accumulator is chosen at compile time.
   // accessesThreshold - number of state accesses required to generate
   // predictions using transitions matrix (if actual number is below the
   // threshold, then stats accumulator is used for prediction).
-  EvolvingMarkovChain(const std::string& statsAccumulatorType,
-                      size_t accessesThreshold);
+  // maxSuccessors - maximal number of successors kept in each row of
+  // transitions stats matrix (0 means no limit). Bounded rows keep the most
+  // observed successors only: once the row is full, the least observed
+  // successor is replaced by the new one, and its transitions are accounted
+  // in the residual mass of the row. Predictions spread the residual mass
+  // over all the states in proportion to the stats accumulator estimate. Thus,
+  // the transitions stats take O(numStates * maxSuccessors) memory.
+  // counterBits - width of the counters in transitions stats matrix: 0 for
+  // floats (default), 8 or 16 for compact integer counters. Compact counters
+  // of each row are halved once their sum would exceed the counter maximum,
+  // so they never saturate and keep their proportions, and decay is applied
+  // by halving all the counters, once the accumulated decay factor reaches
+  // one half. Counters are converted to floats only when the predictions are
+  // made. Accesses threshold should not exceed a half of the counter maximum.
+  BasicEvolvingMarkovChain(const std::string& statsAccumulatorType,
+                           size_t accessesThreshold, size_t maxSuccessors = 0,
+                           size_t counterBits = 0);
 
-  // Registers new state, returns its number.
+  // Registers new state, returns its number. Numbers of the removed states are
+  // reused, so the number of states grows only if there are no such states.
   size_t AddState();
 
+  // Removes the given states. Their rows and the transitions to them are
+  // erased from the transitions stats matrix in a single pass over the
+  // observed transitions, and stats accumulator forgets them. Removed states
+  // should not be used until they are reused by AddState, and the number of
+  // states is not changed.
+  void RemoveStates(const size_t* states, size_t num_states);
+
+  bool IsStateRemoved(size_t state) const;
+
+  // Returns the number of transitions observed from the state (decayed if
+  // decay is applied)
+  float GetStateAccessesCount(size_t state) const;
+
+  // Returns true if the state has enough statistics to use its row of
+  // transitions stats matrix for predictions
+  bool IsHotState(size_t state) const;
+
+  // Returns the row of transitions stats matrix, i.e. the non-normalized
+  // numbers of transitions observed from the state. For the hot states this is
+  // the same prediction as the one given by PredictNextState, except for the
+  // residual mass of the bounded rows (see GetResidualMass). Compact counters
+  // are decoded to the internal buffer, which is overwritten by the next call
+  // of this method or of the prediction methods.
+  const SparseVector<float>& GetTransitionsRow(size_t state) const;
+
+  // Returns the non-normalized number of transitions from the state, which are
+  // not accounted in its row (always 0 if the rows are not bounded)
+  float GetResidualMass(size_t state) const;
+
+  // Decays the collected statistics: all the transitions observed so far are
+  // weighted by the given factor from (0, 1]. Decay is applied lazily: the
+  // weight of the transitions registered later is divided by the factor
+  // instead, and the statistics are rescaled only when this weight becomes too
+  // large, so the amortized cost of decay is O(1). Compact counters are
+  // halved instead (see counterBits).
+  void Decay(float factor);
+
   // Registers new transitions from state1 to state2.
   void RegisterTransition(size_t state1, size_t state2);
 
@@ -31,12 +94,40 @@ class EvolvingMarkovChain {
   // to probabilities just divide the vector by its elements sum.
   void PredictNextState(size_t currentStateNum, Vector<float>* nextState);
 
+  // Gathers the elements of the prediction above for the given states only:
+  // probabilities[i] = nextState(states[i]). The next state vector is not
+  // materialized, so the cost depends only on the number of requested states:
+  // each element is computed in O(1) with stats accumulator or in
+  // O(log(number of observed transitions from the current state)) with
+  // transitions matrix.
+  void PredictNextState(size_t currentStateNum, const size_t* states,
+                        size_t numStates, float* probabilities) const;
+
   // Gives a prediction on the next state using given current state vector.
   // This is expensive type of prediction, but it can be used for long (>1)
   // forecasts. Predictions generated by this method are guaranteed to contain
   // normalized probability values and their sum equals to 1.
+  // The stochastic matrix is never materialized here: rows with enough
+  // statistics are taken from the sparse transitions matrix and normalized on
+  // the fly, and the rest of rows are accumulated directly by stats
+  // accumulator. So the prediction costs a single sparse matrix-vector
+  // multiplication and no rebuild of the stochastic matrix is needed after
+  // registering transitions or adding states.
   Vector<float> PredictNextState(const Vector<float>& currentState);
 
+  // The same as above, but the prediction is written to the nextState output
+  // vector, which should be pre-allocated to be numStates size (its contents
+  // are overwritten). This method does not allocate memory, so it is preferred
+  // for making predictions in a loop.
+  void PredictNextState(const Vector<float>& currentState,
+                        Vector<float>* nextState) const;
+
+  // The same as above, but the current state vector is sparse, so only its
+  // non-zero elements are processed. nextState output vector should be
+  // pre-allocated to be numStates size, its contents are overwritten.
+  void PredictNextState(const SparseVector<float>& currentState,
+                        Vector<float>* nextState) const;
+
   // Returns a single non-normalized probability of transition from state1 to
   // state2 based on accumulated statistics and not on transition matrix.
   // Intended to be used to fix predicted state if it contains freshly added
@@ -46,24 +137,85 @@ class EvolvingMarkovChain {
   float GetTransitionProbabilityFromAccumulator(size_t state1,
                                                 size_t state2) const;
 
-  // Returns the stochastic matrix.
+  // Writes the collected statistics (transitions stats matrix, states access
+  // counters, removed states and stats accumulator statistics) to the
+  // snapshot. The stochastic matrix is not saved, it is rebuilt on demand.
+  void Save(SnapshotWriter* writer) const;
+
+  // Reads the statistics written by Save, replacing the current ones. Returns
+  // false if the snapshot is malformed or was written with another stats
+  // accumulator type, in which case the chain is not modified. Accesses
+  // threshold is not saved, the configured one is used.
+  bool Load(SnapshotReader* reader);
+
+  // Returns the stochastic matrix. The matrix is materialized on demand, which
+  // requires O(N^2) memory and time, so this method is intended to be used for
+  // debugging purposes only.
   const Matrix<float>& GetStochasticMatrix();
 
   const size_t& GetNumStates() const;
 
   void PrintTransitionsStatsMatrix() const;
 
-  ~EvolvingMarkovChain();
+  ~BasicEvolvingMarkovChain();
 
  private:
   void UpdateStochasticMatrix();
 
+  // Applies the pending decay to the statistics and resets the transition
+  // weight to 1
+  void RescaleStats();
+
+  // Erases the rows of the removed states and the transitions to them from
+  // the given transitions stats matrix
+  template <typename CounterT>
+  void EraseRemovedStates(std::vector<SparseVector<CounterT>>* rows,
+                          const size_t* states, size_t num_states);
+
+  // Registers the transition in the row of state1 with the given weight
+  template <typename CounterT>
+  void AddTransition(SparseVector<CounterT>* row, size_t state1, size_t state2,
+                     CounterT weight);
+
+  // Registers the transition in the row of compact counters, which is halved
+  // beforehand if its counters would saturate
+  template <typename CounterT>
+  void AddCompactTransition(SparseVector<CounterT>* row, size_t state1,
+                            size_t state2);
+
+  // Halves the compact counters of the state row along with its access counter
+  // and residual mass
+  template <typename CounterT>
+  void HalveCompactRow(SparseVector<CounterT>* row, size_t state);
+
+  template <typename CounterT>
+  void HalveCompactRows(std::vector<SparseVector<CounterT>>* rows);
+
+  // Decodes the row of compact counters to the internal buffer
+  template <typename CounterT>
+  const SparseVector<float>& DecodeCompactRow(
+      const SparseVector<CounterT>& row) const;
+
+  // Converts the loaded transitions stats matrix to compact counters, scaling
+  // the rows down, so the counters do not saturate
+  template <typename CounterT>
+  void EncodeCompactRows(std::vector<SparseVector<CounterT>>* rows);
+
+  // Adds weight * normalized row of the given state to the output vector if
+  // the state has enough statistics and returns true, otherwise does nothing
+  // and returns false.
+  bool AccumulateNormalizedTransitionsRow(size_t state, float weight,
+                                          float* output) const;
+
   size_t num_states_ = 0;
   size_t accesses_threshold_ = 0;
+  size_t max_successors_ = 0;
+  size_t counter_bits_ = 0;
 
   // Contains a right stochastic matrix for transitions.
   // This matrix is updated lazily as its update require a lot of memory copying
-  // and computations. It is used only for prediction with forecast length > 1.
+  // and computations. It is not used for predictions, only returned by
+  // GetStochasticMatrix.
   // If need_to_update_stochastic_matrix_ == false then it is guaranteed that
   // this matrix is updated regarding the transition_stats_matrix_ and each row
   // in it contains the true probabilities which sums to 1.
@@ -71,15 +223,37 @@ class EvolvingMarkovChain {
   bool need_to_update_stochastic_matrix_ = true;
 
   // Contains the accumulated (i.e. actually observed) number of transitions
-  // between states. It is more efficient to store this matrix as STL vectors,
-  // because of its "smart" resizing and no need to copy all the elements on
-  // each resize (copy is apparently needed, when matrix is stored as a single
-  // pointer with a row-major order).
-  std::vector<std::vector<float>> transition_stats_matrix_;
+  // between states. Each row is stored as a sparse vector, because the vast
+  // majority of transitions is never observed: memory grows with the number
+  // of distinct observed transitions and not with the squared number of
+  // states, and registering a new state only appends an empty row.
+  std::vector<SparseVector<float>> transition_stats_matrix_;
+
+  // The same matrix with compact counters (see counterBits). Only one of the
+  // three matrices is used, the other ones are empty.
+  std::vector<SparseVector<uint8_t>> transition_stats_matrix8_;
+  std::vector<SparseVector<uint16_t>> transition_stats_matrix16_;
 
-  // Contains the sum of elements for each transitionsStatsMatrix row.
+  // Decay factor accumulated since the compact counters were halved last time
+  float pending_decay_ = 1;
+
+  // Contains the sum of elements for each transitionsStatsMatrix row and the
+  // residual mass of the row (see GetResidualMass).
   std::vector<float> states_access_counters_;
 
+  // Contains the residual mass of each row, if the rows are bounded (empty
+  // otherwise).
+  std::vector<float> residual_masses_;
+
+  // Weight of the newly registered transitions. It grows as the statistics
+  // decay, so all the counters above are in units of this weight.
+  float transition_weight_ = 1;
+
+  // Removed states, which numbers are reused by AddState in LIFO order, and
+  // the mask of removed states indexed by state numbers.
+  std::vector<size_t> removed_states_;
+  std::vector<uint8_t> removed_states_mask_;
+
   // Transitions statistics accumulator. It is used for next state prediction in
   // case if the statistics of transitions from the exact given state is
   // insufficient: most likely we don't want to get the maximum probability of
@@ -88,5 +262,17 @@ class EvolvingMarkovChain {
   // state1 now and want to predict the next one. Thus, we need this hacky stats
   // accumulator to deal with growing state space of the stochastic process,
   // which is being modeled with this markov-chain-like model.
-  StatsAccumulator* stats_accumulator_{nullptr};
+  Accumulator* stats_accumulator_{nullptr};
+
+  // Scratch buffers for collecting states with insufficient statistics during
+  // predictions. They are reused between predictions to avoid heap
+  // allocations.
+  mutable std::vector<size_t> cold_states_;
+  mutable std::vector<float> cold_states_weights_;
+
+  // Scratch buffer for the decoded row of compact counters
+  mutable SparseVector<float> decoded_row_;
 };
+
+// Markov chain with stats accumulator chosen at runtime
+typedef BasicEvolvingMarkovChain<StatsAccumulator> EvolvingMarkovChain;
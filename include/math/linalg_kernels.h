@@ -0,0 +1,42 @@
+#pragma once
+
+#include <cstddef>
+
+// Table of single precision linear algebra kernels, which are used when no BLAS
+// library is available. Several implementations are provided: the scalar
+// reference one and the vectorized ones for the different x86 instruction
+// sets. The best implementation supported by the CPU is selected at runtime.
+struct LinalgKernels {
+  const char* name;
+
+  // Returns the sum of x elements
+  float (*sum)(const float* x, size_t n);
+
+  // x = alpha * x
+  void (*scale)(float alpha, float* x, size_t n);
+
+  // y = y + x
+  void (*add)(const float* x, float* y, size_t n);
+
+  // y = y * x (element wise)
+  void (*mul)(const float* x, float* y, size_t n);
+
+  // y = y + alpha * x
+  void (*axpy)(float alpha, const float* x, float* y, size_t n);
+
+  // y = A^T * x, where A is a row-major matrix with the given number of rows
+  // and columns, and its consecutive rows are stride elements apart in memory.
+  // x should contain rows elements and y should contain cols elements.
+  void (*trans_mat_mul_vec)(const float* a, size_t rows, size_t cols,
+                            size_t stride, const float* x, float* y);
+};
+
+enum class InstructionSet { kScalar, kSse, kAvx2, kAvx512 };
+
+// Returns the kernels implemented with the given instruction set or nullptr if
+// the instruction set is not supported by the compiler or by the CPU.
+const LinalgKernels* GetLinalgKernels(InstructionSet instruction_set);
+
+// Returns the kernels implemented with the best instruction set supported by
+// the CPU. The selection is made once, on the first call.
+const LinalgKernels& GetLinalgKernels();
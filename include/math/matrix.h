@@ -8,15 +8,31 @@
 #include "linalg_common.h"
 #include "vector.h"
 
-// Simple row-major matrix class
+// Simple row-major matrix class. Matrix storage may be larger than the matrix
+// itself (see Reserve and Resize), so the rows are placed in memory with the
+// stride equal to the columns capacity.
 template <typename FloatT>
 class Matrix {
  public:
+  Matrix(const Matrix<FloatT>& other) = delete;
+
   Matrix<FloatT>& operator=(const Matrix<FloatT>& other) = delete;
 
+  // Moved matrix takes over the storage of the other one, which is left empty.
+  Matrix(Matrix<FloatT>&& other) noexcept { Swap(&other); }
+
+  Matrix<FloatT>& operator=(Matrix<FloatT>&& other) noexcept {
+    Swap(&other);
+
+    return *this;
+  }
+
   Matrix(size_t num_rows, size_t num_cols,
          FillType fill_type = FillType::kUninitialized)
-      : num_rows_(num_rows), num_cols_(num_cols) {
+      : num_rows_(num_rows),
+        num_cols_(num_cols),
+        rows_capacity_(num_rows),
+        cols_capacity_(num_cols) {
     assert(num_rows);
     assert(num_cols);
     assert(fill_type == FillType::kZeros || fill_type == FillType::kUninitialized);
@@ -39,16 +55,22 @@ class Matrix {
     assert(row < num_rows_);
     assert(col < num_cols_);
 
-    return data_[row * num_cols_ + col];
+    return data_[row * cols_capacity_ + col];
   }
 
   FloatT& operator()(size_t row, size_t col) {
     assert(row < num_rows_);
     assert(col < num_cols_);
 
-    return data_[row * num_cols_ + col];
+    return data_[row * cols_capacity_ + col];
   }
 
+  // Resizes the matrix. Storage is reallocated only if the new size exceeds
+  // the current capacity, in such case the capacity is at least doubled along
+  // the exceeded dimension, so growing the matrix by one row and column at a
+  // time takes amortized O(1) reallocations. kCopy resize preserves the
+  // elements, which fit into the new size, for any combination of growing and
+  // shrinking dimensions, and fills the new elements with zeros.
   void Resize(size_t newNumRows, size_t newNumCols, ResizeType resizeType) {
     assert(newNumRows);
     assert(newNumCols);
@@ -60,45 +82,66 @@ class Matrix {
       return;
     }
 
-    FloatT* newData = nullptr;
+    // Only the exceeded dimension grows, the other one keeps its capacity
+    if (newNumRows > rows_capacity_ || newNumCols > cols_capacity_) {
+      Reallocate(newNumRows > rows_capacity_
+                     ? std::max(newNumRows, 2 * rows_capacity_)
+                     : rows_capacity_,
+                 newNumCols > cols_capacity_
+                     ? std::max(newNumCols, 2 * cols_capacity_)
+                     : cols_capacity_,
+                 resizeType == ResizeType::kCopy);
+    }
 
     switch (resizeType) {
       case ResizeType::kZeros:
-        newData = new FloatT[newNumRows * newNumCols]();
+        for (size_t i = 0; i < newNumRows; ++i) {
+          std::fill(data_ + i * cols_capacity_,
+                    data_ + i * cols_capacity_ + newNumCols, 0);
+        }
+
         break;
       case ResizeType::kUninitialized:
-        newData = new FloatT[newNumRows * newNumCols];
         break;
       case ResizeType::kCopy:
-        newData = new FloatT[newNumRows * newNumCols]();
-
-        if (newNumRows > num_rows_ && newNumCols > num_cols_) {
-          for (size_t i = 0; i < num_rows_; ++i) {
-            std::copy(data_ + i * num_cols_, data_ + (i + 1) * num_cols_,
-                      newData + i * newNumCols);
+        // Storage beyond the current size may contain leftovers from the
+        // previous shrinking resizes, so the new elements are zeroed
+        // explicitly
+        for (size_t i = 0; i < newNumRows; ++i) {
+          const size_t first_new_col = i < num_rows_ ? num_cols_ : 0;
+
+          if (first_new_col < newNumCols) {
+            std::fill(data_ + i * cols_capacity_ + first_new_col,
+                      data_ + i * cols_capacity_ + newNumCols, 0);
           }
         }
 
         break;
     }
 
-    assert(newData);
-    delete[] data_;
-    data_ = newData;
     num_rows_ = newNumRows;
     num_cols_ = newNumCols;
   }
 
+  // Makes sure that the matrix can be resized up to the given size without
+  // storage reallocation. Matrix contents are preserved.
+  void Reserve(size_t numRows, size_t numCols) {
+    if (numRows > rows_capacity_ || numCols > cols_capacity_) {
+      Reallocate(std::max(numRows, rows_capacity_),
+                 std::max(numCols, cols_capacity_), true);
+    }
+  }
+
   Vector<FloatT> Row(size_t row) {
     assert(row < num_rows_);
 
-    return {data_ + row * num_cols_, num_cols_};
+    return {data_ + row * cols_capacity_, num_cols_};
   }
 
   Vector<FloatT> Row(size_t row) const {
     assert(row < num_rows_);
 
-    return {data_ + row * num_cols_, num_cols_};
+    return {data_ + row * cols_capacity_, num_cols_};
   }
 
   const FloatT* GetData() const { return data_; }
@@ -112,9 +155,17 @@ class Matrix {
 
   const size_t& GetNumCols() const { return num_cols_; }
 
+  // Returns the distance between the beginnings of the consecutive rows in
+  // storage (i.e. the leading dimension in BLAS terms)
+  const size_t& GetStride() const { return cols_capacity_; }
+
+  const size_t& GetRowsCapacity() const { return rows_capacity_; }
+
+  const size_t& GetColsCapacity() const { return cols_capacity_; }
+
   friend std::ostream& operator<<(std::ostream& os, const Matrix<FloatT>& obj) {
-    for (size_t i = 0; i < obj.numRows; ++i) {
-      os << obj.row(i) << "\n";
+    for (size_t i = 0; i < obj.num_rows_; ++i) {
+      os << obj.Row(i) << "\n";
     }
 
     return os;
@@ -123,8 +174,41 @@ class Matrix {
   ~Matrix() { delete[] data_; }
 
  private:
+  // Allocates new storage with the given capacity, optionally copying the
+  // current contents to it
+  void Reallocate(size_t newRowsCapacity, size_t newColsCapacity,
+                  bool copyData) {
+    FloatT* newData = new FloatT[newRowsCapacity * newColsCapacity];
+
+    assert(newData);
+
+    if (copyData) {
+      for (size_t i = 0; i < num_rows_; ++i) {
+        std::copy(data_ + i * cols_capacity_,
+                  data_ + i * cols_capacity_ + num_cols_,
+                  newData + i * newColsCapacity);
+      }
+    }
+
+    delete[] data_;
+    data_ = newData;
+    rows_capacity_ = newRowsCapacity;
+    cols_capacity_ = newColsCapacity;
+  }
+
+  void Swap(Matrix<FloatT>* other) noexcept {
+    std::swap(num_rows_, other->num_rows_);
+    std::swap(num_cols_, other->num_cols_);
+    std::swap(rows_capacity_, other->rows_capacity_);
+    std::swap(cols_capacity_, other->cols_capacity_);
+    std::swap(data_, other->data_);
+  }
+
   size_t num_rows_ = 0;
   size_t num_cols_ = 0;
 
+  size_t rows_capacity_ = 0;
+  size_t cols_capacity_ = 0;
+
   FloatT* data_{nullptr};
 };
@@ -0,0 +1,56 @@
+#pragma once
+
+#include <cstddef>
+#include <vector>
+
+#include "evolving_markov_chain.h"
+#include "sparse_vector.h"
+#include "vector.h"
+
+// Generates long (>1) forecasts by propagating a sparse state vector through
+// the Markov chain. After each step the states with probabilities below
+// epsilon are dropped and at most max_states most probable states are kept, so
+// the cost of each step depends on the number of kept states and not on the
+// total number of states squared.
+//
+// Truncation only affects the propagated state, accumulated predictions are
+// computed from the full (non-truncated) next state on each step. Dropped mass
+// is not redistributed, so accumulated probabilities are never overestimated,
+// and each accumulated element differs from the exact (dense) forecast by at
+// most forecast_length * GetDroppedProbabilityMass(). With epsilon == 0 and
+// max_states == 0 no states are dropped and the forecast is exact up to
+// floating point rounding.
+class SparseForecastEngine {
+ public:
+  // epsilon - states with probabilities below this value are dropped after each
+  // step.
+  // max_states - maximal number of states kept after each step (0 means no
+  // limit).
+  explicit SparseForecastEngine(float epsilon = 0, size_t max_states = 0);
+
+  // Accumulates (i.e. sums) predictions on the next forecastLength states if
+  // current state == currentStateNum. accumulatedStates output vector should be
+  // pre-allocated to be chain.GetNumStates() size, its contents are
+  // overwritten. Instantiated for all the Markov chain types.
+  template <typename Accumulator>
+  void Forecast(const BasicEvolvingMarkovChain<Accumulator>& chain,
+                size_t currentStateNum, size_t forecastLength,
+                Vector<float>* accumulatedStates);
+
+  // Returns the total probability mass dropped during the last forecast.
+  float GetDroppedProbabilityMass() const;
+
+ private:
+  // Converts next_state_ to the sparse state_ applying the truncation rules.
+  void TruncateNextState(size_t num_states);
+
+  float epsilon_ = 0;
+  size_t max_states_ = 0;
+
+  float dropped_probability_mass_ = 0;
+
+  // Scratch buffers reused between forecasts
+  SparseVector<float> state_;
+  std::vector<float> next_state_;
+  std::vector<size_t> kept_states_;
+};
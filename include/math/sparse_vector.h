@@ -0,0 +1,179 @@
+#pragma once
+
+#include <algorithm>
+#include <cassert>
+#include <cstdint>
+#include <limits>
+#include <ostream>
+#include <vector>
+
+#include "vector.h"
+
+// Simple sparse vector class. Only non-zero elements are stored: their indices
+// and values are kept in two parallel arrays sorted by index, so the memory
+// footprint is proportional to the number of non-zero elements and not to the
+// logical vector size. Indices are stored as 32-bit integers, which is more
+// than enough for the number of states we are dealing with and halves the
+// indices memory comparing to size_t.
+template <typename FloatT>
+class SparseVector {
+ public:
+  typedef uint32_t IndexT;
+
+  // Adds value to the index-th element. If the element is not stored yet, it
+  // is inserted preserving the indices order.
+  void Add(size_t index, FloatT value) {
+    assert(index <= std::numeric_limits<IndexT>::max());
+
+    const auto it =
+        std::lower_bound(indices_.begin(), indices_.end(), index);
+    const size_t pos = it - indices_.begin();
+
+    if (it == indices_.end() || *it != index) {
+      indices_.insert(it, static_cast<IndexT>(index));
+      values_.insert(values_.begin() + pos, value);
+    } else {
+      values_[pos] += value;
+    }
+  }
+
+  // Appends the element to the end of vector. Index should be greater than all
+  // the stored indices. This is the cheap way to fill the vector in order.
+  void PushBack(size_t index, FloatT value) {
+    assert(index <= std::numeric_limits<IndexT>::max());
+    assert(indices_.empty() || indices_.back() < index);
+
+    indices_.push_back(static_cast<IndexT>(index));
+    values_.push_back(value);
+  }
+
+  // Returns the index-th element or zero if it is not stored
+  FloatT operator()(size_t index) const {
+    const auto it =
+        std::lower_bound(indices_.begin(), indices_.end(), index);
+
+    if (it == indices_.end() || *it != index) {
+      return 0;
+    }
+
+    return values_[it - indices_.begin()];
+  }
+
+  // Writes the stored elements to the corresponding positions of the dense
+  // vector. Other elements of the dense vector are left untouched.
+  void Scatter(Vector<FloatT>* dense) const {
+    assert(dense);
+
+    FloatT* dense_data = dense->GetData();
+
+    for (size_t i = 0; i < indices_.size(); ++i) {
+      assert(indices_[i] < dense->GetSize());
+      dense_data[indices_[i]] = values_[i];
+    }
+  }
+
+  // Adds the stored elements to the corresponding elements of the dense
+  // vector
+  void ScatterAdd(Vector<FloatT>* dense) const {
+    assert(dense);
+
+    FloatT* dense_data = dense->GetData();
+
+    for (size_t i = 0; i < indices_.size(); ++i) {
+      assert(indices_[i] < dense->GetSize());
+      dense_data[indices_[i]] += values_[i];
+    }
+  }
+
+  // Erases the elements, which indices satisfy the predicate, preserving the
+  // order of the rest of elements. Returns the sum of the erased values.
+  template <typename Predicate>
+  FloatT EraseIf(Predicate predicate) {
+    size_t num_kept = 0;
+    FloatT erased_sum = 0;
+
+    for (size_t i = 0; i < indices_.size(); ++i) {
+      if (predicate(indices_[i])) {
+        erased_sum += values_[i];
+      } else {
+        indices_[num_kept] = indices_[i];
+        values_[num_kept] = values_[i];
+        ++num_kept;
+      }
+    }
+
+    indices_.resize(num_kept);
+    values_.resize(num_kept);
+
+    return erased_sum;
+  }
+
+  // Erases the element with the smallest value (the first one of them, if
+  // there are several) and returns its value. Vector should not be empty.
+  FloatT EraseMin() {
+    assert(!indices_.empty());
+
+    const size_t position =
+        std::min_element(values_.begin(), values_.end()) - values_.begin();
+    const FloatT value = values_[position];
+
+    indices_.erase(indices_.begin() + position);
+    values_.erase(values_.begin() + position);
+
+    return value;
+  }
+
+  // Divides the values by two rounding down and erases the elements, which
+  // become zero. Intended for the vectors of integer counters. Returns the sum
+  // of the remaining values.
+  FloatT HalveCounters() {
+    size_t num_kept = 0;
+    FloatT sum = 0;
+
+    for (size_t i = 0; i < indices_.size(); ++i) {
+      const FloatT value = static_cast<FloatT>(values_[i] / 2);
+
+      if (value != 0) {
+        indices_[num_kept] = indices_[i];
+        values_[num_kept] = value;
+        sum += value;
+        ++num_kept;
+      }
+    }
+
+    indices_.resize(num_kept);
+    values_.resize(num_kept);
+
+    return sum;
+  }
+
+  void Clear() {
+    indices_.clear();
+    values_.clear();
+  }
+
+  size_t GetNumNonZeros() const { return indices_.size(); }
+
+  const IndexT* GetIndices() const { return indices_.data(); }
+
+  const FloatT* GetValues() const { return values_.data(); }
+
+  FloatT* GetValues() { return values_.data(); }
+
+  friend std::ostream& operator<<(std::ostream& os,
+                                  const SparseVector<FloatT>& obj) {
+    os << "[";
+
+    for (size_t i = 0; i < obj.indices_.size(); ++i) {
+      os << " " << obj.indices_[i] << ":" << obj.values_[i];
+    }
+
+    os << " ]";
+
+    return os;
+  }
+
+ private:
+  std::vector<IndexT> indices_;
+  std::vector<FloatT> values_;
+};
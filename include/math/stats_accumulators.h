@@ -2,17 +2,38 @@
 
 #include <cassert>
 #include <cstddef>
+#include <cstdint>
 #include <vector>
 
+#include "snapshot.h"
 #include "vector.h"
 
 // Stats accumulator interface. Used for collecting transitions statistics,
-// collected with different transitions interpretations.
+// collected with different transitions interpretations. Implementations are
+// final, so the calls are devirtualized when the implementation is known at
+// compile time (see BasicEvolvingMarkovChain).
 class StatsAccumulator {
  public:
   // Registers new state
   virtual void AddState() = 0;
 
+  // Forgets the statistics related to the state. The number of states is not
+  // changed: the state is expected to be registered again with ReuseState.
+  virtual void RemoveState(size_t state) = 0;
+
+  // Registers new state in place of the removed one
+  virtual void ReuseState(size_t state) = 0;
+
+  // Decays the collected statistics by the given factor from (0, 1]. Decay is
+  // applied lazily by increasing the weight of the statistics collected later
+  // (see EvolvingMarkovChain::Decay).
+  virtual void Decay(float factor) = 0;
+
+  // Lazily decayed statistics are rescaled when the weight of the new
+  // transitions exceeds this value. Rescaling is done rarely enough, but the
+  // counters are still far from the single precision limits.
+  static constexpr float kMaxTransitionWeight = 65536;
+
   // Collects transition from state1 to state2
   virtual void AccumulateTransition(size_t state1, size_t state2) = 0;
 
@@ -27,13 +48,70 @@ class StatsAccumulator {
   virtual float GetTransitionProbabilityEstimate(size_t state1,
                                                  size_t state2) const = 0;
 
+  // Returns the sum of GetTransitionProbabilitiesEstimate output elements, so
+  // the estimate can be normalized without materializing it. Computed in
+  // O(log(number of states)) at most.
+  virtual float GetTransitionProbabilitiesEstimateSum(size_t state) const = 0;
+
+  // Gathers the elements of GetTransitionProbabilitiesEstimate output for the
+  // given states only: output[i] = estimate(state)[states[i]]. Each element is
+  // computed in O(1), so the cost does not depend on the number of states
+  // registered in accumulator.
+  virtual void GatherTransitionProbabilitiesEstimate(
+      size_t state, const size_t* states, size_t num_states,
+      float* output) const = 0;
+
+  // Adds the weighted sum of normalized (i.e. the sum of elements == 1)
+  // transitions probabilities estimates from the given states to the output
+  // vector: output += sum_i(weights[i] * estimate(states[i])). This is
+  // equivalent to multiplying the rows of stochastic matrix, which are
+  // generated by this accumulator, by the vector of weights, but it does not
+  // require such rows to be materialized. Output vector should be
+  // pre-allocated to have <number of states> size.
+  virtual void AccumulateNormalizedTransitionProbabilitiesEstimates(
+      const size_t* states, const float* weights, size_t num_states,
+      Vector<float>* output) const = 0;
+
+  // Writes the collected statistics to the snapshot
+  virtual void Save(SnapshotWriter* writer) const = 0;
+
+  // Reads the statistics written by Save, replacing the current ones. The
+  // number of states is given by Markov chain. Returns false if the snapshot
+  // was written by another accumulator type or is malformed, in which case
+  // the statistics are not modified.
+  virtual bool Load(SnapshotReader* reader, size_t num_states) = 0;
+
   virtual ~StatsAccumulator() = default;
 };
 
+// Fenwick tree, which keeps the prefix sums of the growing array of values, so
+// they are updated and queried in O(log(size)).
+class PrefixSumTree {
+ public:
+  // Appends the value to the end of array
+  void PushBack(double value);
+
+  // Adds value to the index-th element
+  void Add(size_t index, double value);
+
+  // Returns the sum of the first length elements
+  double GetPrefixSum(size_t length) const;
+
+  // Replaces the array with the given values
+  void Assign(const std::vector<float>& values);
+
+ private:
+  // The i-th node contains the sum of the elements [i + 1 - lowbit(i + 1), i]
+  std::vector<double> nodes_;
+};
+
 // Stats accumulator implementation, which employs transitions stats taking into
 // account only the "length" of transitions (i.e. |state1 - state2|).
-class TransitionsBasedStatsAccumulator : public StatsAccumulator {
+class TransitionsBasedStatsAccumulator final : public StatsAccumulator {
  public:
+  // Identifies the accumulator type in snapshots
+  static constexpr uint32_t kSnapshotTag = 1;
+
   // Contains total numbers of forward (state1 < state2) transitions for
   // each length. Index of vector == length of the transition. Thus, zeroth
   // element contains nothing and should not be used.
@@ -48,13 +126,36 @@ class TransitionsBasedStatsAccumulator : public StatsAccumulator {
   float total_number_of_self_transitions_ = 0;
 
   // Contains total number of collected transitions
-  size_t total_number_of_transitions_ = 0;
+  double total_number_of_transitions_ = 0;
+
+  // Weight of the newly collected transitions, all the numbers above are in
+  // units of this weight
+  float transition_weight_ = 1;
 
   // Contains total number of states
   size_t num_states_ = 0;
 
+  // Prefix sums of the forward and backward transitions numbers, which give
+  // the sum of any estimate row in O(log(number of states))
+  PrefixSumTree forward_prefix_sums_;
+  PrefixSumTree backward_prefix_sums_;
+
+  // Returns the number of transitions of the lengths, which fit into the row
+  // of the given state, i.e. the sum of the estimate row before normalization
+  double GetRowNumberOfTransitions(size_t state) const;
+
   void AddState() override;
 
+  // Statistics are collected per transition length and not per state, so
+  // there is nothing to forget here. Note that the reused state has the
+  // position of the removed one, so its transitions lengths are relative to
+  // that position.
+  void RemoveState(size_t state) override;
+
+  void ReuseState(size_t state) override;
+
+  void Decay(float factor) override;
+
   void AccumulateTransition(size_t state1, size_t state2) override;
 
   void GetTransitionProbabilitiesEstimate(size_t state,
@@ -62,17 +163,54 @@ class TransitionsBasedStatsAccumulator : public StatsAccumulator {
 
   float GetTransitionProbabilityEstimate(size_t state1,
                                          size_t state2) const override;
+
+  float GetTransitionProbabilitiesEstimateSum(size_t state) const override;
+
+  void GatherTransitionProbabilitiesEstimate(size_t state,
+                                             const size_t* states,
+                                             size_t num_states,
+                                             float* output) const override;
+
+  void AccumulateNormalizedTransitionProbabilitiesEstimates(
+      const size_t* states, const float* weights, size_t num_states,
+      Vector<float>* output) const override;
+
+  void Save(SnapshotWriter* writer) const override;
+
+  bool Load(SnapshotReader* reader, size_t num_states) override;
 };
 
 // Stats accumulator implementation, which employs transitions stats taking into
 // account only the initial and final states of transitions.
-class StatesBasedStatsAccumulator : public StatsAccumulator {
+class StatesBasedStatsAccumulator final : public StatsAccumulator {
  public:
+  // Identifies the accumulator type in snapshots
+  static constexpr uint32_t kSnapshotTag = 2;
+
   std::vector<float> transition_counters_;
-  size_t total_number_of_transitions_ = 0;
+
+  // Contains the counters the states were initialized with (0 for the removed
+  // states). The total below is their sum: it normalizes the estimates and
+  // does not include the accumulated transitions.
+  std::vector<float> initial_counters_;
+  double total_number_of_transitions_ = 0;
+
+  // Sum of the transition counters, i.e. the sum of the estimate elements
+  // before normalization
+  double transition_counters_sum_ = 0;
+
+  // Weight of the newly collected transitions, all the counters above are in
+  // units of this weight
+  float transition_weight_ = 1;
 
   void AddState() override;
 
+  void RemoveState(size_t state) override;
+
+  void ReuseState(size_t state) override;
+
+  void Decay(float factor) override;
+
   void AccumulateTransition(size_t, size_t state2) override;
 
   // Basically this method yields the average probabilities of transitions to
@@ -81,4 +219,21 @@ class StatesBasedStatsAccumulator : public StatsAccumulator {
                                           Vector<float>* transitions) override;
 
   float GetTransitionProbabilityEstimate(size_t, size_t state2) const override;
+
+  float GetTransitionProbabilitiesEstimateSum(size_t) const override;
+
+  void GatherTransitionProbabilitiesEstimate(size_t, const size_t* states,
+                                             size_t num_states,
+                                             float* output) const override;
+
+  // Since the estimate does not depend on the initial state, all the rows are
+  // the same and the result is just the popularity vector scaled by the sum of
+  // weights.
+  void AccumulateNormalizedTransitionProbabilitiesEstimates(
+      const size_t* states, const float* weights, size_t num_states,
+      Vector<float>* output) const override;
+
+  void Save(SnapshotWriter* writer) const override;
+
+  bool Load(SnapshotReader* reader, size_t num_states) override;
 };
@@ -37,24 +37,37 @@ class Vector {
     std::copy(other.data_, other.data_ + size_, data_);
   }
 
+  // Moved vector takes over the data (and the ownership of data, if any) of
+  // the other one, which is left empty.
+  Vector(Vector<FloatT>&& other) noexcept
+      : data_(other.data_), size_(other.size_), owns_data_(other.owns_data_) {
+    other.data_ = nullptr;
+    other.size_ = 0;
+    other.owns_data_ = true;
+  }
+
   Vector() = default;
 
-  Vector<FloatT>& operator=(Vector<FloatT> other) {
-    if (other.owns_data_) {
-      std::swap(data_, other.data_);
-      std::swap(size_, other.size_);
-      std::swap(owns_data_, other.owns_data_);
-    } else {
-      if (owns_data_) {
-        delete[] data_;
-      }
-
-      owns_data_ = true;
-      size_ = other.size_;
-      data_ = new FloatT[size_];
-      std::copy(other.data_, other.data_ + size_, data_);
+  // Assignment always makes this vector an owning one, even if the other
+  // vector is a non-owning view.
+  Vector<FloatT>& operator=(const Vector<FloatT>& other) {
+    if (this != &other) {
+      Vector<FloatT> copy(other);
+      Swap(&copy);
+    }
+
+    return *this;
+  }
+
+  // The data of owning vector is taken over without copying, while the data
+  // of non-owning view is copied as in case of copy assignment.
+  Vector<FloatT>& operator=(Vector<FloatT>&& other) {
+    if (!other.owns_data_) {
+      return *this = static_cast<const Vector<FloatT>&>(other);
     }
 
+    Swap(&other);
+
     return *this;
   }
 
@@ -112,6 +125,12 @@ class Vector {
   }
 
  private:
+  void Swap(Vector<FloatT>* other) noexcept {
+    std::swap(data_, other->data_);
+    std::swap(size_, other->size_);
+    std::swap(owns_data_, other->owns_data_);
+  }
+
   FloatT* data_{nullptr};
   size_t size_ = 0;
   bool owns_data_ = true;
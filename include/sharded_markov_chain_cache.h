@@ -0,0 +1,101 @@
+#pragma once
+
+#include <algorithm>
+#include <cassert>
+#include <cstdint>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <vector>
+
+#include "markov_chain_cache.h"
+
+// Thread-safe cache for serving requests from multiple threads. Keys are
+// distributed between a number of independent shards by their hashes. Each
+// shard is a separate MarkovChainCache with its own Markov chain, an equal
+// slice of the total capacity and its own lock, so the requests to different
+// shards are processed concurrently.
+//
+// Sharding is not free in terms of hit ratio: each shard observes only the
+// transitions between its own keys, and the capacity is not shared between
+// the shards. An item must fit into a single shard capacity. Delegate methods
+// are called from the requesting threads under the shard lock, so the delegate
+// should be thread-safe.
+template <typename KeyType, typename Hash = std::hash<KeyType>>
+class ShardedMarkovChainCache {
+ public:
+  ShardedMarkovChainCache(const MarkovChainCacheConfig& cfg, size_t num_shards,
+                          CacheDelegate<KeyType>* delegate = nullptr) {
+    assert(num_shards > 0);
+
+    MarkovChainCacheConfig shard_cfg = cfg;
+    shard_cfg.cache_capacity = cfg.cache_capacity / num_shards;
+
+    if (cfg.max_states != 0) {
+      shard_cfg.max_states = std::max<size_t>(1, cfg.max_states / num_shards);
+    }
+
+    shards_.reserve(num_shards);
+
+    for (size_t i = 0; i < num_shards; ++i) {
+      shards_.emplace_back(new Shard(shard_cfg, delegate));
+    }
+  }
+
+  bool ProcessGetRequest(const KeyType& key) {
+    Shard& shard = GetShard(key);
+    std::lock_guard<std::mutex> lock(shard.mutex);
+
+    return shard.cache.ProcessGetRequest(key);
+  }
+
+  void ProcessSetRequest(const KeyType& key, float item_size) {
+    Shard& shard = GetShard(key);
+    std::lock_guard<std::mutex> lock(shard.mutex);
+
+    shard.cache.ProcessSetRequest(key, item_size);
+  }
+
+  bool Contains(const KeyType& key) {
+    Shard& shard = GetShard(key);
+    std::lock_guard<std::mutex> lock(shard.mutex);
+
+    return shard.cache.Contains(key);
+  }
+
+  void Flush() {
+    for (auto& shard : shards_) {
+      std::lock_guard<std::mutex> lock(shard->mutex);
+
+      shard->cache.Flush();
+    }
+  }
+
+  size_t GetNumShards() const { return shards_.size(); }
+
+  size_t GetShardIndex(const KeyType& key) const {
+    // Hashes are mixed with the Fibonacci multiplier, because std::hash is
+    // usually identity for integers and sequential keys would not be
+    // distributed evenly otherwise
+    const uint64_t hash =
+        static_cast<uint64_t>(hasher_(key)) * 0x9E3779B97F4A7C15ull;
+
+    return (hash >> 32) % shards_.size();
+  }
+
+ private:
+  struct Shard {
+    Shard(const MarkovChainCacheConfig& cfg, CacheDelegate<KeyType>* delegate)
+        : cache(cfg, delegate) {}
+
+    std::mutex mutex;
+    MarkovChainCache<KeyType> cache;
+  };
+
+  Shard& GetShard(const KeyType& key) { return *shards_[GetShardIndex(key)]; }
+
+  // Shards are allocated separately, so they are not moved and the locks of
+  // the neighbour shards do not share cache lines
+  std::vector<std::unique_ptr<Shard>> shards_;
+  Hash hasher_;
+};
\ No newline at end of file
@@ -0,0 +1,142 @@
+#pragma once
+
+#include <cassert>
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include <ostream>
+#include <string>
+#include <type_traits>
+#include <vector>
+
+// Binary snapshot of the cache model (see MarkovChainCache::SaveSnapshot). The
+// file starts with the magic number and the format version, which is bumped on
+// every layout change, so the snapshots written by the other versions are
+// rejected instead of being misinterpreted. Values are stored as raw bytes in
+// the native byte order, so the snapshots are not portable between platforms
+// with different endianness or type sizes (the latter are checked on loading).
+constexpr uint32_t kSnapshotMagic = 0x5343434D;  // "MCCS"
+constexpr uint32_t kSnapshotVersion = 2;
+
+// Writes values to the stream. Errors are sticky and reported by IsOk, so the
+// stream state is checked once after writing the whole snapshot.
+class SnapshotWriter {
+ public:
+  explicit SnapshotWriter(std::ostream* stream) : stream_(stream) {
+    assert(stream_);
+  }
+
+  template <typename T>
+  void Write(const T& value) {
+    static_assert(std::is_trivially_copyable<T>::value,
+                  "Only trivially copyable values are written as is");
+
+    stream_->write(reinterpret_cast<const char*>(&value), sizeof(T));
+  }
+
+  // Writes the number of elements followed by the elements
+  template <typename T>
+  void WriteArray(const T* values, size_t num_values) {
+    static_assert(std::is_trivially_copyable<T>::value,
+                  "Only trivially copyable values are written as is");
+    assert(num_values == 0 || values);
+
+    Write<uint64_t>(num_values);
+    stream_->write(reinterpret_cast<const char*>(values),
+                   num_values * sizeof(T));
+  }
+
+  template <typename T>
+  void WriteVector(const std::vector<T>& values) {
+    WriteArray(values.data(), values.size());
+  }
+
+  bool IsOk() const { return stream_->good(); }
+
+ private:
+  std::ostream* stream_;
+};
+
+// Reads values from the snapshot in memory (usually a memory mapped file, see
+// MappedFile). Every read is bounds checked and returns false if the snapshot
+// is truncated, in which case the output is not modified.
+class SnapshotReader {
+ public:
+  SnapshotReader(const void* data, size_t size)
+      : data_(static_cast<const char*>(data)), size_(size) {
+    assert(data_ || size_ == 0);
+  }
+
+  template <typename T>
+  bool Read(T* value) {
+    static_assert(std::is_trivially_copyable<T>::value,
+                  "Only trivially copyable values are read as is");
+    assert(value);
+
+    if (size_ - position_ < sizeof(T)) {
+      return false;
+    }
+
+    // Mapped data is not necessarily aligned, so the values are copied
+    std::memcpy(value, data_ + position_, sizeof(T));
+    position_ += sizeof(T);
+
+    return true;
+  }
+
+  // Reads the array written by SnapshotWriter::WriteArray
+  template <typename T>
+  bool ReadVector(std::vector<T>* values) {
+    static_assert(std::is_trivially_copyable<T>::value,
+                  "Only trivially copyable values are read as is");
+    assert(values);
+
+    uint64_t num_values = 0;
+
+    if (!Read(&num_values) ||
+        num_values > (size_ - position_) / sizeof(T)) {
+      return false;
+    }
+
+    values->resize(num_values);
+
+    if (num_values != 0) {
+      std::memcpy(values->data(), data_ + position_, num_values * sizeof(T));
+    }
+
+    position_ += num_values * sizeof(T);
+
+    return true;
+  }
+
+  bool IsAtEnd() const { return position_ == size_; }
+
+ private:
+  const char* data_;
+  size_t size_;
+  size_t position_ = 0;
+};
+
+// Read-only memory mapping of the whole file. Pages are loaded on demand by
+// the OS, so a snapshot is read without copying it to an intermediate buffer.
+class MappedFile {
+ public:
+  MappedFile() = default;
+  MappedFile(const MappedFile&) = delete;
+  MappedFile& operator=(const MappedFile&) = delete;
+
+  // Returns false if the file does not exist or can not be mapped
+  bool Open(const std::string& path);
+
+  void Close();
+
+  const void* GetData() const { return data_; }
+
+  size_t GetSize() const { return size_; }
+
+  ~MappedFile() { Close(); }
+
+ private:
+  void* data_ = nullptr;
+  size_t size_ = 0;
+};
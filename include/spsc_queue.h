@@ -0,0 +1,80 @@
+#pragma once
+
+#include <atomic>
+#include <cassert>
+#include <vector>
+
+// Bounded lock-free single-producer single-consumer queue. Elements are stored
+// in a preallocated ring buffer, so neither pushing nor popping allocates
+// memory. Producer and consumer may work concurrently; several producers are
+// allowed only if they are serialized externally (e.g. by a lock).
+template <typename T>
+class SpscQueue {
+ public:
+  // Capacity is rounded up to the power of two
+  explicit SpscQueue(size_t capacity) {
+    assert(capacity > 0);
+
+    size_t buffer_size = 1;
+
+    while (buffer_size < capacity) {
+      buffer_size *= 2;
+    }
+
+    buffer_.resize(buffer_size);
+    mask_ = buffer_size - 1;
+  }
+
+  // Returns false if the queue is full. Called by producer only.
+  bool TryPush(const T& value) {
+    const size_t tail = tail_.load(std::memory_order_relaxed);
+
+    if (tail - head_.load(std::memory_order_acquire) == buffer_.size()) {
+      return false;
+    }
+
+    buffer_[tail & mask_] = value;
+    tail_.store(tail + 1, std::memory_order_release);
+
+    return true;
+  }
+
+  // Pops at most max_count elements to the output array, returns the number of
+  // popped elements. Called by consumer only.
+  size_t TryPopBatch(T* output, size_t max_count) {
+    assert(output);
+
+    const size_t head = head_.load(std::memory_order_relaxed);
+    const size_t available = tail_.load(std::memory_order_acquire) - head;
+    const size_t count = available < max_count ? available : max_count;
+
+    for (size_t i = 0; i < count; ++i) {
+      output[i] = buffer_[(head + i) & mask_];
+    }
+
+    head_.store(head + count, std::memory_order_release);
+
+    return count;
+  }
+
+  bool IsEmpty() const {
+    return head_.load(std::memory_order_acquire) ==
+           tail_.load(std::memory_order_acquire);
+  }
+
+  size_t GetCapacity() const { return buffer_.size(); }
+
+ private:
+  // Cache line size padding, so producer and consumer do not invalidate each
+  // other's cache lines on every operation
+  static const size_t kCacheLineSize = 64;
+
+  std::vector<T> buffer_;
+  size_t mask_ = 0;
+
+  char head_padding_[kCacheLineSize];
+  std::atomic<size_t> head_{0};
+  char tail_padding_[kCacheLineSize];
+  std::atomic<size_t> tail_{0};
+  char end_padding_[kCacheLineSize];
+};
\ No newline at end of file
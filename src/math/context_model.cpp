@@ -0,0 +1,136 @@
+#include "math/context_model.h"
+
+#include <algorithm>
+
+#include "math/stats_accumulators.h"
+
+constexpr uint64_t ContextModel::kNoContext;
+
+ContextModel::ContextModel(size_t table_size, size_t max_successors,
+                           size_t accesses_threshold)
+    : max_successors_(max_successors), accesses_threshold_(accesses_threshold) {
+  assert(table_size > 0);
+  assert(max_successors > 0);
+
+  size_t num_slots = 1;
+
+  while (num_slots < table_size) {
+    num_slots <<= 1;
+  }
+
+  slots_.resize(num_slots);
+}
+
+uint64_t ContextModel::HashContext(const size_t* states, size_t num_states,
+                                   size_t last_state) {
+  assert(num_states == 0 || states);
+
+  // Each state is mixed in with the multiply-xorshift step, so the order of
+  // states matters
+  const auto mix = [](uint64_t hash, size_t state) {
+    hash = (hash ^ state) * 0xFF51AFD7ED558CCDull;
+    return hash ^ (hash >> 32);
+  };
+
+  uint64_t hash = 0x9E3779B97F4A7C15ull;
+
+  for (size_t i = 0; i < num_states; ++i) {
+    hash = mix(hash, states[i]);
+  }
+
+  hash = mix(hash, last_state);
+
+  return hash != kNoContext ? hash : 1;
+}
+
+void ContextModel::RegisterTransition(uint64_t context, size_t state) {
+  assert(context != kNoContext);
+
+  Slot& slot = GetSlot(context);
+
+  if (slot.context != context) {
+    // The context in the slot is defended by its counter
+    if (slot.context != kNoContext &&
+        slot.accesses_count > transition_weight_) {
+      slot.accesses_count -= transition_weight_;
+      return;
+    }
+
+    slot.context = context;
+    slot.accesses_count = 0;
+    slot.successors.Clear();
+  }
+
+  SparseVector<float>& successors = slot.successors;
+
+  if (successors.GetNumNonZeros() == max_successors_ &&
+      successors(state) == 0) {
+    // Replace the least observed successor
+    slot.accesses_count -= successors.EraseMin();
+  }
+
+  successors.Add(state, transition_weight_);
+  slot.accesses_count += transition_weight_;
+}
+
+const SparseVector<float>* ContextModel::FindHotRow(uint64_t context) const {
+  const Slot& slot = GetSlot(context);
+
+  if (context == kNoContext || slot.context != context ||
+      slot.accesses_count < accesses_threshold_ * transition_weight_) {
+    return nullptr;
+  }
+
+  return &slot.successors;
+}
+
+void ContextModel::Decay(float factor) {
+  assert(factor > 0);
+  assert(factor <= 1);
+
+  transition_weight_ /= factor;
+
+  if (transition_weight_ > StatsAccumulator::kMaxTransitionWeight) {
+    RescaleStats();
+  }
+}
+
+void ContextModel::RescaleStats() {
+  const float scale = 1 / transition_weight_;
+
+  for (auto& slot : slots_) {
+    float* values = slot.successors.GetValues();
+
+    for (size_t i = 0; i < slot.successors.GetNumNonZeros(); ++i) {
+      values[i] *= scale;
+    }
+
+    slot.accesses_count *= scale;
+  }
+
+  transition_weight_ = 1;
+}
+
+void ContextModel::RemoveStates(const size_t* states, size_t num_states) {
+  if (num_states == 0) {
+    return;
+  }
+
+  assert(states);
+
+  removed_states_.assign(states, states + num_states);
+  std::sort(removed_states_.begin(), removed_states_.end());
+
+  const auto is_removed = [this](size_t state) {
+    return std::binary_search(removed_states_.begin(), removed_states_.end(),
+                              state);
+  };
+
+  // Contexts, which contain the removed states, are not observed anymore, so
+  // they are displaced by the other ones eventually
+  for (auto& slot : slots_) {
+    if (slot.successors.GetNumNonZeros() != 0) {
+      slot.accesses_count -= slot.successors.EraseIf(is_removed);
+    }
+  }
+}
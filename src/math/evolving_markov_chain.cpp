@@ -1,32 +1,85 @@
 #include "math/evolving_markov_chain.h"
 
+#include <algorithm>
+#include <cmath>
 #include <iostream>
+#include <limits>
+#include <numeric>
 
-EvolvingMarkovChain::EvolvingMarkovChain(
-    const std::string& stats_accumulator_type, size_t accesses_threshold)
-    : num_states_(0), accesses_threshold_(accesses_threshold) {
+namespace {
+
+// Concrete stats accumulators are known at compile time, so the type given at
+// runtime is ignored
+template <typename Accumulator>
+Accumulator* CreateStatsAccumulator(const std::string&) {
+  return new Accumulator();
+}
+
+template <>
+StatsAccumulator* CreateStatsAccumulator<StatsAccumulator>(
+    const std::string& stats_accumulator_type) {
   assert(stats_accumulator_type == "states" ||
          stats_accumulator_type == "transitions");
 
   if (stats_accumulator_type == "transitions") {
-    stats_accumulator_ = new TransitionsBasedStatsAccumulator();
-  } else if (stats_accumulator_type == "states") {
-    stats_accumulator_ = new StatesBasedStatsAccumulator();
+    return new TransitionsBasedStatsAccumulator();
   }
+
+  return new StatesBasedStatsAccumulator();
 }
 
-size_t EvolvingMarkovChain::AddState() {
-  ++num_states_;
+}  // namespace
+
+template <typename Accumulator>
+BasicEvolvingMarkovChain<Accumulator>::BasicEvolvingMarkovChain(
+    const std::string& stats_accumulator_type, size_t accesses_threshold,
+    size_t max_successors, size_t counter_bits)
+    : num_states_(0),
+      accesses_threshold_(accesses_threshold),
+      max_successors_(max_successors),
+      counter_bits_(counter_bits),
+      stats_accumulator_(
+          CreateStatsAccumulator<Accumulator>(stats_accumulator_type)) {
+  assert(counter_bits == 0 || counter_bits == 8 || counter_bits == 16);
+  assert(counter_bits == 0 ||
+         2 * accesses_threshold <= (size_t(1) << counter_bits) - 1);
+}
+
+template <typename Accumulator>
+size_t BasicEvolvingMarkovChain<Accumulator>::AddState() {
+  if (!removed_states_.empty()) {
+    // Reuse the removed state: its row and column are already empty
+    const size_t state = removed_states_.back();
+    removed_states_.pop_back();
+    removed_states_mask_[state] = 0;
 
-  // 1. Resize the stats matrices and fill the new values with zeroes
+    need_to_update_stochastic_matrix_ = true;
+    stats_accumulator_->ReuseState(state);
 
-  transition_stats_matrix_.resize(num_states_);
-  states_access_counters_.resize(num_states_);
+    return state;
+  }
 
-  transition_stats_matrix_[num_states_ - 1].resize(num_states_, 0);
+  ++num_states_;
 
-  for (size_t i = 0; i < num_states_ - 1; ++i) {
-    transition_stats_matrix_[i].push_back(0);
+  // 1. Append an empty row to the stats matrix. There is no need to touch the
+  // other rows, since unobserved transitions are not stored at all.
+
+  switch (counter_bits_) {
+    case 8:
+      transition_stats_matrix8_.emplace_back();
+      break;
+    case 16:
+      transition_stats_matrix16_.emplace_back();
+      break;
+    default:
+      transition_stats_matrix_.emplace_back();
+  }
+
+  states_access_counters_.push_back(0);
+  removed_states_mask_.push_back(0);
+
+  if (max_successors_ != 0) {
+    residual_masses_.push_back(0);
   }
 
   // 1.1. Expire the stohastic matrix contents
@@ -40,14 +93,232 @@ size_t EvolvingMarkovChain::AddState() {
   return num_states_ - 1;
 }
 
-void EvolvingMarkovChain::RegisterTransition(size_t state1, size_t state2) {
+template <typename Accumulator>
+void BasicEvolvingMarkovChain<Accumulator>::RemoveStates(const size_t* states,
+                                                         size_t num_states) {
+  if (num_states == 0) {
+    return;
+  }
+
+  assert(states);
+
+  switch (counter_bits_) {
+    case 8:
+      EraseRemovedStates(&transition_stats_matrix8_, states, num_states);
+      break;
+    case 16:
+      EraseRemovedStates(&transition_stats_matrix16_, states, num_states);
+      break;
+    default:
+      EraseRemovedStates(&transition_stats_matrix_, states, num_states);
+  }
+
+  // Expire the stohastic matrix contents
+
+  need_to_update_stochastic_matrix_ = true;
+}
+
+template <typename Accumulator>
+template <typename CounterT>
+void BasicEvolvingMarkovChain<Accumulator>::EraseRemovedStates(
+    std::vector<SparseVector<CounterT>>* rows, const size_t* states,
+    size_t num_states) {
+  // 1. Clear the rows of removed states
+
+  for (size_t i = 0; i < num_states; ++i) {
+    const size_t state = states[i];
+
+    assert(state < num_states_);
+    assert(!removed_states_mask_[state]);
+
+    removed_states_mask_[state] = 1;
+    removed_states_.push_back(state);
+
+    (*rows)[state].Clear();
+    states_access_counters_[state] = 0;
+
+    if (max_successors_ != 0) {
+      residual_masses_[state] = 0;
+    }
+
+    stats_accumulator_->RemoveState(state);
+  }
+
+  // 2. Erase the transitions to removed states from the rest of rows. Their
+  // access counters are decreased accordingly, so the rows stay normalizable.
+
+  const auto is_removed = [this](size_t state) {
+    return removed_states_mask_[state] != 0;
+  };
+
+  for (size_t i = 0; i < num_states_; ++i) {
+    if ((*rows)[i].GetNumNonZeros() != 0) {
+      states_access_counters_[i] -= (*rows)[i].EraseIf(is_removed);
+    }
+  }
+}
+
+template <typename Accumulator>
+bool BasicEvolvingMarkovChain<Accumulator>::IsStateRemoved(
+    size_t state) const {
+  assert(state < num_states_);
+
+  return removed_states_mask_[state] != 0;
+}
+
+template <typename Accumulator>
+float BasicEvolvingMarkovChain<Accumulator>::GetStateAccessesCount(
+    size_t state) const {
+  assert(state < num_states_);
+
+  return states_access_counters_[state] / transition_weight_;
+}
+
+template <typename Accumulator>
+void BasicEvolvingMarkovChain<Accumulator>::Decay(float factor) {
+  assert(factor > 0);
+  assert(factor <= 1);
+
+  stats_accumulator_->Decay(factor);
+
+  if (counter_bits_ != 0) {
+    // Integer counters can not be decayed lazily, so they are halved once the
+    // accumulated decay reaches one half
+    pending_decay_ *= factor;
+
+    while (pending_decay_ <= 0.5f) {
+      if (counter_bits_ == 8) {
+        HalveCompactRows(&transition_stats_matrix8_);
+      } else {
+        HalveCompactRows(&transition_stats_matrix16_);
+      }
+
+      pending_decay_ *= 2;
+    }
+
+    need_to_update_stochastic_matrix_ = true;
+    return;
+  }
+
+  transition_weight_ /= factor;
+
+  if (transition_weight_ > StatsAccumulator::kMaxTransitionWeight) {
+    RescaleStats();
+  }
+}
+
+template <typename Accumulator>
+template <typename CounterT>
+void BasicEvolvingMarkovChain<Accumulator>::HalveCompactRow(
+    SparseVector<CounterT>* row, size_t state) {
+  float residual_mass = 0;
+
+  if (max_successors_ != 0) {
+    residual_mass = residual_masses_[state] /= 2;
+  }
+
+  states_access_counters_[state] = row->HalveCounters() + residual_mass;
+}
+
+template <typename Accumulator>
+template <typename CounterT>
+void BasicEvolvingMarkovChain<Accumulator>::HalveCompactRows(
+    std::vector<SparseVector<CounterT>>* rows) {
+  for (size_t i = 0; i < num_states_; ++i) {
+    HalveCompactRow(&(*rows)[i], i);
+  }
+}
+
+template <typename Accumulator>
+void BasicEvolvingMarkovChain<Accumulator>::RescaleStats() {
+  const float scale = 1 / transition_weight_;
+
+  for (size_t i = 0; i < num_states_; ++i) {
+    SparseVector<float>& row = transition_stats_matrix_[i];
+    float* row_values = row.GetValues();
+
+    for (size_t j = 0; j < row.GetNumNonZeros(); ++j) {
+      row_values[j] *= scale;
+    }
+
+    states_access_counters_[i] *= scale;
+  }
+
+  for (auto& residual_mass : residual_masses_) {
+    residual_mass *= scale;
+  }
+
+  transition_weight_ = 1;
+}
+
+template <typename Accumulator>
+bool BasicEvolvingMarkovChain<Accumulator>::IsHotState(size_t state) const {
+  return states_access_counters_[state] >=
+         accesses_threshold_ * transition_weight_;
+}
+
+template <typename Accumulator>
+const SparseVector<float>&
+BasicEvolvingMarkovChain<Accumulator>::GetTransitionsRow(size_t state) const {
+  assert(state < num_states_);
+
+  switch (counter_bits_) {
+    case 8:
+      return DecodeCompactRow(transition_stats_matrix8_[state]);
+    case 16:
+      return DecodeCompactRow(transition_stats_matrix16_[state]);
+    default:
+      return transition_stats_matrix_[state];
+  }
+}
+
+template <typename Accumulator>
+template <typename CounterT>
+const SparseVector<float>&
+BasicEvolvingMarkovChain<Accumulator>::DecodeCompactRow(
+    const SparseVector<CounterT>& row) const {
+  const SparseVector<float>::IndexT* row_indices = row.GetIndices();
+  const CounterT* row_values = row.GetValues();
+
+  decoded_row_.Clear();
+
+  for (size_t i = 0; i < row.GetNumNonZeros(); ++i) {
+    decoded_row_.PushBack(row_indices[i], row_values[i]);
+  }
+
+  return decoded_row_;
+}
+
+template <typename Accumulator>
+float BasicEvolvingMarkovChain<Accumulator>::GetResidualMass(
+    size_t state) const {
+  assert(state < num_states_);
+
+  return max_successors_ != 0 ? residual_masses_[state] : 0;
+}
+
+template <typename Accumulator>
+void BasicEvolvingMarkovChain<Accumulator>::RegisterTransition(size_t state1,
+                                                               size_t state2) {
   assert(state1 < num_states_);
   assert(state2 < num_states_);
+  assert(!removed_states_mask_[state1]);
+  assert(!removed_states_mask_[state2]);
 
   // 1. Update stats matrices
 
-  transition_stats_matrix_[state1][state2] += 1;
-  states_access_counters_[state1] += 1;
+  switch (counter_bits_) {
+    case 8:
+      AddCompactTransition(&transition_stats_matrix8_[state1], state1, state2);
+      break;
+    case 16:
+      AddCompactTransition(&transition_stats_matrix16_[state1], state1,
+                           state2);
+      break;
+    default:
+      AddTransition(&transition_stats_matrix_[state1], state1, state2,
+                    transition_weight_);
+  }
 
   // 1.1. Expire the stohastic matrix contents
 
@@ -58,52 +329,231 @@ void EvolvingMarkovChain::RegisterTransition(size_t state1, size_t state2) {
   stats_accumulator_->AccumulateTransition(state1, state2);
 }
 
-void EvolvingMarkovChain::PredictNextState(size_t current_state_num,
-                                           Vector<float>* next_state) {
+template <typename Accumulator>
+template <typename CounterT>
+void BasicEvolvingMarkovChain<Accumulator>::AddTransition(
+    SparseVector<CounterT>* row, size_t state1, size_t state2,
+    CounterT weight) {
+  if (max_successors_ != 0 && row->GetNumNonZeros() >= max_successors_ &&
+      (*row)(state2) == 0) {
+    // The least observed successor is replaced with the new one, and its
+    // transitions are moved to the residual mass. The row may be longer than
+    // the limit, if it was loaded from the snapshot of unbounded rows.
+    while (row->GetNumNonZeros() >= max_successors_) {
+      residual_masses_[state1] += row->EraseMin();
+    }
+  }
+
+  row->Add(state2, weight);
+  states_access_counters_[state1] += weight;
+}
+
+template <typename Accumulator>
+template <typename CounterT>
+void BasicEvolvingMarkovChain<Accumulator>::AddCompactTransition(
+    SparseVector<CounterT>* row, size_t state1, size_t state2) {
+  // Access counter is the sum of the row counters and the residual mass, so
+  // none of the counters saturates while it stays below the maximum
+  if (states_access_counters_[state1] + 1 >
+      std::numeric_limits<CounterT>::max()) {
+    HalveCompactRow(row, state1);
+  }
+
+  AddTransition(row, state1, state2, static_cast<CounterT>(1));
+}
+
+template <typename Accumulator>
+void BasicEvolvingMarkovChain<Accumulator>::PredictNextState(
+    size_t current_state_num, Vector<float>* next_state) {
   assert(current_state_num < num_states_);
   assert(next_state);
   assert(next_state->GetSize() == num_states_);
 
-  if (states_access_counters_[current_state_num] < accesses_threshold_) {
+  if (!IsHotState(current_state_num)) {
     // If we decide that collected transitions number from the given state is
     // not enough to give a prediction, we generate a prediction base on overall
     // statistics using stats accumulator.
     stats_accumulator_->GetTransitionProbabilitiesEstimate(current_state_num,
                                                            next_state);
   } else {
-    // Otherwise just return the row from transitions matrix.
-    next_state->CopyFromVector(
-        Vector<float>{transition_stats_matrix_[current_state_num].data(),
-                      transition_stats_matrix_[current_state_num].size()});
+    // Otherwise just return the row from transitions matrix. Residual mass
+    // is spread in proportion to the normalized stats accumulator estimate.
+    const float residual_mass = GetResidualMass(current_state_num);
+
+    if (residual_mass > 0) {
+      stats_accumulator_->GetTransitionProbabilitiesEstimate(current_state_num,
+                                                             next_state);
+      next_state->Scale(residual_mass / next_state->Sum());
+    } else {
+      std::fill(next_state->GetData(), next_state->GetData() + num_states_, 0);
+    }
+
+    GetTransitionsRow(current_state_num).ScatterAdd(next_state);
   }
 }
 
-Vector<float> EvolvingMarkovChain::PredictNextState(
-    const Vector<float>& current_state) {
-  assert(current_state.GetSize() == num_states_);
+template <typename Accumulator>
+void BasicEvolvingMarkovChain<Accumulator>::PredictNextState(
+    size_t current_state_num, const size_t* states, size_t num_states,
+    float* probabilities) const {
+  assert(current_state_num < num_states_);
+  assert(num_states == 0 || (states && probabilities));
 
-  UpdateStochasticMatrix();
+  if (!IsHotState(current_state_num)) {
+    stats_accumulator_->GatherTransitionProbabilitiesEstimate(
+        current_state_num, states, num_states, probabilities);
+  } else {
+    const SparseVector<float>& row = GetTransitionsRow(current_state_num);
+    const float residual_mass = GetResidualMass(current_state_num);
+    float residual_scale = 0;
+
+    // The estimate is normalized the same way as in the full prediction
+    if (residual_mass > 0) {
+      stats_accumulator_->GatherTransitionProbabilitiesEstimate(
+          current_state_num, states, num_states, probabilities);
+      residual_scale =
+          residual_mass /
+          stats_accumulator_->GetTransitionProbabilitiesEstimateSum(
+              current_state_num);
+    }
 
+    for (size_t i = 0; i < num_states; ++i) {
+      assert(states[i] < num_states_);
+
+      probabilities[i] =
+          row(states[i]) +
+          (residual_mass > 0 ? residual_scale * probabilities[i] : 0);
+    }
+  }
+}
+
+template <typename Accumulator>
+Vector<float> BasicEvolvingMarkovChain<Accumulator>::PredictNextState(
+    const Vector<float>& current_state) {
   Vector<float> next_state(num_states_);
 
-  stochastic_matrix_.TransMatMulVec(current_state, &next_state);
+  PredictNextState(current_state, &next_state);
 
   return next_state;
 }
 
-const Matrix<float>& EvolvingMarkovChain::GetStochasticMatrix() {
+template <typename Accumulator>
+void BasicEvolvingMarkovChain<Accumulator>::PredictNextState(
+    const Vector<float>& current_state, Vector<float>* next_state) const {
+  assert(current_state.GetSize() == num_states_);
+  assert(next_state);
+  assert(next_state->GetSize() == num_states_);
+  assert(next_state->GetData() != current_state.GetData());
+
+  float* next_state_data = next_state->GetData();
+  std::fill(next_state_data, next_state_data + num_states_, 0);
+
+  cold_states_.clear();
+  cold_states_weights_.clear();
+
+  for (size_t i = 0; i < num_states_; ++i) {
+    const float weight = current_state(i);
+
+    if (weight == 0) {
+      continue;
+    }
+
+    if (!AccumulateNormalizedTransitionsRow(i, weight, next_state_data)) {
+      // Rows with insufficient statistics are generated by stats accumulator,
+      // so we just collect them and let it do the job at once
+      cold_states_.push_back(i);
+      cold_states_weights_.push_back(weight);
+    }
+  }
+
+  stats_accumulator_->AccumulateNormalizedTransitionProbabilitiesEstimates(
+      cold_states_.data(), cold_states_weights_.data(), cold_states_.size(),
+      next_state);
+}
+
+template <typename Accumulator>
+void BasicEvolvingMarkovChain<Accumulator>::PredictNextState(
+    const SparseVector<float>& current_state, Vector<float>* next_state) const {
+  assert(next_state);
+  assert(next_state->GetSize() == num_states_);
+
+  float* next_state_data = next_state->GetData();
+  std::fill(next_state_data, next_state_data + num_states_, 0);
+
+  const SparseVector<float>::IndexT* current_state_indices =
+      current_state.GetIndices();
+  const float* current_state_values = current_state.GetValues();
+
+  cold_states_.clear();
+  cold_states_weights_.clear();
+
+  for (size_t i = 0; i < current_state.GetNumNonZeros(); ++i) {
+    const size_t state = current_state_indices[i];
+
+    assert(state < num_states_);
+
+    if (!AccumulateNormalizedTransitionsRow(state, current_state_values[i],
+                                            next_state_data)) {
+      cold_states_.push_back(state);
+      cold_states_weights_.push_back(current_state_values[i]);
+    }
+  }
+
+  stats_accumulator_->AccumulateNormalizedTransitionProbabilitiesEstimates(
+      cold_states_.data(), cold_states_weights_.data(), cold_states_.size(),
+      next_state);
+}
+
+template <typename Accumulator>
+bool BasicEvolvingMarkovChain<Accumulator>::AccumulateNormalizedTransitionsRow(
+    size_t state, float weight, float* output) const {
+  if (!IsHotState(state)) {
+    return false;
+  }
+
+  // Normalize the row on the fly
+  const SparseVector<float>& row = GetTransitionsRow(state);
+  const SparseVector<float>::IndexT* row_indices = row.GetIndices();
+  const float* row_values = row.GetValues();
+  const float alpha = weight / states_access_counters_[state];
+
+  for (size_t j = 0; j < row.GetNumNonZeros(); ++j) {
+    output[row_indices[j]] += alpha * row_values[j];
+  }
+
+  // Residual mass is spread by stats accumulator along with the cold rows
+  const float residual_mass = GetResidualMass(state);
+
+  if (residual_mass > 0) {
+    cold_states_.push_back(state);
+    cold_states_weights_.push_back(alpha * residual_mass);
+  }
+
+  return true;
+}
+
+template <typename Accumulator>
+const Matrix<float>&
+BasicEvolvingMarkovChain<Accumulator>::GetStochasticMatrix() {
   UpdateStochasticMatrix();
   return stochastic_matrix_;
 }
 
-const size_t& EvolvingMarkovChain::GetNumStates() const { return num_states_; }
+template <typename Accumulator>
+const size_t& BasicEvolvingMarkovChain<Accumulator>::GetNumStates() const {
+  return num_states_;
+}
 
-void EvolvingMarkovChain::PrintTransitionsStatsMatrix() const {
+template <typename Accumulator>
+void BasicEvolvingMarkovChain<Accumulator>::PrintTransitionsStatsMatrix()
+    const {
   for (size_t i = 0; i < num_states_; ++i) {
     std::cout << "[";
 
+    const SparseVector<float>& row = GetTransitionsRow(i);
+
     for (size_t j = 0; j < num_states_; ++j) {
-      std::cout << " " << transition_stats_matrix_[i][j];
+      std::cout << " " << row(j);
     }
 
     std::cout << " ]\n";
@@ -112,15 +562,182 @@ void EvolvingMarkovChain::PrintTransitionsStatsMatrix() const {
   std::cout << std::endl;
 }
 
-float EvolvingMarkovChain::GetTransitionProbabilityFromAccumulator(
-    size_t state1, size_t state2) const {
+template <typename Accumulator>
+float BasicEvolvingMarkovChain<
+    Accumulator>::GetTransitionProbabilityFromAccumulator(size_t state1,
+                                                          size_t state2) const {
   assert(state1 < num_states_);
   assert(state2 < num_states_);
 
   return stats_accumulator_->GetTransitionProbabilityEstimate(state1, state2);
 }
 
-void EvolvingMarkovChain::UpdateStochasticMatrix() {
+template <typename Accumulator>
+void BasicEvolvingMarkovChain<Accumulator>::Save(SnapshotWriter* writer) const {
+  assert(writer);
+
+  writer->Write<uint64_t>(num_states_);
+
+  // Compact counters are saved as floats, so the snapshot does not depend on
+  // the counters width
+  for (size_t i = 0; i < num_states_; ++i) {
+    const SparseVector<float>& row = GetTransitionsRow(i);
+
+    writer->WriteArray(row.GetIndices(), row.GetNumNonZeros());
+    writer->WriteArray(row.GetValues(), row.GetNumNonZeros());
+  }
+
+  writer->WriteVector(states_access_counters_);
+  writer->Write(transition_weight_);
+  writer->WriteVector(removed_states_);
+  writer->WriteVector(removed_states_mask_);
+
+  stats_accumulator_->Save(writer);
+}
+
+template <typename Accumulator>
+bool BasicEvolvingMarkovChain<Accumulator>::Load(SnapshotReader* reader) {
+  assert(reader);
+
+  // Everything is read and validated before replacing the current statistics,
+  // so the chain is left intact if the snapshot is malformed. Rows are
+  // appended one by one, so the corrupted number of states is detected on
+  // reaching the end of snapshot rather than by allocating the whole matrix.
+  uint64_t num_states = 0;
+
+  if (!reader->Read(&num_states)) {
+    return false;
+  }
+
+  std::vector<SparseVector<float>> transition_stats_matrix;
+  std::vector<SparseVector<float>::IndexT> row_indices;
+  std::vector<float> row_values;
+
+  for (uint64_t i = 0; i < num_states; ++i) {
+    if (!reader->ReadVector(&row_indices) || !reader->ReadVector(&row_values) ||
+        row_indices.size() != row_values.size()) {
+      return false;
+    }
+
+    transition_stats_matrix.emplace_back();
+
+    for (size_t j = 0; j < row_indices.size(); ++j) {
+      // Indices are stored in the ascending order
+      if (row_indices[j] >= num_states ||
+          (j != 0 && row_indices[j] <= row_indices[j - 1])) {
+        return false;
+      }
+
+      transition_stats_matrix.back().PushBack(row_indices[j], row_values[j]);
+    }
+  }
+
+  std::vector<float> states_access_counters;
+  float transition_weight = 0;
+  std::vector<size_t> removed_states;
+  std::vector<uint8_t> removed_states_mask;
+
+  if (!reader->ReadVector(&states_access_counters) ||
+      states_access_counters.size() != num_states ||
+      !reader->Read(&transition_weight) || !(transition_weight > 0) ||
+      !reader->ReadVector(&removed_states) ||
+      !reader->ReadVector(&removed_states_mask) ||
+      removed_states_mask.size() != num_states) {
+    return false;
+  }
+
+  for (const auto& state : removed_states) {
+    if (state >= num_states || !removed_states_mask[state]) {
+      return false;
+    }
+  }
+
+  // Stats accumulator is the last one, so nothing is modified if it fails
+  if (!stats_accumulator_->Load(reader, num_states)) {
+    return false;
+  }
+
+  num_states_ = num_states;
+  transition_stats_matrix_.swap(transition_stats_matrix);
+  states_access_counters_.swap(states_access_counters);
+
+  // Residual masses are not saved, since they are given by the access counters
+  // and the rows
+  if (max_successors_ != 0) {
+    residual_masses_.resize(num_states_);
+
+    for (size_t i = 0; i < num_states_; ++i) {
+      const SparseVector<float>& row = transition_stats_matrix_[i];
+
+      residual_masses_[i] = std::max(
+          0.0f, states_access_counters_[i] -
+                    std::accumulate(row.GetValues(),
+                                    row.GetValues() + row.GetNumNonZeros(),
+                                    0.0f));
+    }
+  }
+
+  transition_weight_ = transition_weight;
+  removed_states_.swap(removed_states);
+  removed_states_mask_.swap(removed_states_mask);
+  need_to_update_stochastic_matrix_ = true;
+
+  if (counter_bits_ == 8) {
+    EncodeCompactRows(&transition_stats_matrix8_);
+  } else if (counter_bits_ == 16) {
+    EncodeCompactRows(&transition_stats_matrix16_);
+  }
+
+  return true;
+}
+
+template <typename Accumulator>
+template <typename CounterT>
+void BasicEvolvingMarkovChain<Accumulator>::EncodeCompactRows(
+    std::vector<SparseVector<CounterT>>* rows) {
+  const float max_count = std::numeric_limits<CounterT>::max();
+
+  rows->clear();
+  rows->resize(num_states_);
+
+  for (size_t i = 0; i < num_states_; ++i) {
+    const SparseVector<float>& row = transition_stats_matrix_[i];
+    const SparseVector<float>::IndexT* row_indices = row.GetIndices();
+    const float* row_values = row.GetValues();
+
+    // Counts are rounded down, so their sum does not exceed the maximum
+    float scale = 1 / transition_weight_;
+
+    if (states_access_counters_[i] * scale > max_count) {
+      scale = max_count / states_access_counters_[i];
+    }
+
+    float accesses_count = 0;
+
+    for (size_t j = 0; j < row.GetNumNonZeros(); ++j) {
+      const float count = std::floor(row_values[j] * scale);
+
+      if (count > 0) {
+        (*rows)[i].PushBack(row_indices[j], static_cast<CounterT>(count));
+        accesses_count += count;
+      }
+    }
+
+    if (max_successors_ != 0) {
+      residual_masses_[i] *= scale;
+      accesses_count += residual_masses_[i];
+    }
+
+    states_access_counters_[i] = accesses_count;
+  }
+
+  transition_stats_matrix_.clear();
+  transition_weight_ = 1;
+  pending_decay_ = 1;
+}
+
+template <typename Accumulator>
+void BasicEvolvingMarkovChain<Accumulator>::UpdateStochasticMatrix() {
   // This check is useful when we are generating a prediction on the next states
   // sequence without changing the number of states and registering transitions.
   if (need_to_update_stochastic_matrix_) {
@@ -129,7 +746,7 @@ void EvolvingMarkovChain::UpdateStochasticMatrix() {
     for (size_t i = 0; i < num_states_; ++i) {
       Vector<float> row_view = stochastic_matrix_.Row(i);
 
-      if (states_access_counters_[i] < accesses_threshold_) {
+      if (!IsHotState(i)) {
         // If we decide that collected transitions number from the given state
         // is not enough to give a prediction, we generate a prediction base on
         // overall statistics using stats accumulator.
@@ -137,9 +754,19 @@ void EvolvingMarkovChain::UpdateStochasticMatrix() {
         row_view.Scale(1.0f / row_view.Sum());
       } else {
         // Otherwise just copy the corresponding row from the transitions matrix
-        // and normalize it.
-        row_view.CopyFromVector(
-            Vector<float>{transition_stats_matrix_[i].data(), num_states_});
+        // and normalize it. The matrix is not necessarily reallocated on
+        // update, so the row is cleared (or filled with the spread residual
+        // mass) beforehand.
+        const float residual_mass = GetResidualMass(i);
+
+        if (residual_mass > 0) {
+          stats_accumulator_->GetTransitionProbabilitiesEstimate(i, &row_view);
+          row_view.Scale(residual_mass / row_view.Sum());
+        } else {
+          std::fill(row_view.GetData(), row_view.GetData() + num_states_, 0);
+        }
+
+        GetTransitionsRow(i).ScatterAdd(&row_view);
         row_view.Scale(1.0 / states_access_counters_[i]);
       }
     }
@@ -148,4 +775,11 @@ void EvolvingMarkovChain::UpdateStochasticMatrix() {
   }
 }
 
-EvolvingMarkovChain::~EvolvingMarkovChain() { delete stats_accumulator_; }
\ No newline at end of file
+template <typename Accumulator>
+BasicEvolvingMarkovChain<Accumulator>::~BasicEvolvingMarkovChain() {
+  delete stats_accumulator_;
+}
+
+template class BasicEvolvingMarkovChain<StatsAccumulator>;
+template class BasicEvolvingMarkovChain<TransitionsBasedStatsAccumulator>;
+template class BasicEvolvingMarkovChain<StatesBasedStatsAccumulator>;
@@ -1,19 +1,28 @@
 #include <math/matrix.h>
 #include <math/vector.h>
 
-#ifdef USE_MKL
+#if defined(USE_MKL) || defined(USE_CBLAS)
+
+// Any CBLAS compatible library may be used. Element-wise operations are not
+// the part of BLAS, so they are done with MKL VML functions when MKL is used and
+// with BLAS axpy or the built-in vectorized kernels otherwise.
 
+#ifdef USE_MKL
 #include <mkl.h>
+#else
+#include <cblas.h>
+#include <math/linalg_kernels.h>
+#endif
 
 template <>
 void Matrix<float>::TransMatMulVec(const Vector<float>& vec,
                                    Vector<float>* output) const {
   assert(output);
   assert(vec.GetSize() == num_rows_);
-  assert(vec.GetSize() == output->GetSize());
+  assert(output->GetSize() == num_cols_);
 
   cblas_sgemv(CblasRowMajor, CblasTrans, num_rows_, num_cols_, 1, data_,
-              num_rows_, vec.GetData(), 1, 0, output->GetData(), 1);
+              cols_capacity_, vec.GetData(), 1, 0, output->GetData(), 1);
 }
 
 template <>
@@ -30,67 +39,65 @@ template <>
 void Vector<float>::AddElements(const Vector<float>& other) {
   assert(size_ == other.size_);
 
+#ifdef USE_MKL
   vsAdd(size_, other.data_, data_, data_);
+#else
+  cblas_saxpy(size_, 1, other.data_, 1, data_, 1);
+#endif
 }
 
 template <>
 void Vector<float>::MulElements(const Vector<float>& other) {
   assert(size_ == other.size_);
 
+#ifdef USE_MKL
   vsMul(size_, other.data_, data_, data_);
+#else
+  GetLinalgKernels().mul(other.data_, data_, size_);
+#endif
 }
 
 #else
 
+// Without BLAS library, the vectorized kernels are used. The best
+// implementation for the host CPU is selected at runtime.
+
+#include <math/linalg_kernels.h>
+
 template <>
 void Matrix<float>::TransMatMulVec(const Vector<float>& vec,
                                    Vector<float>* output) const {
   assert(output);
   assert(vec.GetSize() == num_rows_);
-  assert(vec.GetSize() == output->GetSize());
-
-  for (size_t i = 0; i < num_cols_; ++i) {
-    (*output)(i) = 0;
-    for (size_t j = 0; j < num_rows_; ++j) {
-      (*output)(i) += vec(j) * (*this)(j, i);
-    }
-  }
+  assert(output->GetSize() == num_cols_);
+
+  GetLinalgKernels().trans_mat_mul_vec(data_, num_rows_, num_cols_,
+                                       cols_capacity_, vec.GetData(),
+                                       output->GetData());
 }
 
 template <>
 float Vector<float>::Sum() const {
-  float sum = 0;
-
-  for (size_t i = 0; i < size_; ++i) {
-    sum += data_[i];
-  }
-
-  return sum;
+  return GetLinalgKernels().sum(data_, size_);
 }
 
 template <>
 void Vector<float>::Scale(float alpha) {
-  for (size_t i = 0; i < size_; ++i) {
-    data_[i] *= alpha;
-  }
+  GetLinalgKernels().scale(alpha, data_, size_);
 }
 
 template <>
 void Vector<float>::AddElements(const Vector<float>& other) {
   assert(size_ == other.size_);
 
-  for (size_t i = 0; i < size_; ++i) {
-    data_[i] += other(i);
-  }
+  GetLinalgKernels().add(other.data_, data_, size_);
 }
 
 template <>
 void Vector<float>::MulElements(const Vector<float>& other) {
   assert(size_ == other.size_);
 
-  for (size_t i = 0; i < size_; ++i) {
-    data_[i] *= other(i);
-  }
+  GetLinalgKernels().mul(other.data_, data_, size_);
 }
 
 #endif
\ No newline at end of file
@@ -0,0 +1,130 @@
+#include "math/linalg_kernels.h"
+
+#include "linalg_kernels_impl.h"
+
+/**************************************
+ * Scalar reference kernels           *
+ **************************************/
+
+namespace {
+
+float ReferenceSum(const float* x, size_t n) {
+  float sum = 0;
+
+  for (size_t i = 0; i < n; ++i) {
+    sum += x[i];
+  }
+
+  return sum;
+}
+
+void ReferenceScale(float alpha, float* x, size_t n) {
+  for (size_t i = 0; i < n; ++i) {
+    x[i] *= alpha;
+  }
+}
+
+void ReferenceAdd(const float* x, float* y, size_t n) {
+  for (size_t i = 0; i < n; ++i) {
+    y[i] += x[i];
+  }
+}
+
+void ReferenceMul(const float* x, float* y, size_t n) {
+  for (size_t i = 0; i < n; ++i) {
+    y[i] *= x[i];
+  }
+}
+
+void ReferenceAxpy(float alpha, const float* x, float* y, size_t n) {
+  for (size_t i = 0; i < n; ++i) {
+    y[i] += alpha * x[i];
+  }
+}
+
+void ReferenceTransMatMulVec(const float* a, size_t rows, size_t cols,
+                             size_t stride, const float* x, float* y) {
+  for (size_t i = 0; i < cols; ++i) {
+    y[i] = 0;
+
+    for (size_t j = 0; j < rows; ++j) {
+      y[i] += x[j] * a[j * stride + i];
+    }
+  }
+}
+
+const LinalgKernels kReferenceKernels = {
+    "scalar",      ReferenceSum,  ReferenceScale,         ReferenceAdd,
+    ReferenceMul,  ReferenceAxpy, ReferenceTransMatMulVec};
+
+/**************************************
+ * CPU features detection             *
+ **************************************/
+
+#if (defined(__GNUC__) || defined(__clang__)) && \
+    (defined(__x86_64__) || defined(__i386__))
+
+bool CpuSupports(InstructionSet instruction_set) {
+  __builtin_cpu_init();
+
+  switch (instruction_set) {
+    case InstructionSet::kScalar:
+      return true;
+    case InstructionSet::kSse:
+      return __builtin_cpu_supports("sse2");
+    case InstructionSet::kAvx2:
+      return __builtin_cpu_supports("avx2") && __builtin_cpu_supports("fma");
+    case InstructionSet::kAvx512:
+      return __builtin_cpu_supports("avx512f");
+  }
+
+  return false;
+}
+
+#else
+
+bool CpuSupports(InstructionSet instruction_set) {
+  return instruction_set == InstructionSet::kScalar;
+}
+
+#endif
+
+const LinalgKernels* SelectLinalgKernels() {
+  const InstructionSet instruction_sets[] = {
+      InstructionSet::kAvx512, InstructionSet::kAvx2, InstructionSet::kSse};
+
+  for (const auto& instruction_set : instruction_sets) {
+    if (const LinalgKernels* kernels = GetLinalgKernels(instruction_set)) {
+      return kernels;
+    }
+  }
+
+  return &kReferenceKernels;
+}
+
+}  // namespace
+
+const LinalgKernels* GetLinalgKernels(InstructionSet instruction_set) {
+  if (!CpuSupports(instruction_set)) {
+    return nullptr;
+  }
+
+  switch (instruction_set) {
+    case InstructionSet::kScalar:
+      return &kReferenceKernels;
+    case InstructionSet::kSse:
+      return GetSseLinalgKernels();
+    case InstructionSet::kAvx2:
+      return GetAvx2LinalgKernels();
+    case InstructionSet::kAvx512:
+      return GetAvx512LinalgKernels();
+  }
+
+  return nullptr;
+}
+
+const LinalgKernels& GetLinalgKernels() {
+  static const LinalgKernels* kernels = SelectLinalgKernels();
+
+  return *kernels;
+}
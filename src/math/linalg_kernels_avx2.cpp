@@ -0,0 +1,47 @@
+#include "linalg_kernels_impl.h"
+
+#if defined(__AVX2__) && defined(__FMA__)
+
+#include <immintrin.h>
+
+namespace {
+
+struct Avx2Ops {
+  typedef __m256 Reg;
+
+  static const size_t kWidth = 8;
+
+  static Reg Zero() { return _mm256_setzero_ps(); }
+
+  static Reg Set(float value) { return _mm256_set1_ps(value); }
+
+  static Reg Load(const float* ptr) { return _mm256_loadu_ps(ptr); }
+
+  static void Store(float* ptr, Reg value) { _mm256_storeu_ps(ptr, value); }
+
+  static Reg Add(Reg a, Reg b) { return _mm256_add_ps(a, b); }
+
+  static Reg Mul(Reg a, Reg b) { return _mm256_mul_ps(a, b); }
+
+  // a * b + c
+  static Reg MulAdd(Reg a, Reg b, Reg c) { return _mm256_fmadd_ps(a, b, c); }
+
+  static float HorizontalSum(Reg value) {
+    const __m128 sum4 = _mm_add_ps(_mm256_castps256_ps128(value),
+                                   _mm256_extractf128_ps(value, 1));
+    const __m128 sum2 = _mm_add_ps(sum4, _mm_movehl_ps(sum4, sum4));
+    return _mm_cvtss_f32(_mm_add_ss(sum2, _mm_shuffle_ps(sum2, sum2, 1)));
+  }
+};
+
+}  // namespace
+
+const LinalgKernels* GetAvx2LinalgKernels() {
+  return MakeLinalgKernels<Avx2Ops>("avx2");
+}
+
+#else
+
+const LinalgKernels* GetAvx2LinalgKernels() { return nullptr; }
+
+#endif
@@ -0,0 +1,42 @@
+#include "linalg_kernels_impl.h"
+
+#if defined(__AVX512F__)
+
+#include <immintrin.h>
+
+namespace {
+
+struct Avx512Ops {
+  typedef __m512 Reg;
+
+  static const size_t kWidth = 16;
+
+  static Reg Zero() { return _mm512_setzero_ps(); }
+
+  static Reg Set(float value) { return _mm512_set1_ps(value); }
+
+  static Reg Load(const float* ptr) { return _mm512_loadu_ps(ptr); }
+
+  static void Store(float* ptr, Reg value) { _mm512_storeu_ps(ptr, value); }
+
+  static Reg Add(Reg a, Reg b) { return _mm512_add_ps(a, b); }
+
+  static Reg Mul(Reg a, Reg b) { return _mm512_mul_ps(a, b); }
+
+  // a * b + c
+  static Reg MulAdd(Reg a, Reg b, Reg c) { return _mm512_fmadd_ps(a, b, c); }
+
+  static float HorizontalSum(Reg value) { return _mm512_reduce_add_ps(value); }
+};
+
+}  // namespace
+
+const LinalgKernels* GetAvx512LinalgKernels() {
+  return MakeLinalgKernels<Avx512Ops>("avx512");
+}
+
+#else
+
+const LinalgKernels* GetAvx512LinalgKernels() { return nullptr; }
+
+#endif
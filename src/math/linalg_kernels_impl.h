@@ -0,0 +1,202 @@
+#pragma once
+
+// Generic implementations of vectorized linear algebra kernels. This header is
+// included by the instruction set specific translation units, which are
+// compiled with the corresponding compiler flags. Each of them provides the
+// Ops structure with the SIMD register type and operations on it.
+//
+// Everything is placed into anonymous namespace and no inline functions from
+// standard headers are used here: otherwise the linker could pick the copy of
+// some function compiled with the wider instruction set and use it on the CPU,
+// which does not support it.
+
+#include <cstddef>
+
+#include "math/linalg_kernels.h"
+
+namespace {
+
+// Number of output elements processed at once by the transposed matrix-vector
+// multiplication. 2048 floats (8 KB) stay in L1 cache while the rows are
+// streamed from memory.
+const size_t kTransMatMulVecBlockSize = 2048;
+
+template <typename Ops>
+float SumImpl(const float* x, size_t n) {
+  const size_t w = Ops::kWidth;
+
+  // Several independent accumulators hide the addition latency
+  typename Ops::Reg acc0 = Ops::Zero();
+  typename Ops::Reg acc1 = Ops::Zero();
+  typename Ops::Reg acc2 = Ops::Zero();
+  typename Ops::Reg acc3 = Ops::Zero();
+
+  size_t i = 0;
+
+  for (; i + 4 * w <= n; i += 4 * w) {
+    acc0 = Ops::Add(acc0, Ops::Load(x + i));
+    acc1 = Ops::Add(acc1, Ops::Load(x + i + w));
+    acc2 = Ops::Add(acc2, Ops::Load(x + i + 2 * w));
+    acc3 = Ops::Add(acc3, Ops::Load(x + i + 3 * w));
+  }
+
+  for (; i + w <= n; i += w) {
+    acc0 = Ops::Add(acc0, Ops::Load(x + i));
+  }
+
+  float sum =
+      Ops::HorizontalSum(Ops::Add(Ops::Add(acc0, acc1), Ops::Add(acc2, acc3)));
+
+  for (; i < n; ++i) {
+    sum += x[i];
+  }
+
+  return sum;
+}
+
+template <typename Ops>
+void ScaleImpl(float alpha, float* x, size_t n) {
+  const size_t w = Ops::kWidth;
+  const typename Ops::Reg alpha_reg = Ops::Set(alpha);
+
+  size_t i = 0;
+
+  for (; i + w <= n; i += w) {
+    Ops::Store(x + i, Ops::Mul(alpha_reg, Ops::Load(x + i)));
+  }
+
+  for (; i < n; ++i) {
+    x[i] *= alpha;
+  }
+}
+
+template <typename Ops>
+void AddImpl(const float* x, float* y, size_t n) {
+  const size_t w = Ops::kWidth;
+
+  size_t i = 0;
+
+  for (; i + w <= n; i += w) {
+    Ops::Store(y + i, Ops::Add(Ops::Load(y + i), Ops::Load(x + i)));
+  }
+
+  for (; i < n; ++i) {
+    y[i] += x[i];
+  }
+}
+
+template <typename Ops>
+void MulImpl(const float* x, float* y, size_t n) {
+  const size_t w = Ops::kWidth;
+
+  size_t i = 0;
+
+  for (; i + w <= n; i += w) {
+    Ops::Store(y + i, Ops::Mul(Ops::Load(y + i), Ops::Load(x + i)));
+  }
+
+  for (; i < n; ++i) {
+    y[i] *= x[i];
+  }
+}
+
+template <typename Ops>
+void AxpyImpl(float alpha, const float* x, float* y, size_t n) {
+  const size_t w = Ops::kWidth;
+  const typename Ops::Reg alpha_reg = Ops::Set(alpha);
+
+  size_t i = 0;
+
+  for (; i + w <= n; i += w) {
+    Ops::Store(y + i, Ops::MulAdd(alpha_reg, Ops::Load(x + i), Ops::Load(y + i)));
+  }
+
+  for (; i < n; ++i) {
+    y[i] += alpha * x[i];
+  }
+}
+
+// y = y + alpha0 * x0 + alpha1 * x1 + alpha2 * x2 + alpha3 * x3. Processing four
+// rows at once reduces the output loads and stores by four times.
+template <typename Ops>
+void Axpy4Impl(const float* alpha, const float* x0, const float* x1,
+               const float* x2, const float* x3, float* y, size_t n) {
+  const size_t w = Ops::kWidth;
+  const typename Ops::Reg alpha0 = Ops::Set(alpha[0]);
+  const typename Ops::Reg alpha1 = Ops::Set(alpha[1]);
+  const typename Ops::Reg alpha2 = Ops::Set(alpha[2]);
+  const typename Ops::Reg alpha3 = Ops::Set(alpha[3]);
+
+  size_t i = 0;
+
+  for (; i + w <= n; i += w) {
+    typename Ops::Reg acc = Ops::Load(y + i);
+    acc = Ops::MulAdd(alpha0, Ops::Load(x0 + i), acc);
+    acc = Ops::MulAdd(alpha1, Ops::Load(x1 + i), acc);
+    acc = Ops::MulAdd(alpha2, Ops::Load(x2 + i), acc);
+    acc = Ops::MulAdd(alpha3, Ops::Load(x3 + i), acc);
+    Ops::Store(y + i, acc);
+  }
+
+  for (; i < n; ++i) {
+    y[i] += alpha[0] * x0[i] + alpha[1] * x1[i] + alpha[2] * x2[i] +
+            alpha[3] * x3[i];
+  }
+}
+
+// Row-major matrix is multiplied by rows: each row scaled by the
+// corresponding element of x is added to the output, so the matrix is read
+// sequentially. Output is split into blocks, which fit into L1 cache, and rows
+// with zero coefficients are skipped.
+template <typename Ops>
+void TransMatMulVecImpl(const float* a, size_t rows, size_t cols,
+                        size_t stride, const float* x, float* y) {
+  for (size_t block_begin = 0; block_begin < cols;
+       block_begin += kTransMatMulVecBlockSize) {
+    const size_t block_size = cols - block_begin < kTransMatMulVecBlockSize
+                                  ? cols - block_begin
+                                  : kTransMatMulVecBlockSize;
+    float* y_block = y + block_begin;
+
+    for (size_t j = 0; j < block_size; ++j) {
+      y_block[j] = 0;
+    }
+
+    size_t i = 0;
+
+    for (; i + 4 <= rows; i += 4) {
+      if (x[i] == 0 && x[i + 1] == 0 && x[i + 2] == 0 && x[i + 3] == 0) {
+        continue;
+      }
+
+      const float* row = a + i * stride + block_begin;
+      Axpy4Impl<Ops>(x + i, row, row + stride, row + 2 * stride,
+                     row + 3 * stride, y_block, block_size);
+    }
+
+    for (; i < rows; ++i) {
+      if (x[i] != 0) {
+        AxpyImpl<Ops>(x[i], a + i * stride + block_begin, y_block, block_size);
+      }
+    }
+  }
+}
+
+template <typename Ops>
+const LinalgKernels* MakeLinalgKernels(const char* name) {
+  static const LinalgKernels kernels = {
+      name,           SumImpl<Ops>, ScaleImpl<Ops>,
+      AddImpl<Ops>,   MulImpl<Ops>, AxpyImpl<Ops>,
+      TransMatMulVecImpl<Ops>};
+
+  return &kernels;
+}
+
+}  // namespace
+
+// Instruction set specific kernels getters. They return nullptr if the
+// corresponding translation unit was compiled without the required compiler
+// flags.
+const LinalgKernels* GetSseLinalgKernels();
+const LinalgKernels* GetAvx2LinalgKernels();
+const LinalgKernels* GetAvx512LinalgKernels();
@@ -0,0 +1,48 @@
+#include "linalg_kernels_impl.h"
+
+#if defined(__SSE2__)
+
+#include <emmintrin.h>
+
+namespace {
+
+struct SseOps {
+  typedef __m128 Reg;
+
+  static const size_t kWidth = 4;
+
+  static Reg Zero() { return _mm_setzero_ps(); }
+
+  static Reg Set(float value) { return _mm_set1_ps(value); }
+
+  static Reg Load(const float* ptr) { return _mm_loadu_ps(ptr); }
+
+  static void Store(float* ptr, Reg value) { _mm_storeu_ps(ptr, value); }
+
+  static Reg Add(Reg a, Reg b) { return _mm_add_ps(a, b); }
+
+  static Reg Mul(Reg a, Reg b) { return _mm_mul_ps(a, b); }
+
+  // a * b + c
+  static Reg MulAdd(Reg a, Reg b, Reg c) {
+    return _mm_add_ps(_mm_mul_ps(a, b), c);
+  }
+
+  static float HorizontalSum(Reg value) {
+    const Reg high = _mm_movehl_ps(value, value);
+    const Reg sum = _mm_add_ps(value, high);
+    return _mm_cvtss_f32(_mm_add_ss(sum, _mm_shuffle_ps(sum, sum, 1)));
+  }
+};
+
+}  // namespace
+
+const LinalgKernels* GetSseLinalgKernels() {
+  return MakeLinalgKernels<SseOps>("sse");
+}
+
+#else
+
+const LinalgKernels* GetSseLinalgKernels() { return nullptr; }
+
+#endif
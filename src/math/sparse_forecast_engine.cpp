@@ -0,0 +1,91 @@
+#include "math/sparse_forecast_engine.h"
+
+#include <algorithm>
+#include <cassert>
+
+SparseForecastEngine::SparseForecastEngine(float epsilon, size_t max_states)
+    : epsilon_(epsilon), max_states_(max_states) {
+  assert(epsilon >= 0);
+}
+
+template <typename Accumulator>
+void SparseForecastEngine::Forecast(
+    const BasicEvolvingMarkovChain<Accumulator>& chain,
+    size_t current_state_num, size_t forecast_length,
+    Vector<float>* accumulated_states) {
+  const size_t num_states = chain.GetNumStates();
+
+  assert(current_state_num < num_states);
+  assert(forecast_length > 0);
+  assert(accumulated_states);
+  assert(accumulated_states->GetSize() == num_states);
+
+  std::fill(accumulated_states->GetData(),
+            accumulated_states->GetData() + num_states, 0);
+
+  next_state_.resize(num_states);
+  Vector<float> next_state(next_state_.data(), num_states);
+
+  state_.Clear();
+  state_.PushBack(current_state_num, 1);
+
+  dropped_probability_mass_ = 0;
+
+  for (size_t i = 0; i < forecast_length; ++i) {
+    chain.PredictNextState(state_, &next_state);
+    accumulated_states->AddElements(next_state);
+
+    // There is no need to truncate the state after the last step, as it is not
+    // propagated any further
+    if (i + 1 != forecast_length) {
+      TruncateNextState(num_states);
+    }
+  }
+}
+
+template void SparseForecastEngine::Forecast(
+    const BasicEvolvingMarkovChain<StatsAccumulator>&, size_t, size_t,
+    Vector<float>*);
+template void SparseForecastEngine::Forecast(
+    const BasicEvolvingMarkovChain<TransitionsBasedStatsAccumulator>&, size_t,
+    size_t, Vector<float>*);
+template void SparseForecastEngine::Forecast(
+    const BasicEvolvingMarkovChain<StatesBasedStatsAccumulator>&, size_t,
+    size_t, Vector<float>*);
+
+float SparseForecastEngine::GetDroppedProbabilityMass() const {
+  return dropped_probability_mass_;
+}
+
+void SparseForecastEngine::TruncateNextState(size_t num_states) {
+  kept_states_.clear();
+
+  for (size_t i = 0; i < num_states; ++i) {
+    if (next_state_[i] > 0 && next_state_[i] >= epsilon_) {
+      kept_states_.push_back(i);
+    } else {
+      dropped_probability_mass_ += next_state_[i];
+    }
+  }
+
+  if (max_states_ != 0 && kept_states_.size() > max_states_) {
+    // Move the most probable states to the beginning and drop the rest
+    std::nth_element(kept_states_.begin(), kept_states_.begin() + max_states_,
+                     kept_states_.end(), [&](size_t i, size_t j) {
+                       return next_state_[i] > next_state_[j];
+                     });
+
+    for (size_t i = max_states_; i < kept_states_.size(); ++i) {
+      dropped_probability_mass_ += next_state_[kept_states_[i]];
+    }
+
+    kept_states_.resize(max_states_);
+    std::sort(kept_states_.begin(), kept_states_.end());
+  }
+
+  state_.Clear();
+
+  for (const auto& state : kept_states_) {
+    state_.PushBack(state, next_state_[state]);
+  }
+}
@@ -1,17 +1,126 @@
 #include "math/stats_accumulators.h"
 
+#include <numeric>
+
+#include "math/linalg_kernels.h"
+
+constexpr float StatsAccumulator::kMaxTransitionWeight;
+constexpr uint32_t TransitionsBasedStatsAccumulator::kSnapshotTag;
+constexpr uint32_t StatesBasedStatsAccumulator::kSnapshotTag;
+
+/*****************
+ * PrefixSumTree *
+ *****************/
+
+namespace {
+
+// Returns the lowest set bit of the value
+size_t LowBit(size_t value) { return value & (~value + 1); }
+
+}  // namespace
+
+void PrefixSumTree::PushBack(double value) {
+  // The new node covers the previous elements down to the start of its range
+  const size_t size = nodes_.size();
+  const size_t range_start = size + 1 - LowBit(size + 1);
+
+  nodes_.push_back(value + GetPrefixSum(size) - GetPrefixSum(range_start));
+}
+
+void PrefixSumTree::Add(size_t index, double value) {
+  assert(index < nodes_.size());
+
+  for (size_t i = index + 1; i <= nodes_.size(); i += LowBit(i)) {
+    nodes_[i - 1] += value;
+  }
+}
+
+double PrefixSumTree::GetPrefixSum(size_t length) const {
+  assert(length <= nodes_.size());
+
+  double sum = 0;
+
+  for (size_t i = length; i > 0; i -= LowBit(i)) {
+    sum += nodes_[i - 1];
+  }
+
+  return sum;
+}
+
+void PrefixSumTree::Assign(const std::vector<float>& values) {
+  nodes_.assign(values.begin(), values.end());
+
+  // Each node is added to the next node covering it, which builds the tree in
+  // linear time
+  for (size_t i = 1; i <= nodes_.size(); ++i) {
+    const size_t parent = i + LowBit(i);
+
+    if (parent <= nodes_.size()) {
+      nodes_[parent - 1] += nodes_[i - 1];
+    }
+  }
+}
+
 /************************************
  * TransitionsBasedStatsAccumulator *
  ************************************/
 
+// The row of state S is not normalized, its elements sum is equal to
+// (self + sum(backward[1..S]) + sum(forward[1..N-S-1])). The zeroth lengths
+// are not used, so they are excluded from the prefix sums.
+double TransitionsBasedStatsAccumulator::GetRowNumberOfTransitions(
+    size_t state) const {
+  assert(state < num_states_);
+
+  return total_number_of_self_transitions_ +
+         backward_prefix_sums_.GetPrefixSum(state + 1) -
+         backward_prefix_sums_.GetPrefixSum(1) +
+         forward_prefix_sums_.GetPrefixSum(num_states_ - state) -
+         forward_prefix_sums_.GetPrefixSum(1);
+}
+
 void TransitionsBasedStatsAccumulator::AddState() {
   ++num_states_;
 
   // We initialize new length with zeros
-  total_numbers_of_forward_transitions_.push_back(1);
-  total_numbers_of_backward_transitions_.push_back(1);
+  total_numbers_of_forward_transitions_.push_back(transition_weight_);
+  total_numbers_of_backward_transitions_.push_back(transition_weight_);
+  forward_prefix_sums_.PushBack(transition_weight_);
+  backward_prefix_sums_.PushBack(transition_weight_);
 
-  ++total_number_of_transitions_;
+  total_number_of_transitions_ += transition_weight_;
+}
+
+void TransitionsBasedStatsAccumulator::RemoveState(size_t state) {
+  assert(state < num_states_);
+}
+
+void TransitionsBasedStatsAccumulator::ReuseState(size_t state) {
+  assert(state < num_states_);
+}
+
+void TransitionsBasedStatsAccumulator::Decay(float factor) {
+  assert(factor > 0);
+  assert(factor <= 1);
+
+  transition_weight_ /= factor;
+
+  if (transition_weight_ > kMaxTransitionWeight) {
+    const float scale = 1 / transition_weight_;
+
+    for (size_t length = 0; length < num_states_; ++length) {
+      total_numbers_of_forward_transitions_[length] *= scale;
+      total_numbers_of_backward_transitions_[length] *= scale;
+    }
+
+    // Prefix sums are rebuilt, so the rounding errors do not accumulate
+    forward_prefix_sums_.Assign(total_numbers_of_forward_transitions_);
+    backward_prefix_sums_.Assign(total_numbers_of_backward_transitions_);
+
+    total_number_of_self_transitions_ *= scale;
+    total_number_of_transitions_ *= scale;
+    transition_weight_ = 1;
+  }
 }
 
 void TransitionsBasedStatsAccumulator::AccumulateTransition(size_t state1,
@@ -21,16 +130,20 @@ void TransitionsBasedStatsAccumulator::AccumulateTransition(size_t state1,
 
   if (state1 == state2) {
     // Self-transition
-    total_number_of_self_transitions_ += 1;
+    total_number_of_self_transitions_ += transition_weight_;
   } else if (state1 < state2) {
     // Forward transition
-    total_numbers_of_forward_transitions_[state2 - state1] += 1;
+    total_numbers_of_forward_transitions_[state2 - state1] +=
+        transition_weight_;
+    forward_prefix_sums_.Add(state2 - state1, transition_weight_);
   } else if (state1 > state2) {
     // Backward transition
-    total_numbers_of_backward_transitions_[state1 - state2] += 1;
+    total_numbers_of_backward_transitions_[state1 - state2] +=
+        transition_weight_;
+    backward_prefix_sums_.Add(state1 - state2, transition_weight_);
   }
 
-  ++total_number_of_transitions_;
+  total_number_of_transitions_ += transition_weight_;
 }
 
 void TransitionsBasedStatsAccumulator::GetTransitionProbabilitiesEstimate(
@@ -78,30 +191,206 @@ float TransitionsBasedStatsAccumulator::GetTransitionProbabilityEstimate(
   assert(state1 < num_states_);
   assert(state2 < num_states_);
 
+  const float total_number_of_transitions =
+      static_cast<float>(total_number_of_transitions_);
+
   if (state1 == state2) {
-    return total_number_of_self_transitions_ / total_number_of_transitions_;
+    return total_number_of_self_transitions_ / total_number_of_transitions;
   } else if (state1 < state2) {
     return total_numbers_of_forward_transitions_[state2 - state1] /
-           total_number_of_transitions_;
+           total_number_of_transitions;
   } else { /* if (state1 > state2) { */
     return total_numbers_of_backward_transitions_[state1 - state2] /
-           total_number_of_transitions_;
+           total_number_of_transitions;
+  }
+}
+
+float TransitionsBasedStatsAccumulator::GetTransitionProbabilitiesEstimateSum(
+    size_t state) const {
+  return static_cast<float>(GetRowNumberOfTransitions(state) /
+                            total_number_of_transitions_);
+}
+
+void TransitionsBasedStatsAccumulator::GatherTransitionProbabilitiesEstimate(
+    size_t state, const size_t* states, size_t num_states,
+    float* output) const {
+  assert(state < num_states_);
+  assert(num_states == 0 || (states && output));
+
+  // The same scale as in GetTransitionProbabilitiesEstimate, so the results
+  // are exactly the same
+  const float alpha = static_cast<float>(1.0 / total_number_of_transitions_);
+
+  for (size_t i = 0; i < num_states; ++i) {
+    const size_t next_state = states[i];
+
+    assert(next_state < num_states_);
+
+    if (next_state == state) {
+      output[i] = total_number_of_self_transitions_ * alpha;
+    } else if (next_state > state) {
+      output[i] =
+          total_numbers_of_forward_transitions_[next_state - state] * alpha;
+    } else {
+      output[i] =
+          total_numbers_of_backward_transitions_[state - next_state] * alpha;
+    }
   }
 }
 
+void TransitionsBasedStatsAccumulator::
+    AccumulateNormalizedTransitionProbabilitiesEstimates(
+        const size_t* states, const float* weights, size_t num_states,
+        Vector<float>* output) const {
+  assert(output);
+  assert(output->GetSize() == num_states_);
+
+  if (num_states == 0) {
+    return;
+  }
+
+  assert(states);
+  assert(weights);
+
+  float* output_data = output->GetData();
+
+  for (size_t i = 0; i < num_states; ++i) {
+    const size_t state = states[i];
+
+    assert(state < num_states_);
+
+    const float alpha =
+        static_cast<float>(weights[i] / GetRowNumberOfTransitions(state));
+
+    // See the layout description in GetTransitionProbabilitiesEstimate
+    for (size_t j = 0; j < state; ++j) {
+      output_data[j] +=
+          alpha * total_numbers_of_backward_transitions_[state - j];
+    }
+
+    output_data[state] += alpha * total_number_of_self_transitions_;
+
+    GetLinalgKernels().axpy(alpha,
+                            total_numbers_of_forward_transitions_.data() + 1,
+                            output_data + state + 1, num_states_ - state - 1);
+  }
+}
+
+void TransitionsBasedStatsAccumulator::Save(SnapshotWriter* writer) const {
+  assert(writer);
+
+  // Scratch buffers are not saved
+  writer->Write(kSnapshotTag);
+  writer->Write<uint64_t>(num_states_);
+  writer->WriteVector(total_numbers_of_forward_transitions_);
+  writer->WriteVector(total_numbers_of_backward_transitions_);
+  writer->Write(total_number_of_self_transitions_);
+  writer->Write(total_number_of_transitions_);
+  writer->Write(transition_weight_);
+}
+
+bool TransitionsBasedStatsAccumulator::Load(SnapshotReader* reader,
+                                            size_t num_states) {
+  assert(reader);
+
+  uint32_t tag = 0;
+  uint64_t saved_num_states = 0;
+  std::vector<float> forward_transitions;
+  std::vector<float> backward_transitions;
+  float self_transitions = 0;
+  double transitions = 0;
+  float transition_weight = 0;
+
+  if (!reader->Read(&tag) || tag != kSnapshotTag ||
+      !reader->Read(&saved_num_states) || saved_num_states != num_states ||
+      !reader->ReadVector(&forward_transitions) ||
+      forward_transitions.size() != num_states ||
+      !reader->ReadVector(&backward_transitions) ||
+      backward_transitions.size() != num_states ||
+      !reader->Read(&self_transitions) || !reader->Read(&transitions) ||
+      !reader->Read(&transition_weight) || !(transition_weight > 0)) {
+    return false;
+  }
+
+  num_states_ = num_states;
+  total_numbers_of_forward_transitions_.swap(forward_transitions);
+  total_numbers_of_backward_transitions_.swap(backward_transitions);
+  forward_prefix_sums_.Assign(total_numbers_of_forward_transitions_);
+  backward_prefix_sums_.Assign(total_numbers_of_backward_transitions_);
+  total_number_of_self_transitions_ = self_transitions;
+  total_number_of_transitions_ = transitions;
+  transition_weight_ = transition_weight;
+
+  return true;
+}
+
 /*******************************
  * StatesBasedStatsAccumulator *
  *******************************/
 
 void StatesBasedStatsAccumulator::AddState() {
-  transition_counters_.push_back(1);
-  ++total_number_of_transitions_;
+  transition_counters_.push_back(transition_weight_);
+  initial_counters_.push_back(transition_weight_);
+  total_number_of_transitions_ += transition_weight_;
+  transition_counters_sum_ += transition_weight_;
+}
+
+// Removed state is excluded from the popularity vector, and the reused one
+// is initialized the same way as the freshly added one. The total is
+// decreased by the initial counter of the state, which is the amount it was
+// increased by, since the weight may have grown with decay in the meantime.
+void StatesBasedStatsAccumulator::RemoveState(size_t state) {
+  assert(state < transition_counters_.size());
+
+  total_number_of_transitions_ -= initial_counters_[state];
+  transition_counters_sum_ -= transition_counters_[state];
+  transition_counters_[state] = 0;
+  initial_counters_[state] = 0;
+}
+
+void StatesBasedStatsAccumulator::ReuseState(size_t state) {
+  assert(state < transition_counters_.size());
+  assert(transition_counters_[state] == 0);
+
+  transition_counters_[state] = transition_weight_;
+  initial_counters_[state] = transition_weight_;
+  total_number_of_transitions_ += transition_weight_;
+  transition_counters_sum_ += transition_weight_;
+}
+
+void StatesBasedStatsAccumulator::Decay(float factor) {
+  assert(factor > 0);
+  assert(factor <= 1);
+
+  transition_weight_ /= factor;
+
+  if (transition_weight_ > kMaxTransitionWeight) {
+    const float scale = 1 / transition_weight_;
+
+    // The sums are recomputed, so the rounding errors do not accumulate
+    transition_counters_sum_ = 0;
+
+    for (auto& counter : transition_counters_) {
+      counter *= scale;
+      transition_counters_sum_ += counter;
+    }
+
+    total_number_of_transitions_ = 0;
+
+    for (auto& counter : initial_counters_) {
+      counter *= scale;
+      total_number_of_transitions_ += counter;
+    }
+
+    transition_weight_ = 1;
+  }
 }
 
 void StatesBasedStatsAccumulator::AccumulateTransition(size_t, size_t state2) {
   assert(state2 < transition_counters_.size());
 
-  transition_counters_[state2] += 1;
+  transition_counters_[state2] += transition_weight_;
+  transition_counters_sum_ += transition_weight_;
 }
 
 // Basically this method yields the average probabilities of transitions to
@@ -126,3 +415,86 @@ float StatesBasedStatsAccumulator::GetTransitionProbabilityEstimate(
 
   return transition_counters_[state2];
 }
+
+float StatesBasedStatsAccumulator::GetTransitionProbabilitiesEstimateSum(
+    size_t) const {
+  return static_cast<float>(transition_counters_sum_ /
+                            total_number_of_transitions_);
+}
+
+void StatesBasedStatsAccumulator::GatherTransitionProbabilitiesEstimate(
+    size_t, const size_t* states, size_t num_states, float* output) const {
+  assert(num_states == 0 || (states && output));
+
+  // The same scale as in GetTransitionProbabilitiesEstimate, so the results
+  // are exactly the same
+  const float alpha = static_cast<float>(1.0 / total_number_of_transitions_);
+
+  for (size_t i = 0; i < num_states; ++i) {
+    assert(states[i] < transition_counters_.size());
+
+    output[i] = transition_counters_[states[i]] * alpha;
+  }
+}
+
+void StatesBasedStatsAccumulator::
+    AccumulateNormalizedTransitionProbabilitiesEstimates(
+        const size_t*, const float* weights, size_t num_states,
+        Vector<float>* output) const {
+  assert(output);
+  assert(output->GetSize() == transition_counters_.size());
+
+  if (num_states == 0) {
+    return;
+  }
+
+  assert(weights);
+
+  const double weights_sum =
+      std::accumulate(weights, weights + num_states, 0.0);
+  const float alpha =
+      static_cast<float>(weights_sum / transition_counters_sum_);
+
+  GetLinalgKernels().axpy(alpha, transition_counters_.data(),
+                          output->GetData(), transition_counters_.size());
+}
+
+void StatesBasedStatsAccumulator::Save(SnapshotWriter* writer) const {
+  assert(writer);
+
+  writer->Write(kSnapshotTag);
+  writer->WriteVector(transition_counters_);
+  writer->WriteVector(initial_counters_);
+  writer->Write(total_number_of_transitions_);
+  writer->Write(transition_weight_);
+}
+
+bool StatesBasedStatsAccumulator::Load(SnapshotReader* reader,
+                                       size_t num_states) {
+  assert(reader);
+
+  uint32_t tag = 0;
+  std::vector<float> transition_counters;
+  std::vector<float> initial_counters;
+  double transitions = 0;
+  float transition_weight = 0;
+
+  if (!reader->Read(&tag) || tag != kSnapshotTag ||
+      !reader->ReadVector(&transition_counters) ||
+      transition_counters.size() != num_states ||
+      !reader->ReadVector(&initial_counters) ||
+      initial_counters.size() != num_states ||
+      !reader->Read(&transitions) || !reader->Read(&transition_weight) ||
+      !(transition_weight > 0)) {
+    return false;
+  }
+
+  transition_counters_.swap(transition_counters);
+  initial_counters_.swap(initial_counters);
+  transition_counters_sum_ = std::accumulate(
+      transition_counters_.begin(), transition_counters_.end(), 0.0);
+  total_number_of_transitions_ = transitions;
+  transition_weight_ = transition_weight;
+
+  return true;
+}
\ No newline at end of file
@@ -0,0 +1,50 @@
+#include "snapshot.h"
+
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+bool MappedFile::Open(const std::string& path) {
+  Close();
+
+  const int fd = open(path.c_str(), O_RDONLY);
+
+  if (fd < 0) {
+    return false;
+  }
+
+  struct stat file_stat;
+
+  if (fstat(fd, &file_stat) != 0 || file_stat.st_size == 0) {
+    close(fd);
+    return false;
+  }
+
+  const size_t size = static_cast<size_t>(file_stat.st_size);
+  void* data = mmap(nullptr, size, PROT_READ, MAP_PRIVATE, fd, 0);
+
+  // The mapping stays valid after the descriptor is closed
+  close(fd);
+
+  if (data == MAP_FAILED) {
+    return false;
+  }
+
+  // Snapshot is read sequentially from the beginning to the end
+  madvise(data, size, MADV_SEQUENTIAL);
+
+  data_ = data;
+  size_ = size;
+
+  return true;
+}
+
+void MappedFile::Close() {
+  if (data_) {
+    munmap(data_, size_);
+  }
+
+  data_ = nullptr;
+  size_ = 0;
+}
@@ -0,0 +1,140 @@
+#include <frequency_sketch.h>
+#include <markov_chain_cache.h>
+
+#include <iostream>
+
+#include "test_delegates.h"
+
+// Replays a cyclic workload, which fits into the cache, interleaved with the
+// one-hit wonders, with and without admission filter. Checks that the filter
+// keeps the one-hit wonders from pushing the cyclic items out of cache and
+// that the items in cache always fit into the cache capacity. Also checks the
+// frequency sketch estimates.
+
+namespace {
+
+const size_t kNumHotKeys = 20;
+const size_t kNumRounds = 100;
+const size_t kFirstColdKey = 1000;
+const float kCacheCapacity = 20;
+
+// Returns the number of hits of the cyclic items or a negative value on
+// failure. All the items have unit sizes.
+long Run(bool admission_filter, size_t admission_sketch_width) {
+  MarkovChainCacheConfig cfg;
+
+  cfg.cache_capacity = kCacheCapacity;
+  cfg.admission_filter = admission_filter;
+  cfg.admission_sketch_width = admission_sketch_width;
+
+  TrackingDelegate delegate;
+  MarkovChainCache<size_t> cache(cfg, &delegate);
+  long num_hits = 0;
+  size_t cold_key = kFirstColdKey;
+
+  for (size_t key = 0; key < kNumHotKeys; ++key) {
+    cache.ProcessSetRequest(key, 1);
+  }
+
+  // Cold items are known to the cache, but each of them is requested once
+  for (size_t key = 0; key < kNumRounds * kNumHotKeys; ++key) {
+    cache.ProcessSetRequest(kFirstColdKey + key, 1);
+  }
+
+  for (size_t i = 0; i < kNumRounds; ++i) {
+    for (size_t key = 0; key < kNumHotKeys; ++key) {
+      num_hits += cache.ProcessGetRequest(key);
+      cache.ProcessGetRequest(cold_key);
+
+      if (delegate.GetCacheSize() > kCacheCapacity) {
+        std::cerr << "Cache size exceeds the capacity: "
+                  << delegate.GetCacheSize() << std::endl;
+        return -1;
+      }
+
+      ++cold_key;
+    }
+  }
+
+  return num_hits;
+}
+
+// Returns false on failure
+bool CheckFrequencySketch() {
+  FrequencySketch<size_t> sketch(1000);
+
+  if (sketch.GetWidth() != 1024) {
+    std::cerr << "Sketch width is not rounded up: " << sketch.GetWidth()
+              << std::endl;
+    return false;
+  }
+
+  // Count-min sketch never underestimates until the counters are halved
+  for (size_t key = 0; key < 100; ++key) {
+    for (size_t i = 0; i < key % 10; ++i) {
+      sketch.Increment(key);
+    }
+  }
+
+  for (size_t key = 0; key < 100; ++key) {
+    if (sketch.Estimate(key) < key % 10) {
+      std::cerr << "Frequency of key " << key << " is underestimated"
+                << std::endl;
+      return false;
+    }
+  }
+
+  // Counters saturate instead of overflowing, and the frequent key fades away
+  // once the other keys are counted
+  for (size_t i = 0; i < 1000; ++i) {
+    sketch.Increment(0);
+  }
+
+  if (sketch.Estimate(0) != 255) {
+    std::cerr << "Counters are not saturated" << std::endl;
+    return false;
+  }
+
+  for (size_t key = 0; key < 10 * sketch.GetWidth(); ++key) {
+    sketch.Increment(kFirstColdKey + key);
+  }
+
+  if (sketch.Estimate(0) >= 255) {
+    std::cerr << "Counters are not halved" << std::endl;
+    return false;
+  }
+
+  return true;
+}
+
+}  // namespace
+
+int main() {
+  if (!CheckFrequencySketch()) {
+    return 1;
+  }
+
+  const long num_hits = Run(false, 0);
+  // Zero width means the default one
+  const long num_filtered_hits = Run(true, 0);
+  const long num_sketch_filtered_hits = Run(true, 1024);
+
+  if (num_hits < 0 || num_filtered_hits < 0 || num_sketch_filtered_hits < 0) {
+    return 1;
+  }
+
+  if (num_filtered_hits <= num_hits || num_sketch_filtered_hits <= num_hits) {
+    std::cerr << "Admission filter does not improve hits: " << num_filtered_hits
+              << " and " << num_sketch_filtered_hits << " vs " << num_hits
+              << std::endl;
+    return 1;
+  }
+
+  std::cout << "Hits: " << num_hits << " without admission filter, "
+            << num_filtered_hits << " with default frequency sketch, "
+            << num_sketch_filtered_hits << " with narrow frequency sketch"
+            << std::endl;
+  std::cout << "OK" << std::endl;
+
+  return 0;
+}
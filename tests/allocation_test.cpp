@@ -0,0 +1,110 @@
+#include <markov_chain_cache.h>
+
+#include <cstdlib>
+#include <iostream>
+#include <new>
+
+// Checks that steady-state request processing does not perform heap
+// allocations. Global allocation functions are replaced with the counting ones.
+// Exits with non-zero code if any allocation is detected.
+
+namespace {
+
+size_t num_allocations = 0;
+
+const size_t kNumItems = 200;
+const size_t kNumWarmUpRounds = 5;
+const size_t kNumRounds = 5;
+
+// Requests items in a fixed pseudo-random order, so that the cache is
+// thrashed and every round contains both hits and misses, while the set of
+// observed transitions stops growing after the first round.
+void ProcessRound(MarkovChainCache<size_t>* cache, size_t* num_hits) {
+  for (size_t i = 0; i < kNumItems; ++i) {
+    if (cache->ProcessGetRequest((i * 37) % kNumItems)) {
+      ++*num_hits;
+    }
+  }
+}
+
+bool CheckAllocations(const std::string& stats_accumulator_type,
+                      size_t forecast_length) {
+  MarkovChainCacheConfig cfg;
+
+  cfg.cache_capacity = kNumItems / 2;
+  cfg.stats_accumulator_type = stats_accumulator_type;
+  cfg.forecast_length = forecast_length;
+
+  MarkovChainCache<size_t> cache(cfg);
+
+  for (size_t i = 0; i < kNumItems; ++i) {
+    cache.ProcessSetRequest(i, 1);
+  }
+
+  size_t num_hits = 0;
+
+  for (size_t i = 0; i < kNumWarmUpRounds; ++i) {
+    ProcessRound(&cache, &num_hits);
+  }
+
+  num_hits = 0;
+  num_allocations = 0;
+
+  for (size_t i = 0; i < kNumRounds; ++i) {
+    ProcessRound(&cache, &num_hits);
+  }
+
+  const size_t steady_state_allocations = num_allocations;
+
+  if (steady_state_allocations != 0 || num_hits == 0 ||
+      num_hits == kNumRounds * kNumItems) {
+    std::cerr << stats_accumulator_type
+              << " (forecast length = " << forecast_length
+              << "): " << steady_state_allocations << " allocations, "
+              << num_hits << " hits" << std::endl;
+    return false;
+  }
+
+  return true;
+}
+
+}  // namespace
+
+void* operator new(size_t size) {
+  ++num_allocations;
+
+  if (void* ptr = std::malloc(size)) {
+    return ptr;
+  }
+
+  throw std::bad_alloc();
+}
+
+void* operator new[](size_t size) {
+  ++num_allocations;
+
+  if (void* ptr = std::malloc(size)) {
+    return ptr;
+  }
+
+  throw std::bad_alloc();
+}
+
+void operator delete(void* ptr) noexcept { std::free(ptr); }
+
+void operator delete[](void* ptr) noexcept { std::free(ptr); }
+
+void operator delete(void* ptr, size_t) noexcept { std::free(ptr); }
+
+void operator delete[](void* ptr, size_t) noexcept { std::free(ptr); }
+
+int main() {
+  bool ok = true;
+
+  for (const auto& type : {"states", "transitions"}) {
+    ok &= CheckAllocations(type, 1);
+    ok &= CheckAllocations(type, 3);
+  }
+
+  return ok ? 0 : 1;
+}
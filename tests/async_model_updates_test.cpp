@@ -0,0 +1,105 @@
+#include <markov_chain_cache.h>
+
+#include <iostream>
+#include <random>
+
+// Checks that the cache with asynchronous model updates makes the same
+// decisions as the cache with synchronous updates once the learner thread has
+// caught up, and that it keeps serving requests while the model is being
+// updated in background. Exits with non-zero code on failure.
+
+namespace {
+
+const size_t kNumItems = 500;
+const size_t kNumRequests = 20000;
+
+float ItemSize(size_t key) { return 1 + key % 50; }
+
+std::vector<size_t> GenerateRequests() {
+  std::mt19937 generator(42);
+  std::geometric_distribution<size_t> distribution(0.05);
+
+  std::vector<size_t> requests;
+  size_t item = 0;
+
+  for (size_t i = 0; i < kNumRequests; ++i) {
+    item = (item + distribution(generator)) % kNumItems;
+    requests.push_back(item);
+  }
+
+  return requests;
+}
+
+MarkovChainCacheConfig MakeConfig(bool async_model_updates) {
+  MarkovChainCacheConfig cfg;
+
+  cfg.cache_capacity = 1000;
+  cfg.async_model_updates = async_model_updates;
+  cfg.transitions_queue_capacity = 256;
+  cfg.learner_batch_size = 32;
+
+  return cfg;
+}
+
+bool CheckSynchronizedUpdates(const std::vector<size_t>& requests) {
+  MarkovChainCache<size_t> cache(MakeConfig(false));
+  MarkovChainCache<size_t> async_cache(MakeConfig(true));
+
+  for (size_t i = 0; i < kNumItems; ++i) {
+    cache.ProcessSetRequest(i, ItemSize(i));
+    async_cache.ProcessSetRequest(i, ItemSize(i));
+  }
+
+  for (const auto& key : requests) {
+    if (cache.ProcessGetRequest(key) != async_cache.ProcessGetRequest(key)) {
+      std::cerr << "Asynchronous cache mismatch" << std::endl;
+      return false;
+    }
+
+    async_cache.WaitForModelUpdates();
+  }
+
+  if (async_cache.GetNumDroppedTransitions() != 0) {
+    std::cerr << "Unexpected dropped transitions" << std::endl;
+    return false;
+  }
+
+  return true;
+}
+
+bool CheckBackgroundUpdates(const std::vector<size_t>& requests) {
+  MarkovChainCache<size_t> cache(MakeConfig(true));
+
+  for (size_t i = 0; i < kNumItems; ++i) {
+    cache.ProcessSetRequest(i, ItemSize(i));
+  }
+
+  size_t num_hits = 0;
+
+  for (const auto& key : requests) {
+    num_hits += cache.ProcessGetRequest(key);
+  }
+
+  cache.WaitForModelUpdates();
+
+  if (num_hits == 0) {
+    std::cerr << "No hits with background model updates" << std::endl;
+    return false;
+  }
+
+  return true;
+}
+
+}  // namespace
+
+int main() {
+  const std::vector<size_t> requests = GenerateRequests();
+
+  if (!CheckSynchronizedUpdates(requests) || !CheckBackgroundUpdates(requests)) {
+    return 1;
+  }
+
+  std::cout << "OK" << std::endl;
+
+  return 0;
+}
\ No newline at end of file
@@ -0,0 +1,189 @@
+#include <markov_chain_cache.h>
+
+#include <algorithm>
+#include <iostream>
+#include <random>
+#include <vector>
+
+#include "test_delegates.h"
+
+// Runs a workload in batches and checks that the hits bitmaps and the admitted
+// and evicted keys lists agree with the delegate notifications, that the items
+// in cache always fit into the cache capacity, and that the batched cache
+// achieves a hit ratio comparable to the one of the cache processing requests
+// one by one.
+
+namespace {
+
+const size_t kNumKeys = 500;
+const size_t kNumRequests = 50000;
+const size_t kBatchSize = 16;
+const float kCacheCapacity = 600;
+
+// Batched processing is allowed to lose this fraction of the hit ratio
+const float kMaxHitRatioLoss = 0.1f;
+
+// Each key is followed by one of two fixed successors
+std::vector<size_t> GenerateRequests(std::mt19937* generator) {
+  std::uniform_int_distribution<size_t> keys_distribution(0, kNumKeys - 1);
+  std::bernoulli_distribution successors_distribution(0.8);
+
+  std::vector<size_t> successors(2 * kNumKeys);
+
+  for (auto& successor : successors) {
+    successor = keys_distribution(*generator);
+  }
+
+  std::vector<size_t> requests(kNumRequests);
+  size_t key = 0;
+
+  for (auto& request : requests) {
+    key = successors[2 * key + successors_distribution(*generator)];
+    request = key;
+  }
+
+  return requests;
+}
+
+float RunSequential(const MarkovChainCacheConfig& cfg,
+                    const std::vector<size_t>& requests,
+                    const std::vector<float>& item_sizes) {
+  MarkovChainCache<size_t> cache(cfg);
+  size_t num_hits = 0;
+
+  for (const auto& key : requests) {
+    if (!cache.Contains(key)) {
+      cache.ProcessSetRequest(key, item_sizes[key]);
+    } else {
+      num_hits += cache.ProcessGetRequest(key);
+    }
+  }
+
+  return static_cast<float>(num_hits) / requests.size();
+}
+
+// Returns negative value on failure
+float RunBatched(const MarkovChainCacheConfig& cfg,
+                 const std::vector<size_t>& requests,
+                 const std::vector<float>& item_sizes) {
+  TrackingDelegate delegate(
+      [&item_sizes](size_t key) { return item_sizes[key]; });
+  MarkovChainCache<size_t> cache(cfg, &delegate);
+  CacheBatchResult<size_t> result;
+
+  std::vector<size_t> get_keys;
+  std::vector<size_t> set_keys;
+  std::vector<float> set_sizes;
+  size_t num_hits = 0;
+
+  for (size_t begin = 0; begin < requests.size(); begin += kBatchSize) {
+    const size_t end = std::min(begin + kBatchSize, requests.size());
+
+    get_keys.clear();
+    set_keys.clear();
+    set_sizes.clear();
+
+    for (size_t i = begin; i < end; ++i) {
+      if (cache.Contains(requests[i])) {
+        get_keys.push_back(requests[i]);
+      } else {
+        set_keys.push_back(requests[i]);
+        set_sizes.push_back(item_sizes[requests[i]]);
+      }
+    }
+
+    cache.ProcessSetBatch(set_keys.data(), set_sizes.data(), set_keys.size(),
+                          &result);
+
+    if (result.admitted_keys != delegate.PopAdmittedKeys() ||
+        result.evicted_keys != delegate.PopEvictedKeys()) {
+      std::cerr << "Set batch result does not match the notifications"
+                << std::endl;
+      return -1;
+    }
+
+    // Hits are expected for the items, which are in cache at the beginning of
+    // the batch
+    std::vector<uint8_t> expected_hits;
+
+    for (const auto& key : get_keys) {
+      expected_hits.push_back(delegate.IsResident(key));
+    }
+
+    cache.ProcessGetBatch(get_keys.data(), get_keys.size(), &result);
+
+    if (result.hits != expected_hits) {
+      std::cerr << "Unexpected hits bitmap" << std::endl;
+      return -1;
+    }
+
+    if (result.admitted_keys != delegate.PopAdmittedKeys() ||
+        result.evicted_keys != delegate.PopEvictedKeys()) {
+      std::cerr << "Get batch result does not match the notifications"
+                << std::endl;
+      return -1;
+    }
+
+    if (delegate.GetCacheSize() > kCacheCapacity) {
+      std::cerr << "Cache size exceeds the capacity: "
+                << delegate.GetCacheSize() << std::endl;
+      return -1;
+    }
+
+    for (const auto& hit : result.hits) {
+      num_hits += hit;
+    }
+  }
+
+  return static_cast<float>(num_hits) / requests.size();
+}
+
+bool CheckBatches(const std::string& stats_accumulator_type) {
+  std::mt19937 generator(42);
+  std::uniform_int_distribution<int> sizes_distribution(1, 10);
+
+  std::vector<float> item_sizes(kNumKeys);
+
+  for (auto& size : item_sizes) {
+    size = sizes_distribution(generator);
+  }
+
+  const std::vector<size_t> requests = GenerateRequests(&generator);
+
+  MarkovChainCacheConfig cfg;
+
+  cfg.cache_capacity = kCacheCapacity;
+  cfg.stats_accumulator_type = stats_accumulator_type;
+
+  const float sequential_hit_ratio = RunSequential(cfg, requests, item_sizes);
+  const float batched_hit_ratio = RunBatched(cfg, requests, item_sizes);
+
+  if (batched_hit_ratio < 0) {
+    return false;
+  }
+
+  if (batched_hit_ratio < sequential_hit_ratio - kMaxHitRatioLoss) {
+    std::cerr << "Batched hit ratio " << batched_hit_ratio
+              << " is too low compared to " << sequential_hit_ratio
+              << std::endl;
+    return false;
+  }
+
+  return true;
+}
+
+}  // namespace
+
+int main() {
+  for (const auto& stats_accumulator_type : {"transitions", "states"}) {
+    if (!CheckBatches(stats_accumulator_type)) {
+      std::cerr << "Failed with " << stats_accumulator_type
+                << " stats accumulator" << std::endl;
+      return 1;
+    }
+  }
+
+  std::cout << "OK" << std::endl;
+
+  return 0;
+}
@@ -0,0 +1,218 @@
+#include <math/evolving_markov_chain.h>
+
+#include <cmath>
+#include <iostream>
+#include <random>
+#include <vector>
+
+// Checks that the bounded rows of the transitions stats matrix keep the most
+// observed successors only, account the replaced ones in the residual mass and
+// that the predictions made with the residual mass are still normalized,
+// including the one step predictions, which sum up to the accesses count.
+// Exits with non-zero code on failure.
+
+namespace {
+
+const size_t kAccessesThreshold = 5;
+const size_t kMaxSuccessors = 2;
+const size_t kNumStates = 50;
+const size_t kNumRandomTransitions = 10000;
+
+const float kTolerance = 1e-4f;
+
+// Returns false on failure
+bool CheckBoundedRow(const std::string& stats_accumulator_type) {
+  EvolvingMarkovChain chain(stats_accumulator_type, kAccessesThreshold,
+                            kMaxSuccessors);
+
+  for (size_t i = 0; i < 4; ++i) {
+    chain.AddState();
+  }
+
+  // The third successor replaces the least observed one
+  for (size_t i = 0; i < 5; ++i) {
+    chain.RegisterTransition(0, 1);
+  }
+
+  for (size_t i = 0; i < 3; ++i) {
+    chain.RegisterTransition(0, 2);
+  }
+
+  chain.RegisterTransition(0, 3);
+
+  const SparseVector<float>& row = chain.GetTransitionsRow(0);
+
+  if (row.GetNumNonZeros() != kMaxSuccessors || row(1) != 5 || row(2) != 0 ||
+      row(3) != 1) {
+    std::cerr << "Least observed successor is not replaced" << std::endl;
+    return false;
+  }
+
+  if (chain.GetResidualMass(0) != 3 || chain.GetStateAccessesCount(0) != 9) {
+    std::cerr << "Replaced transitions are not accounted in residual mass: "
+              << chain.GetResidualMass(0) << std::endl;
+    return false;
+  }
+
+  // The replaced successor keeps a non-zero probability
+  const size_t states[] = {1, 2, 3};
+  float probabilities[3];
+
+  chain.PredictNextState(0, states, 3, probabilities);
+
+  if (probabilities[0] < 5 || probabilities[1] <= 0 || probabilities[2] < 1) {
+    std::cerr << "Residual mass is not spread over the states" << std::endl;
+    return false;
+  }
+
+  Vector<float> next_state(chain.GetNumStates(), FillType::kZeros);
+  chain.PredictNextState(0, &next_state);
+
+  for (size_t i = 0; i < 3; ++i) {
+    if (std::fabs(next_state(states[i]) - probabilities[i]) > kTolerance) {
+      std::cerr << "Gathered prediction mismatch for state " << states[i]
+                << std::endl;
+      return false;
+    }
+  }
+
+  return true;
+}
+
+// Returns false on failure
+bool CheckRandomTransitions(const std::string& stats_accumulator_type) {
+  EvolvingMarkovChain chain(stats_accumulator_type, kAccessesThreshold,
+                            kMaxSuccessors);
+
+  for (size_t i = 0; i < kNumStates; ++i) {
+    chain.AddState();
+  }
+
+  std::mt19937 generator(42);
+  std::uniform_int_distribution<size_t> states_distribution(0, kNumStates - 1);
+
+  // Every state has the heavy hitter successor, which is followed in half of
+  // the transitions
+  size_t state = 0;
+
+  for (size_t i = 0; i < kNumRandomTransitions; ++i) {
+    const size_t next_state = i % 2 == 0 ? (state + 1) % kNumStates
+                                         : states_distribution(generator);
+
+    chain.RegisterTransition(state, next_state);
+    state = next_state;
+  }
+
+  Vector<float> current_state(kNumStates, FillType::kZeros);
+  current_state(0) = 0.5f;
+  current_state(1) = 0.5f;
+
+  const Vector<float> next_state = chain.PredictNextState(current_state);
+  float sum = 0;
+
+  for (size_t i = 0; i < kNumStates; ++i) {
+    sum += next_state(i);
+  }
+
+  if (std::fabs(sum - 1) > kTolerance) {
+    std::cerr << "Prediction is not normalized: " << sum << std::endl;
+    return false;
+  }
+
+  const Matrix<float>& stochastic_matrix = chain.GetStochasticMatrix();
+
+  for (size_t i = 0; i < kNumStates; ++i) {
+    const SparseVector<float>& row = chain.GetTransitionsRow(i);
+    const float accesses_count = chain.GetStateAccessesCount(i);
+
+    if (row.GetNumNonZeros() > kMaxSuccessors) {
+      std::cerr << "Row " << i << " is not bounded: " << row.GetNumNonZeros()
+                << std::endl;
+      return false;
+    }
+
+    if (row((i + 1) % kNumStates) < 0.4f * accesses_count) {
+      std::cerr << "Heavy hitter successor of " << i << " is not retained"
+                << std::endl;
+      return false;
+    }
+
+    float row_sum = 0;
+
+    for (size_t j = 0; j < kNumStates; ++j) {
+      row_sum += stochastic_matrix(i, j);
+    }
+
+    if (std::fabs(row_sum - 1) > kTolerance) {
+      std::cerr << "Row " << i << " of stochastic matrix is not normalized: "
+                << row_sum << std::endl;
+      return false;
+    }
+  }
+
+  return true;
+}
+
+// Returns false on failure
+bool CheckOneStepMass(const std::string& stats_accumulator_type) {
+  EvolvingMarkovChain chain(stats_accumulator_type, kAccessesThreshold, 1);
+
+  for (size_t i = 0; i < kNumStates; ++i) {
+    chain.AddState();
+  }
+
+  // Almost all the transitions are moved to the residual mass
+  for (size_t i = 0; i < 450; ++i) {
+    chain.RegisterTransition(0, 1 + i % 9);
+  }
+
+  const float accesses_count = chain.GetStateAccessesCount(0);
+
+  Vector<float> next_state(kNumStates, FillType::kZeros);
+  chain.PredictNextState(0, &next_state);
+
+  std::vector<size_t> states(kNumStates);
+  std::vector<float> probabilities(kNumStates);
+
+  for (size_t i = 0; i < kNumStates; ++i) {
+    states[i] = i;
+  }
+
+  chain.PredictNextState(0, states.data(), kNumStates, probabilities.data());
+
+  float sum = 0;
+  float gathered_sum = 0;
+
+  for (size_t i = 0; i < kNumStates; ++i) {
+    sum += next_state(i);
+    gathered_sum += probabilities[i];
+  }
+
+  if (std::fabs(sum / accesses_count - 1) > kTolerance ||
+      std::fabs(gathered_sum / accesses_count - 1) > kTolerance) {
+    std::cerr << "One step prediction mass " << sum << " (gathered "
+              << gathered_sum << ") does not match accesses count "
+              << accesses_count << std::endl;
+    return false;
+  }
+
+  return true;
+}
+
+}  // namespace
+
+int main() {
+  for (const auto& stats_accumulator_type : {"transitions", "states"}) {
+    if (!CheckBoundedRow(stats_accumulator_type) ||
+        !CheckRandomTransitions(stats_accumulator_type) ||
+        !CheckOneStepMass(stats_accumulator_type)) {
+      std::cerr << "Failed with " << stats_accumulator_type
+                << " stats accumulator" << std::endl;
+      return 1;
+    }
+  }
+
+  std::cout << "OK" << std::endl;
+
+  return 0;
+}
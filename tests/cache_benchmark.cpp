@@ -0,0 +1,171 @@
+#include <markov_chain_cache.h>
+
+#include <algorithm>
+#include <chrono>
+#include <iomanip>
+#include <iostream>
+#include <random>
+#include <string>
+#include <vector>
+
+// Measures the time per request of the cache configured at runtime and of the
+// cache with the policies fixed at compile time on the same synthetic workload
+// and reports the per-request delta. Hit ratios of both caches are expected to
+// be identical.
+
+namespace {
+
+const size_t kNumKeys = 2000;
+const size_t kNumRequests = 200000;
+const float kCacheCapacity = 6000;
+
+const size_t kNumSuccessors = 3;
+const double kSuccessorsWeights[kNumSuccessors] = {0.7, 0.2, 0.1};
+
+// Each measurement is repeated this number of times and the best time is taken
+const size_t kNumRepetitions = 5;
+
+struct Request {
+  size_t key;
+  float size;
+};
+
+// Each key is followed by one of a few fixed successors with skewed
+// probabilities, so the transitions are predictable enough for the Markov chain
+// to learn them
+std::vector<Request> GenerateRequests() {
+  std::mt19937 generator(42);
+  std::uniform_int_distribution<size_t> keys_distribution(0, kNumKeys - 1);
+  std::uniform_int_distribution<int> sizes_distribution(1, 10);
+  std::discrete_distribution<size_t> successors_distribution(
+      kSuccessorsWeights, kSuccessorsWeights + kNumSuccessors);
+
+  std::vector<float> sizes(kNumKeys);
+  std::vector<size_t> successors(kNumKeys * kNumSuccessors);
+
+  for (auto& size : sizes) {
+    size = sizes_distribution(generator);
+  }
+
+  for (auto& successor : successors) {
+    successor = keys_distribution(generator);
+  }
+
+  std::vector<Request> requests(kNumRequests);
+  size_t key = 0;
+
+  for (auto& request : requests) {
+    key = successors[key * kNumSuccessors + successors_distribution(generator)];
+    request = {key, sizes[key]};
+  }
+
+  return requests;
+}
+
+// Counts the notifications. The class is final, so the calls are not virtual
+// if the cache is specialized for it.
+class CountingDelegate final : public CacheDelegate<size_t> {
+ public:
+  void AdmitItem(const size_t&) const override { num_admitted_items_++; }
+
+  void EvictItem(const size_t&) const override { num_evicted_items_++; }
+
+ private:
+  mutable size_t num_admitted_items_ = 0;
+  mutable size_t num_evicted_items_ = 0;
+};
+
+struct Result {
+  double nanoseconds_per_request;
+  double hit_ratio;
+};
+
+// Items are set on the first request and requested afterwards
+template <typename Cache, typename Delegate>
+Result Run(const MarkovChainCacheConfig& cfg,
+           const std::vector<Request>& requests) {
+  typedef std::chrono::steady_clock Clock;
+
+  Delegate delegate;
+  Cache cache(cfg, &delegate);
+  std::vector<bool> is_set(kNumKeys, false);
+  size_t num_hits = 0;
+
+  const Clock::time_point begin = Clock::now();
+
+  for (const auto& request : requests) {
+    if (!is_set[request.key]) {
+      cache.ProcessSetRequest(request.key, request.size);
+      is_set[request.key] = true;
+    } else {
+      num_hits += cache.ProcessGetRequest(request.key);
+    }
+  }
+
+  const double elapsed_nanoseconds =
+      std::chrono::duration<double, std::nano>(Clock::now() - begin).count();
+
+  return {elapsed_nanoseconds / requests.size(),
+          static_cast<double>(num_hits) / requests.size()};
+}
+
+// Keeps the best time of the repeated measurements
+void UpdateBestResult(const Result& result, Result* best_result) {
+  if (best_result->nanoseconds_per_request == 0 ||
+      result.nanoseconds_per_request < best_result->nanoseconds_per_request) {
+    *best_result = result;
+  }
+}
+
+template <typename Accumulator>
+void Benchmark(const std::string& stats_accumulator_type,
+               const std::vector<Request>& requests) {
+  MarkovChainCacheConfig cfg;
+
+  cfg.cache_capacity = kCacheCapacity;
+  cfg.stats_accumulator_type = stats_accumulator_type;
+
+  Result runtime_result = {0, 0};
+  Result static_result = {0, 0};
+
+  // Measurements are interleaved, so both caches are equally affected by the
+  // machine load fluctuations
+  for (size_t i = 0; i < kNumRepetitions; ++i) {
+    UpdateBestResult(
+        Run<MarkovChainCache<size_t>, CountingDelegate>(cfg, requests),
+        &runtime_result);
+    UpdateBestResult(
+        Run<MarkovChainCache<size_t, Accumulator, 1, CountingDelegate>,
+            CountingDelegate>(cfg, requests),
+        &static_result);
+  }
+
+  std::cout << std::setw(12) << stats_accumulator_type << std::setw(12)
+            << runtime_result.nanoseconds_per_request << std::setw(12)
+            << static_result.nanoseconds_per_request << std::setw(12)
+            << runtime_result.nanoseconds_per_request -
+                   static_result.nanoseconds_per_request
+            << std::setw(12) << runtime_result.hit_ratio << std::setw(12)
+            << static_result.hit_ratio << std::endl;
+}
+
+}  // namespace
+
+int main() {
+  const std::vector<Request> requests = GenerateRequests();
+
+  std::cout << std::fixed << std::setprecision(2);
+  std::cout << "Time per request (ns) and hit ratio for the cache configured "
+               "at runtime and the cache with the policies fixed at compile "
+               "time"
+            << std::endl;
+  std::cout << std::setw(12) << "accumulator" << std::setw(12) << "runtime"
+            << std::setw(12) << "static" << std::setw(12) << "delta"
+            << std::setw(12) << "hit runtime" << std::setw(12) << "hit static"
+            << std::endl;
+
+  Benchmark<TransitionsBasedStatsAccumulator>("transitions", requests);
+  Benchmark<StatesBasedStatsAccumulator>("states", requests);
+
+  return 0;
+}
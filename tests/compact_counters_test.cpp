@@ -0,0 +1,175 @@
+#include <math/evolving_markov_chain.h>
+#include <snapshot.h>
+
+#include <cmath>
+#include <iostream>
+#include <sstream>
+#include <string>
+
+// Checks that the compact counters never saturate, keep the proportions of the
+// transitions, are halved on decay and give the same predictions as floats
+// until they are halved, including the chain loaded from the snapshot of float
+// counters. Exits with non-zero code on failure.
+
+namespace {
+
+const size_t kAccessesThreshold = 5;
+const size_t kNumStates = 4;
+
+const float kTolerance = 1e-4f;
+
+// Returns the normalized prediction from the given state
+Vector<float> Predict(EvolvingMarkovChain* chain, size_t state) {
+  Vector<float> current_state(chain->GetNumStates(), FillType::kZeros);
+  current_state(state) = 1;
+
+  return chain->PredictNextState(current_state);
+}
+
+bool IsSamePrediction(const Vector<float>& prediction,
+                      const Vector<float>& expected_prediction) {
+  for (size_t i = 0; i < expected_prediction.GetSize(); ++i) {
+    if (std::fabs(prediction(i) - expected_prediction(i)) > kTolerance) {
+      return false;
+    }
+  }
+
+  return true;
+}
+
+// Returns false on failure
+bool CheckSaturation() {
+  EvolvingMarkovChain chain("transitions", kAccessesThreshold, 0, 8);
+
+  for (size_t i = 0; i < kNumStates; ++i) {
+    chain.AddState();
+  }
+
+  for (size_t i = 0; i < 1000; ++i) {
+    chain.RegisterTransition(0, 1 + i % 4 / 3);
+
+    if (chain.GetStateAccessesCount(0) > 255) {
+      std::cerr << "Counters saturate: " << chain.GetStateAccessesCount(0)
+                << std::endl;
+      return false;
+    }
+  }
+
+  // The row is halved on saturation, so the proportions are kept
+  const SparseVector<float>& row = chain.GetTransitionsRow(0);
+
+  if (row(1) + row(2) != chain.GetStateAccessesCount(0) ||
+      std::fabs(row(1) / row(2) - 3) > 0.1f) {
+    std::cerr << "Proportions are not kept: " << row << std::endl;
+    return false;
+  }
+
+  // Decay halves the counters once it accumulates to one half
+  const float accesses_count = chain.GetStateAccessesCount(0);
+
+  chain.Decay(0.8f);
+
+  if (chain.GetStateAccessesCount(0) != accesses_count) {
+    std::cerr << "Counters are halved too early" << std::endl;
+    return false;
+  }
+
+  chain.Decay(0.5f);
+
+  if (std::fabs(chain.GetStateAccessesCount(0) - accesses_count / 2) > 1) {
+    std::cerr << "Counters are not halved on decay: "
+              << chain.GetStateAccessesCount(0) << std::endl;
+    return false;
+  }
+
+  // Removed states are erased from the compact rows as well
+  const size_t removed_state = 2;
+  chain.RemoveStates(&removed_state, 1);
+
+  if (chain.GetTransitionsRow(0)(2) != 0 ||
+      chain.GetStateAccessesCount(0) != chain.GetTransitionsRow(0)(1)) {
+    std::cerr << "Removed state is not erased" << std::endl;
+    return false;
+  }
+
+  return true;
+}
+
+// Returns false on failure
+bool CheckPredictions(const std::string& stats_accumulator_type) {
+  EvolvingMarkovChain chain(stats_accumulator_type, kAccessesThreshold);
+  EvolvingMarkovChain compact_chain(stats_accumulator_type, kAccessesThreshold,
+                                    0, 16);
+
+  for (size_t i = 0; i < kNumStates; ++i) {
+    chain.AddState();
+    compact_chain.AddState();
+  }
+
+  // Hot and cold rows
+  for (size_t i = 0; i < 100; ++i) {
+    chain.RegisterTransition(0, 1 + i % 3);
+    compact_chain.RegisterTransition(0, 1 + i % 3);
+  }
+
+  chain.RegisterTransition(1, 3);
+  compact_chain.RegisterTransition(1, 3);
+
+  for (size_t state = 0; state < 2; ++state) {
+    if (!IsSamePrediction(Predict(&compact_chain, state),
+                          Predict(&chain, state))) {
+      std::cerr << "Prediction from state " << state << " mismatch"
+                << std::endl;
+      return false;
+    }
+  }
+
+  // Float counters are scaled down to fit into the compact ones on loading
+  for (size_t i = 0; i < 100000; ++i) {
+    chain.RegisterTransition(0, 1 + i % 3);
+  }
+
+  std::ostringstream stream;
+  SnapshotWriter writer(&stream);
+  chain.Save(&writer);
+
+  const std::string snapshot = stream.str();
+  SnapshotReader reader(snapshot.data(), snapshot.size());
+
+  if (!compact_chain.Load(&reader)) {
+    std::cerr << "Snapshot is not loaded" << std::endl;
+    return false;
+  }
+
+  if (compact_chain.GetStateAccessesCount(0) > 65535) {
+    std::cerr << "Loaded counters saturate" << std::endl;
+    return false;
+  }
+
+  if (!IsSamePrediction(Predict(&compact_chain, 0), Predict(&chain, 0))) {
+    std::cerr << "Loaded prediction mismatch" << std::endl;
+    return false;
+  }
+
+  return true;
+}
+
+}  // namespace
+
+int main() {
+  if (!CheckSaturation()) {
+    return 1;
+  }
+
+  for (const auto& stats_accumulator_type : {"transitions", "states"}) {
+    if (!CheckPredictions(stats_accumulator_type)) {
+      std::cerr << "Failed with " << stats_accumulator_type
+                << " stats accumulator" << std::endl;
+      return 1;
+    }
+  }
+
+  std::cout << "OK" << std::endl;
+
+  return 0;
+}
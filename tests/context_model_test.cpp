@@ -0,0 +1,156 @@
+#include <markov_chain_cache.h>
+#include <math/context_model.h>
+
+#include <iostream>
+#include <random>
+#include <vector>
+
+// Checks the context table bounds and collisions handling, and replays a
+// workload, which is predictable only from the last two requests, with the
+// first and the second order models. Checks that the second order model
+// improves the hit ratio with prefetch enabled. Exits with non-zero code on
+// failure.
+
+namespace {
+
+const size_t kNumBranches = 20;
+const size_t kNumRounds = 2000;
+const float kCacheCapacity = 10;
+
+// Returns false on failure
+bool CheckContextModel() {
+  ContextModel model(3, 2, 2);
+
+  if (model.GetTableSize() != 4) {
+    std::cerr << "Table size is not rounded up: " << model.GetTableSize()
+              << std::endl;
+    return false;
+  }
+
+  const size_t context_states[] = {1, 2};
+  const uint64_t context = ContextModel::HashContext(context_states, 1, 2);
+  const uint64_t reversed_context =
+      ContextModel::HashContext(context_states + 1, 1, 1);
+
+  if (context == ContextModel::kNoContext || context == reversed_context) {
+    std::cerr << "Order of states is not hashed" << std::endl;
+    return false;
+  }
+
+  model.RegisterTransition(context, 5);
+
+  if (model.FindHotRow(context)) {
+    std::cerr << "Context is hot before reaching the threshold" << std::endl;
+    return false;
+  }
+
+  // At most two successors are kept, the least observed one is replaced
+  model.RegisterTransition(context, 5);
+  model.RegisterTransition(context, 6);
+  model.RegisterTransition(context, 7);
+
+  const SparseVector<float>* row = model.FindHotRow(context);
+
+  if (!row || row->GetNumNonZeros() != 2 || (*row)(5) != 2 ||
+      (*row)(7) != 1) {
+    std::cerr << "Successors are not bounded" << std::endl;
+    return false;
+  }
+
+  // Removed states are erased from the successors
+  const size_t removed_state = 7;
+  model.RemoveStates(&removed_state, 1);
+  row = model.FindHotRow(context);
+
+  if (!row || row->GetNumNonZeros() != 1 || (*row)(7) != 0) {
+    std::cerr << "Removed state is not erased" << std::endl;
+    return false;
+  }
+
+  // Colliding context takes the slot over once the counter of the context in
+  // the slot drops to zero
+  uint64_t colliding_context = context;
+
+  for (size_t state = 0; colliding_context == context ||
+                         (colliding_context & 3) != (context & 3);
+       ++state) {
+    colliding_context = ContextModel::HashContext(context_states, 1, state);
+  }
+
+  model.RegisterTransition(context, 5);
+  model.RegisterTransition(colliding_context, 5);
+
+  if (model.FindHotRow(colliding_context) || !model.FindHotRow(context)) {
+    std::cerr << "Context is displaced by the colliding one" << std::endl;
+    return false;
+  }
+
+  for (size_t i = 0; i < 4; ++i) {
+    model.RegisterTransition(colliding_context, 5);
+  }
+
+  if (!model.FindHotRow(colliding_context) || model.FindHotRow(context)) {
+    std::cerr << "Context is not displaced by the colliding one" << std::endl;
+    return false;
+  }
+
+  return true;
+}
+
+// Each round is a request of the branch item, then of the shared item and
+// then of the leaf item of the same branch, so the leaf item is predictable
+// only from the two last requests. Returns the number of hits.
+size_t Run(size_t model_order) {
+  MarkovChainCacheConfig cfg;
+
+  cfg.cache_capacity = kCacheCapacity;
+  cfg.accesses_threshold = 2;
+  cfg.prefetch_max_items = 1;
+  cfg.model_order = model_order;
+
+  MarkovChainCache<size_t> cache(cfg);
+  std::mt19937 generator(42);
+  std::uniform_int_distribution<size_t> branches_distribution(
+      0, kNumBranches - 1);
+
+  const size_t shared_key = 2 * kNumBranches;
+
+  for (size_t key = 0; key <= shared_key; ++key) {
+    cache.ProcessSetRequest(key, 1);
+  }
+
+  size_t num_hits = 0;
+
+  for (size_t i = 0; i < kNumRounds; ++i) {
+    const size_t branch = branches_distribution(generator);
+
+    num_hits += cache.ProcessGetRequest(branch);
+    num_hits += cache.ProcessGetRequest(shared_key);
+    num_hits += cache.ProcessGetRequest(kNumBranches + branch);
+  }
+
+  return num_hits;
+}
+
+}  // namespace
+
+int main() {
+  if (!CheckContextModel()) {
+    return 1;
+  }
+
+  const size_t num_hits = Run(1);
+  const size_t num_context_hits = Run(2);
+
+  if (num_context_hits <= num_hits) {
+    std::cerr << "Second order model does not improve hits: "
+              << num_context_hits << " vs " << num_hits << std::endl;
+    return 1;
+  }
+
+  std::cout << "Hits: " << num_hits << " with the first order model, "
+            << num_context_hits << " with the second order model" << std::endl;
+  std::cout << "OK" << std::endl;
+
+  return 0;
+}
@@ -0,0 +1,153 @@
+#include <math/evolving_markov_chain.h>
+
+#include <cmath>
+#include <iostream>
+
+// Checks that the lazily decayed statistics match the explicitly weighted ones,
+// including the case when the decay weight is rescaled, and that the states
+// accumulator stays consistent when the states are removed and reused between
+// decays. Exits with non-zero code on mismatch.
+
+namespace {
+
+const size_t kAccessesThreshold = 5;
+const size_t kNumOldTransitions = 1000;
+const size_t kNumNewTransitions = 10;
+
+// Total decay is large enough to trigger rescaling of the statistics
+const float kDecayFactor = 1.0f / 64;
+const size_t kNumDecays = 4;
+
+const float kTolerance = 1e-4f;
+
+bool CheckDecay(const std::string& stats_accumulator_type) {
+  EvolvingMarkovChain chain(stats_accumulator_type, kAccessesThreshold);
+
+  for (size_t i = 0; i < 3; ++i) {
+    chain.AddState();
+  }
+
+  for (size_t i = 0; i < kNumOldTransitions; ++i) {
+    chain.RegisterTransition(0, 1);
+  }
+
+  float old_weight = 1;
+
+  for (size_t i = 0; i < kNumDecays; ++i) {
+    chain.Decay(kDecayFactor);
+    old_weight *= kDecayFactor;
+  }
+
+  for (size_t i = 0; i < kNumNewTransitions; ++i) {
+    chain.RegisterTransition(0, 2);
+  }
+
+  const float expected_accesses =
+      kNumOldTransitions * old_weight + kNumNewTransitions;
+
+  if (std::fabs(chain.GetStateAccessesCount(0) - expected_accesses) >
+      kTolerance * expected_accesses) {
+    std::cerr << "Accesses count mismatch: " << chain.GetStateAccessesCount(0)
+              << " vs " << expected_accesses << std::endl;
+    return false;
+  }
+
+  Vector<float> current_state(3, FillType::kZeros);
+  current_state(0) = 1;
+
+  const Vector<float> next_state = chain.PredictNextState(current_state);
+  const float expected_probability =
+      kNumOldTransitions * old_weight / expected_accesses;
+
+  if (std::fabs(next_state(1) - expected_probability) > kTolerance ||
+      std::fabs(next_state(2) - (1 - expected_probability)) > kTolerance) {
+    std::cerr << "Prediction mismatch: " << next_state << std::endl;
+    return false;
+  }
+
+  // State 1 has no statistics, so its prediction is generated by the stats
+  // accumulator, which should be dominated by the fresh transitions as well
+  current_state(0) = 0;
+  current_state(1) = 1;
+
+  const Vector<float> cold_next_state = chain.PredictNextState(current_state);
+
+  if (cold_next_state(2) <= cold_next_state(1)) {
+    std::cerr << "Stats accumulator is not decayed: " << cold_next_state
+              << std::endl;
+    return false;
+  }
+
+  return true;
+}
+
+// States are removed and reused while the statistics decay, so they are
+// initialized with the different weights. Returns false on failure.
+bool CheckDecayWithRemoval() {
+  const size_t num_states = 10;
+  const size_t num_rounds = 1000;
+
+  StatesBasedStatsAccumulator accumulator;
+
+  for (size_t i = 0; i < num_states; ++i) {
+    accumulator.AddState();
+  }
+
+  for (size_t i = 0; i < num_rounds; ++i) {
+    const size_t state = i % num_states;
+
+    accumulator.AccumulateTransition(0, (state + 1) % num_states);
+    accumulator.Decay(0.9f);
+    accumulator.RemoveState(state);
+    accumulator.ReuseState(state);
+
+    // The total is the sum of the initial counters of the states, and the
+    // initial counter of the last reused state is the current weight
+    if (accumulator.total_number_of_transitions_ <
+        accumulator.transition_weight_) {
+      std::cerr << "Total number of transitions is too small: "
+                << accumulator.total_number_of_transitions_ << std::endl;
+      return false;
+    }
+  }
+
+  size_t states[num_states];
+  float estimates[num_states];
+
+  for (size_t i = 0; i < num_states; ++i) {
+    states[i] = i;
+  }
+
+  accumulator.GatherTransitionProbabilitiesEstimate(0, states, num_states,
+                                                    estimates);
+
+  for (size_t i = 0; i < num_states; ++i) {
+    if (!(estimates[i] > 0)) {
+      std::cerr << "Estimate for state " << i
+                << " is not positive: " << estimates[i] << std::endl;
+      return false;
+    }
+  }
+
+  return true;
+}
+
+}  // namespace
+
+int main() {
+  if (!CheckDecayWithRemoval()) {
+    return 1;
+  }
+
+  for (const auto& stats_accumulator_type : {"transitions", "states"}) {
+    if (!CheckDecay(stats_accumulator_type)) {
+      std::cerr << "Failed with " << stats_accumulator_type
+                << " stats accumulator" << std::endl;
+      return 1;
+    }
+  }
+
+  std::cout << "OK" << std::endl;
+
+  return 0;
+}
\ No newline at end of file
@@ -0,0 +1,153 @@
+#include <markov_chain_cache.h>
+
+#include <iostream>
+#include <random>
+#include <unordered_map>
+
+#include "test_delegates.h"
+
+// Runs a churny workload with overwrites and deletions and checks that the
+// items in cache always fit into the cache capacity, that deleted items are
+// forgotten, and that the number of Markov chain states stays bounded by the
+// number of live items thanks to the states reuse. Also checks that the items
+// deleted before the first get request are not used as the previous state.
+
+namespace {
+
+const size_t kNumRequests = 50000;
+const size_t kNumLiveItems = 200;
+const float kCacheCapacity = 300;
+
+bool CheckChurnyWorkload(const std::string& stats_accumulator_type) {
+  std::unordered_map<size_t, float> item_sizes;
+  TrackingDelegate delegate(
+      [&item_sizes](size_t key) { return item_sizes.at(key); });
+
+  MarkovChainCacheConfig cfg;
+
+  cfg.cache_capacity = kCacheCapacity;
+  cfg.stats_accumulator_type = stats_accumulator_type;
+
+  MarkovChainCache<size_t> cache(cfg, &delegate);
+
+  std::mt19937 generator(42);
+  std::uniform_int_distribution<size_t> offsets_distribution(0,
+                                                             kNumLiveItems - 1);
+  std::uniform_int_distribution<int> sizes_distribution(1, 20);
+  std::uniform_int_distribution<int> operations_distribution(0, 9);
+
+  // Live items are the last kNumLiveItems keys, the oldest live item is
+  // deleted whenever the new one is saved
+  size_t next_key = 0;
+  size_t num_hits = 0;
+
+  for (size_t i = 0; i < kNumRequests; ++i) {
+    const int operation = operations_distribution(generator);
+
+    if (operation == 0 || next_key < kNumLiveItems) {
+      if (next_key >= kNumLiveItems) {
+        const size_t deleted_key = next_key - kNumLiveItems;
+
+        delegate.DeleteItem(deleted_key);
+        item_sizes.erase(deleted_key);
+
+        if (!cache.ProcessDeleteRequest(deleted_key) ||
+            cache.Contains(deleted_key) ||
+            cache.ProcessGetRequest(deleted_key)) {
+          std::cerr << "Item " << deleted_key << " is not deleted" << std::endl;
+          return false;
+        }
+      }
+
+      item_sizes[next_key] = sizes_distribution(generator);
+      cache.ProcessSetRequest(next_key, item_sizes[next_key]);
+      next_key++;
+    } else {
+      const size_t key =
+          next_key - kNumLiveItems + offsets_distribution(generator);
+
+      if (operation == 1) {
+        // Overwrite with the new size
+        item_sizes[key] = sizes_distribution(generator);
+        cache.ProcessSetRequest(key, item_sizes[key]);
+      } else {
+        num_hits += cache.ProcessGetRequest(key);
+      }
+    }
+
+    if (delegate.GetCacheSize() > kCacheCapacity) {
+      std::cerr << "Cache size exceeds the capacity: "
+                << delegate.GetCacheSize() << std::endl;
+      return false;
+    }
+  }
+
+  if (num_hits == 0) {
+    std::cerr << "No hits" << std::endl;
+    return false;
+  }
+
+  // States of the deleted items are removed in batches, so some of them might
+  // be still waiting for reuse
+  if (cache.GetNumStates() > 2 * kNumLiveItems) {
+    std::cerr << "Number of states is not bounded: " << cache.GetNumStates()
+              << " states for " << cache.GetNumTrackedItems() << " items"
+              << std::endl;
+    return false;
+  }
+
+  return true;
+}
+
+// Returns false on failure
+bool CheckDeleteBeforeFirstGet(const std::string& stats_accumulator_type) {
+  MarkovChainCacheConfig cfg;
+
+  cfg.cache_capacity = kCacheCapacity;
+  cfg.stats_accumulator_type = stats_accumulator_type;
+
+  MarkovChainCache<size_t> cache(cfg);
+
+  // Enough deletions to remove the states, including the first one
+  for (size_t key = 0; key < 20; ++key) {
+    cache.ProcessSetRequest(key, 1);
+  }
+
+  for (size_t key = 0; key < 20; ++key) {
+    cache.ProcessDeleteRequest(key);
+  }
+
+  cache.ProcessSetRequest(100, 1);
+
+  for (size_t i = 0; i < 10; ++i) {
+    if (!cache.ProcessGetRequest(100)) {
+      std::cerr << "Item set after deletions is missing" << std::endl;
+      return false;
+    }
+  }
+
+  if (cache.GetNumTrackedItems() != 1) {
+    std::cerr << "Deleted items are tracked: " << cache.GetNumTrackedItems()
+              << std::endl;
+    return false;
+  }
+
+  return true;
+}
+
+}  // namespace
+
+int main() {
+  for (const auto& stats_accumulator_type : {"transitions", "states"}) {
+    if (!CheckChurnyWorkload(stats_accumulator_type) ||
+        !CheckDeleteBeforeFirstGet(stats_accumulator_type)) {
+      std::cerr << "Failed with " << stats_accumulator_type
+                << " stats accumulator" << std::endl;
+      return 1;
+    }
+  }
+
+  std::cout << "OK" << std::endl;
+
+  return 0;
+}
\ No newline at end of file
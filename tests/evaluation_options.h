@@ -0,0 +1,108 @@
+#pragma once
+
+#include <markov_chain_cache.h>
+
+#include <cstring>
+#include <functional>
+#include <iostream>
+#include <sstream>
+#include <string>
+#include <utility>
+#include <vector>
+
+// Optional settings of the evaluation utilities, which are given as
+// --name=value after the positional arguments. Eviction low watermarks are a
+// comma-separated list, the trace is replayed for each of them.
+
+const char kEvaluationOptionsUsage[] =
+    "[--forecast-epsilon=<value>] [--forecast-max-states=<value>] "
+    "[--max-states=<value>] [--decay-half-life=<value>] "
+    "[--decay-time-unit=requests|timestamps] "
+    "[--eviction-low-watermarks=<value>[,<value>...]] "
+    "[--prefetch-max-items=<value>] "
+    "[--prefetch-probability-threshold=<value>] "
+    "[--prefetch-budget=<value>] [--admission-filter=0|1] "
+    "[--admission-sketch-width=<value>] [--model-order=<value>] "
+    "[--context-table-size=<value>] [--max-successors=<value>] "
+    "[--counter-bits=0|8|16]";
+
+// Parses the options starting from argv[first_option] into the config and the
+// list of watermarks. Returns false and reports the argument, which is not a
+// known option.
+inline bool ParseEvaluationOptions(
+    int argc, char* argv[], int first_option, MarkovChainCacheConfig* cfg,
+    std::vector<float>* eviction_low_watermarks) {
+  typedef std::function<void(const std::string&)> Setter;
+
+  const std::vector<std::pair<std::string, Setter>> options = {
+      {"forecast-epsilon",
+       [&](const std::string& v) { cfg->forecast_epsilon = std::stof(v); }},
+      {"forecast-max-states",
+       [&](const std::string& v) { cfg->forecast_max_states = std::stoll(v); }},
+      {"max-states",
+       [&](const std::string& v) { cfg->max_states = std::stoll(v); }},
+      {"decay-half-life",
+       [&](const std::string& v) { cfg->decay_half_life = std::stof(v); }},
+      {"decay-time-unit",
+       [&](const std::string& v) { cfg->decay_time_unit = v; }},
+      {"eviction-low-watermarks",
+       [&](const std::string& v) {
+         eviction_low_watermarks->clear();
+
+         std::istringstream watermarks(v);
+         std::string watermark;
+
+         while (std::getline(watermarks, watermark, ',')) {
+           eviction_low_watermarks->push_back(std::stof(watermark));
+         }
+       }},
+      {"prefetch-max-items",
+       [&](const std::string& v) { cfg->prefetch_max_items = std::stoll(v); }},
+      {"prefetch-probability-threshold",
+       [&](const std::string& v) {
+         cfg->prefetch_probability_threshold = std::stof(v);
+       }},
+      {"prefetch-budget",
+       [&](const std::string& v) { cfg->prefetch_budget = std::stof(v); }},
+      {"admission-filter",
+       [&](const std::string& v) { cfg->admission_filter = std::stoll(v); }},
+      {"admission-sketch-width",
+       [&](const std::string& v) {
+         cfg->admission_sketch_width = std::stoll(v);
+       }},
+      {"model-order",
+       [&](const std::string& v) { cfg->model_order = std::stoll(v); }},
+      {"context-table-size",
+       [&](const std::string& v) { cfg->context_table_size = std::stoll(v); }},
+      {"max-successors",
+       [&](const std::string& v) { cfg->max_successors = std::stoll(v); }},
+      {"counter-bits",
+       [&](const std::string& v) { cfg->counter_bits = std::stoll(v); }},
+  };
+
+  eviction_low_watermarks->assign(1, cfg->eviction_low_watermark);
+
+  for (int i = first_option; i < argc; ++i) {
+    const char* value = std::strchr(argv[i], '=');
+    bool is_known_option = false;
+
+    if (std::strncmp(argv[i], "--", 2) == 0 && value) {
+      const std::string name(argv[i] + 2, value - argv[i] - 2);
+
+      for (const auto& option : options) {
+        if (option.first == name) {
+          option.second(value + 1);
+          is_known_option = true;
+          break;
+        }
+      }
+    }
+
+    if (!is_known_option) {
+      std::cerr << "Unknown option: " << argv[i] << std::endl;
+      return false;
+    }
+  }
+
+  return true;
+}
@@ -0,0 +1,181 @@
+#include <sharded_markov_chain_cache.h>
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <fstream>
+#include <iostream>
+#include <map>
+#include <thread>
+
+// Replays static trace from multiple threads against the sharded cache and
+// reports throughput and hit ratios for the different numbers of threads and
+// shards. Trace requests are taken by threads in small chunks in the trace
+// order, so the requests are interleaved as they would be in a server.
+
+struct GetRequest {
+  size_t timestamp;
+  size_t item_id;
+  size_t item_size;
+};
+
+std::vector<GetRequest> ParseTrace(std::ifstream& is) {
+  size_t timestamp;
+  size_t item_id;
+  size_t item_size;
+
+  std::vector<GetRequest> requests;
+
+  while (is >> timestamp >> item_id >> item_size) {
+    requests.push_back({timestamp, item_id, item_size});
+  }
+
+  return requests;
+}
+
+namespace {
+
+const size_t kChunkSize = 64;
+
+struct ReplayResult {
+  double requests_per_second;
+  double object_hit_ratio;
+  double byte_hit_ratio;
+};
+
+ReplayResult Replay(const std::vector<GetRequest>& trace,
+                    const std::map<size_t, size_t>& unique_items,
+                    const MarkovChainCacheConfig& cfg, size_t num_shards,
+                    size_t num_threads) {
+  ShardedMarkovChainCache<size_t> cache(cfg, num_shards);
+
+  for (const auto& item : unique_items) {
+    cache.ProcessSetRequest(item.first, item.second);
+  }
+
+  cache.Flush();
+
+  std::atomic<size_t> next_chunk(0);
+  std::atomic<size_t> num_hits(0);
+  std::atomic<size_t> num_hits_bytes(0);
+
+  const auto worker = [&]() {
+    size_t local_num_hits = 0;
+    size_t local_num_hits_bytes = 0;
+
+    while (true) {
+      const size_t begin = next_chunk.fetch_add(kChunkSize);
+
+      if (begin >= trace.size()) {
+        break;
+      }
+
+      const size_t end = std::min(begin + kChunkSize, trace.size());
+
+      for (size_t i = begin; i < end; ++i) {
+        if (cache.ProcessGetRequest(trace[i].item_id)) {
+          local_num_hits++;
+          local_num_hits_bytes += trace[i].item_size;
+        }
+      }
+    }
+
+    num_hits += local_num_hits;
+    num_hits_bytes += local_num_hits_bytes;
+  };
+
+  typedef std::chrono::steady_clock Clock;
+  const Clock::time_point start = Clock::now();
+
+  std::vector<std::thread> threads;
+
+  for (size_t i = 0; i < num_threads; ++i) {
+    threads.emplace_back(worker);
+  }
+
+  for (auto& thread : threads) {
+    thread.join();
+  }
+
+  const double elapsed_seconds =
+      std::chrono::duration<double>(Clock::now() - start).count();
+
+  double total_size = 0;
+
+  for (const auto& r : trace) {
+    total_size += r.item_size;
+  }
+
+  return {trace.size() / elapsed_seconds,
+          static_cast<double>(num_hits) / trace.size(),
+          num_hits_bytes / total_size};
+}
+
+}  // namespace
+
+int main(int argc, char* argv[]) {
+  if (argc < 6) {
+    std::cout << "Usage: " << argv[0]
+              << " <path to trace file> <cache size> <stats accumulator type> "
+              << "<access threshold> <forecast length> [max threads] "
+              << "[max shards]" << std::endl;
+    return 1;
+  }
+
+  std::ifstream input(argv[1]);
+  std::vector<GetRequest> trace = ParseTrace(input);
+
+  MarkovChainCacheConfig cfg;
+
+  cfg.cache_capacity = static_cast<float>(std::stoll(argv[2]));
+  cfg.stats_accumulator_type = argv[3];
+  cfg.accesses_threshold = std::stoll(argv[4]);
+  cfg.forecast_length = std::stoll(argv[5]);
+
+  const size_t max_threads =
+      argc > 6 ? std::stoll(argv[6])
+               : std::max(1u, std::thread::hardware_concurrency());
+  const size_t max_shards = argc > 7 ? std::stoll(argv[7]) : 4 * max_threads;
+
+  // Items, which do not fit into a single shard of the smallest size, are
+  // excluded from the trace, so all the configurations replay the same
+  // requests
+  const float max_item_size = cfg.cache_capacity / max_shards;
+  const size_t trace_size = trace.size();
+
+  trace.erase(std::remove_if(trace.begin(), trace.end(),
+                             [&](const GetRequest& r) {
+                               return r.item_size > max_item_size;
+                             }),
+              trace.end());
+
+  if (trace.empty()) {
+    std::cout << "No requests fit into a single shard" << std::endl;
+    return 1;
+  }
+
+  if (trace.size() < trace_size) {
+    std::cout << "Requests excluded as too large for a single shard: "
+              << trace_size - trace.size() << std::endl;
+  }
+
+  std::map<size_t, size_t> unique_items;
+
+  for (const auto& r : trace) {
+    unique_items[r.item_id] = r.item_size;
+  }
+
+  for (size_t num_threads = 1; num_threads <= max_threads; num_threads *= 2) {
+    for (size_t num_shards = 1; num_shards <= max_shards; num_shards *= 2) {
+      const ReplayResult result =
+          Replay(trace, unique_items, cfg, num_shards, num_threads);
+
+      std::cout << "Threads: " << num_threads << " Shards: " << num_shards
+                << " Requests per second: " << result.requests_per_second
+                << " Object hit ratio: " << result.object_hit_ratio
+                << " Byte hit ratio: " << result.byte_hit_ratio << std::endl;
+    }
+  }
+
+  return 0;
+}
\ No newline at end of file
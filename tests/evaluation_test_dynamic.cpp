@@ -1,14 +1,18 @@
 #include <markov_chain_cache.h>
 
+#include <algorithm>
+#include <chrono>
 #include <fstream>
 #include <iostream>
 
+#include "evaluation_options.h"
+
 #ifdef USE_MKL
 #include <mkl.h>
 #endif
 
 struct GetRequest {
-  char type;  // `g` - get, `s` - set
+  char type;  // `g` - get, `s` - set, `d` - delete
   size_t timestamp;
   size_t item_id;
   size_t item_size;
@@ -29,27 +33,11 @@ std::vector<GetRequest> ParseTrace(std::ifstream& is) {
   return requests;
 }
 
-int main(int argc, char* argv[]) {
-  if (argc < 5) {
-    std::cout << "Usage: " << argv[0]
-              << " <path to trace file> <cache size> <stats accumulator type> "
-              << "<access threshold> <forecast length>" << std::endl;
-    return 1;
-  }
-
-#ifdef USE_MKL
-  mkl_set_num_threads(mkl_get_max_threads());
-#endif
-
-  std::ifstream input(argv[1]);
-  std::vector<GetRequest> trace = ParseTrace(input);
-
-  MarkovChainCacheConfig cfg;
-
-  cfg.cache_capacity = static_cast<float>(std::stoll(argv[2]));
-  cfg.stats_accumulator_type = argv[3];
-  cfg.accesses_threshold = std::stoll(argv[4]);
-  cfg.forecast_length = std::stoll(argv[5]);
+// Replays the trace and reports the hit ratios and the number of requests
+// processed per second
+void Evaluate(const MarkovChainCacheConfig& cfg,
+              const std::vector<GetRequest>& trace) {
+  typedef std::chrono::steady_clock Clock;
 
   MarkovChainCache<size_t> cache(cfg);
 
@@ -58,7 +46,11 @@ int main(int argc, char* argv[]) {
   double num_hits_bytes = 0;
   double total_size = 0;
 
+  const Clock::time_point begin = Clock::now();
+
   for (const auto& r : trace) {
+    cache.SetTime(r.timestamp);
+
     switch (r.type) {
       case 's':
         cache.ProcessSetRequest(r.item_id, r.item_size);
@@ -67,19 +59,85 @@ int main(int argc, char* argv[]) {
         if (cache.ProcessGetRequest(r.item_id)) {
           num_hits++;
           num_hits_bytes += r.item_size;
+        } else if (!cache.Contains(r.item_id)) {
+          // The item was retired, so it is set again as if it was read from
+          // the backing storage
+          cache.ProcessSetRequest(r.item_id, r.item_size);
         }
 
         total_size += r.item_size;
         num_get_requests++;
         break;
+      case 'd':
+        cache.ProcessDeleteRequest(r.item_id);
+        break;
       default:
         throw std::invalid_argument("Invalid action type");
     }
   }
 
+  const double elapsed_seconds =
+      std::chrono::duration<double>(Clock::now() - begin).count();
+
   std::cout << "Object hit ratio: "
             << static_cast<float>(num_hits) / num_get_requests << std::endl;
   std::cout << "Byte hit ratio: " << num_hits_bytes / total_size << std::endl;
+  std::cout << "Requests per second: " << trace.size() / elapsed_seconds
+            << std::endl;
+
+  if (cfg.prefetch_max_items != 0) {
+    const CachePrefetchStats& prefetch_stats = cache.GetPrefetchStats();
+
+    std::cout << "Prefetched items: " << prefetch_stats.num_prefetched_items
+              << std::endl;
+    std::cout << "Prefetch hit ratio: "
+              << static_cast<float>(prefetch_stats.num_prefetch_hits) /
+                     std::max<size_t>(1, prefetch_stats.num_prefetched_items)
+              << std::endl;
+    std::cout << "Wasted prefetch bytes: " << prefetch_stats.wasted_bytes
+              << " of " << prefetch_stats.prefetched_bytes << std::endl;
+  }
+}
+
+int main(int argc, char* argv[]) {
+  if (argc < 6) {
+    std::cout << "Usage: " << argv[0]
+              << " <path to trace file> <cache size> <stats accumulator type> "
+              << "<access threshold> <forecast length> "
+              << kEvaluationOptionsUsage << std::endl;
+    return 1;
+  }
+
+#ifdef USE_MKL
+  mkl_set_num_threads(mkl_get_max_threads());
+#endif
+
+  std::ifstream input(argv[1]);
+  std::vector<GetRequest> trace = ParseTrace(input);
+
+  MarkovChainCacheConfig cfg;
+
+  cfg.cache_capacity = static_cast<float>(std::stoll(argv[2]));
+  cfg.stats_accumulator_type = argv[3];
+  cfg.accesses_threshold = std::stoll(argv[4]);
+  cfg.forecast_length = std::stoll(argv[5]);
+
+  std::vector<float> eviction_low_watermarks;
+
+  if (!ParseEvaluationOptions(argc, argv, 6, &cfg, &eviction_low_watermarks)) {
+    return 1;
+  }
+
+  for (const auto& eviction_low_watermark : eviction_low_watermarks) {
+    cfg.eviction_low_watermark = eviction_low_watermark;
+
+    if (eviction_low_watermarks.size() > 1) {
+      std::cout << "Eviction low watermark: " << eviction_low_watermark
+                << std::endl;
+    }
+
+    Evaluate(cfg, trace);
+  }
 
   return 0;
 }
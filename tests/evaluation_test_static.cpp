@@ -1,9 +1,13 @@
 #include <markov_chain_cache.h>
 
+#include <algorithm>
+#include <chrono>
 #include <fstream>
 #include <iostream>
 #include <map>
 
+#include "evaluation_options.h"
+
 #ifdef USE_MKL
 #include <mkl.h>
 #endif
@@ -28,11 +32,70 @@ std::vector<GetRequest> ParseTrace(std::ifstream& is) {
   return requests;
 }
 
+// Replays the trace with all the items saved beforehand and reports the hit
+// ratios and the number of requests processed per second
+void Evaluate(const MarkovChainCacheConfig& cfg,
+              const std::map<size_t, size_t>& unique_items,
+              const std::vector<GetRequest>& trace) {
+  typedef std::chrono::steady_clock Clock;
+
+  MarkovChainCache<size_t> cache(cfg);
+
+  for (const auto& item : unique_items) {
+    cache.ProcessSetRequest(item.first, item.second);
+  }
+
+  cache.Flush();
+
+  size_t num_hits = 0;
+  double num_hits_bytes = 0;
+  double total_size = 0;
+
+  const Clock::time_point begin = Clock::now();
+
+  for (const auto& r : trace) {
+    cache.SetTime(r.timestamp);
+
+    if (cache.ProcessGetRequest(r.item_id)) {
+      num_hits++;
+      num_hits_bytes += r.item_size;
+    } else if (!cache.Contains(r.item_id)) {
+      // The item was retired, so it is set again as if it was read from the
+      // backing storage
+      cache.ProcessSetRequest(r.item_id, r.item_size);
+    }
+    total_size += r.item_size;
+  }
+
+  const double elapsed_seconds =
+      std::chrono::duration<double>(Clock::now() - begin).count();
+
+  std::cout << "Object hit ratio: "
+            << static_cast<float>(num_hits) / trace.size() << std::endl;
+  std::cout << "Byte hit ratio: " << num_hits_bytes / total_size << std::endl;
+  std::cout << "Requests per second: " << trace.size() / elapsed_seconds
+            << std::endl;
+
+  if (cfg.prefetch_max_items != 0) {
+    const CachePrefetchStats& prefetch_stats = cache.GetPrefetchStats();
+
+    std::cout << "Prefetched items: " << prefetch_stats.num_prefetched_items
+              << std::endl;
+    std::cout << "Prefetch hit ratio: "
+              << static_cast<float>(prefetch_stats.num_prefetch_hits) /
+                     std::max<size_t>(1, prefetch_stats.num_prefetched_items)
+              << std::endl;
+    std::cout << "Wasted prefetch bytes: " << prefetch_stats.wasted_bytes
+              << " of " << prefetch_stats.prefetched_bytes << std::endl;
+  }
+}
+
 int main(int argc, char* argv[]) {
-  if (argc < 5) {
+  if (argc < 6) {
     std::cout << "Usage: " << argv[0]
               << " <path to trace file> <cache size> <stats accumulator type> "
-              << "<access threshold> <forecast length>" << std::endl;
+              << "<access threshold> <forecast length> "
+              << kEvaluationOptionsUsage << std::endl;
     return 1;
   }
 
@@ -56,29 +119,22 @@ int main(int argc, char* argv[]) {
   cfg.accesses_threshold = std::stoll(argv[4]);
   cfg.forecast_length = std::stoll(argv[5]);
 
-  MarkovChainCache<size_t> cache(cfg);
+  std::vector<float> eviction_low_watermarks;
 
-  for (const auto& item : unique_items) {
-    cache.ProcessSetRequest(item.first, item.second);
+  if (!ParseEvaluationOptions(argc, argv, 6, &cfg, &eviction_low_watermarks)) {
+    return 1;
   }
 
-  cache.Flush();
+  for (const auto& eviction_low_watermark : eviction_low_watermarks) {
+    cfg.eviction_low_watermark = eviction_low_watermark;
 
-  size_t num_hits = 0;
-  double num_hits_bytes = 0;
-  double total_size = 0;
-
-  for (const auto& r : trace) {
-    if (cache.ProcessGetRequest(r.item_id)) {
-      num_hits++;
-      num_hits_bytes += r.item_size;
+    if (eviction_low_watermarks.size() > 1) {
+      std::cout << "Eviction low watermark: " << eviction_low_watermark
+                << std::endl;
     }
-    total_size += r.item_size;
-  }
 
-  std::cout << "Object hit ratio: "
-            << static_cast<float>(num_hits) / trace.size() << std::endl;
-  std::cout << "Byte hit ratio: " << num_hits_bytes / total_size << std::endl;
+    Evaluate(cfg, unique_items, trace);
+  }
 
   return 0;
-}
\ No newline at end of file
+}
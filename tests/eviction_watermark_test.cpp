@@ -0,0 +1,99 @@
+#include <markov_chain_cache.h>
+
+#include <iostream>
+#include <random>
+#include <vector>
+
+#include "test_delegates.h"
+
+// Checks that the items in cache always fit into the cache capacity and that
+// evictions on misses free the space down to the low watermark.
+
+namespace {
+
+const size_t kNumKeys = 1000;
+const size_t kNumRequests = 20000;
+const float kCacheCapacity = 500;
+const float kEvictionLowWatermark = 0.8f;
+const float kMaxItemSize = 10;
+
+bool CheckWatermarks(const std::string& stats_accumulator_type) {
+  std::mt19937 generator(42);
+  std::uniform_int_distribution<size_t> keys_distribution(0, kNumKeys - 1);
+  std::uniform_int_distribution<int> sizes_distribution(1, kMaxItemSize);
+
+  std::vector<float> item_sizes(kNumKeys);
+
+  for (auto& size : item_sizes) {
+    size = sizes_distribution(generator);
+  }
+
+  TrackingDelegate delegate(
+      [&item_sizes](size_t key) { return item_sizes[key]; });
+
+  MarkovChainCacheConfig cfg;
+
+  cfg.cache_capacity = kCacheCapacity;
+  cfg.stats_accumulator_type = stats_accumulator_type;
+  cfg.eviction_low_watermark = kEvictionLowWatermark;
+
+  MarkovChainCache<size_t> cache(cfg, &delegate);
+
+  size_t num_eviction_rounds = 0;
+
+  for (size_t i = 0; i < kNumRequests; ++i) {
+    const size_t key = keys_distribution(generator);
+    const size_t num_evictions = delegate.GetNumEvictions();
+
+    const bool is_get_request = cache.Contains(key);
+
+    if (is_get_request) {
+      cache.ProcessGetRequest(key);
+    } else {
+      cache.ProcessSetRequest(key, item_sizes[key]);
+    }
+
+    if (delegate.GetCacheSize() > kCacheCapacity) {
+      std::cerr << "Cache size exceeds the capacity: "
+                << delegate.GetCacheSize() << std::endl;
+      return false;
+    }
+
+    // Get requests always evict enough items, so the cache is filled up to the
+    // low watermark plus the size of the loaded item. Set requests may evict
+    // less, since only the items cheaper than the saved one are evicted.
+    if (is_get_request && delegate.GetNumEvictions() != num_evictions) {
+      num_eviction_rounds++;
+
+      if (delegate.GetCacheSize() >
+          kEvictionLowWatermark * kCacheCapacity + kMaxItemSize) {
+        std::cerr << "Cache is not emptied down to the low watermark: "
+                  << delegate.GetCacheSize() << std::endl;
+        return false;
+      }
+    }
+  }
+
+  if (num_eviction_rounds == 0) {
+    std::cerr << "No evictions" << std::endl;
+    return false;
+  }
+
+  return true;
+}
+
+}  // namespace
+
+int main() {
+  for (const auto& stats_accumulator_type : {"transitions", "states"}) {
+    if (!CheckWatermarks(stats_accumulator_type)) {
+      std::cerr << "Failed with " << stats_accumulator_type
+                << " stats accumulator" << std::endl;
+      return 1;
+    }
+  }
+
+  std::cout << "OK" << std::endl;
+
+  return 0;
+}
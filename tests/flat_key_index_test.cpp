@@ -0,0 +1,81 @@
+#include <flat_key_index.h>
+
+#include <iostream>
+#include <random>
+#include <string>
+#include <unordered_map>
+
+// Compares FlatKeyIndex with std::unordered_map on a random sequence of
+// insertions, erasures and lookups. Exits with non-zero code on mismatch.
+
+namespace {
+
+const size_t kNumOperations = 200000;
+const size_t kKeysRange = 5000;
+
+template <typename KeyType, typename MakeKey>
+bool CheckRandomOperations(const MakeKey& make_key) {
+  std::mt19937 generator(42);
+  std::uniform_int_distribution<size_t> keys_distribution(0, kKeysRange - 1);
+  std::uniform_int_distribution<int> operations_distribution(0, 2);
+
+  FlatKeyIndex<KeyType> index;
+  std::unordered_map<KeyType, size_t> reference;
+  size_t next_state = 0;
+
+  for (size_t i = 0; i < kNumOperations; ++i) {
+    const KeyType key = make_key(keys_distribution(generator));
+    const auto reference_it = reference.find(key);
+    const size_t expected_state = reference_it == reference.end()
+                                      ? FlatKeyIndex<KeyType>::kNotFound
+                                      : reference_it->second;
+
+    if (index.Find(key) != expected_state) {
+      std::cerr << "Lookup mismatch at operation " << i << std::endl;
+      return false;
+    }
+
+    switch (operations_distribution(generator)) {
+      case 0:
+        if (reference_it == reference.end()) {
+          index.Insert(key, next_state);
+          reference[key] = next_state++;
+        }
+        break;
+      case 1:
+        if (index.Erase(key) != (reference_it != reference.end())) {
+          std::cerr << "Erase mismatch at operation " << i << std::endl;
+          return false;
+        }
+
+        reference.erase(key);
+        break;
+      default:
+        break;
+    }
+
+    if (index.GetSize() != reference.size()) {
+      std::cerr << "Size mismatch at operation " << i << std::endl;
+      return false;
+    }
+  }
+
+  return true;
+}
+
+}  // namespace
+
+int main() {
+  const bool ok =
+      CheckRandomOperations<size_t>([](size_t i) { return i * 4096; }) &&
+      CheckRandomOperations<std::string>(
+          [](size_t i) { return "key" + std::to_string(i); });
+
+  if (!ok) {
+    return 1;
+  }
+
+  std::cout << "OK" << std::endl;
+
+  return 0;
+}
\ No newline at end of file
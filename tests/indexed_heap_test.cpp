@@ -0,0 +1,88 @@
+#include <indexed_heap.h>
+
+#include <iostream>
+#include <random>
+#include <set>
+
+// Compares IndexedHeap with std::set on a random sequence of pushes, pops and
+// erasures. Exits with non-zero code on mismatch.
+
+namespace {
+
+const size_t kNumOperations = 200000;
+const size_t kIdsRange = 1000;
+
+bool CheckRandomOperations() {
+  std::mt19937 generator(42);
+  std::uniform_int_distribution<size_t> ids_distribution(0, kIdsRange - 1);
+  std::uniform_int_distribution<int> operations_distribution(0, 3);
+
+  IndexedHeap<> heap;
+  std::set<size_t> reference;
+
+  for (size_t i = 0; i < kNumOperations; ++i) {
+    const size_t id = ids_distribution(generator);
+
+    if (heap.Contains(id) != (reference.count(id) != 0)) {
+      std::cerr << "Contains mismatch at operation " << i << std::endl;
+      return false;
+    }
+
+    switch (operations_distribution(generator)) {
+      case 0:
+      case 1:
+        if (!heap.Contains(id)) {
+          heap.Push(id);
+          reference.insert(id);
+        }
+        break;
+      case 2:
+        if (!reference.empty()) {
+          const size_t expected_id = *reference.rbegin();
+
+          if (heap.Pop() != expected_id) {
+            std::cerr << "Pop mismatch at operation " << i << std::endl;
+            return false;
+          }
+
+          reference.erase(expected_id);
+        }
+        break;
+      case 3:
+        if (heap.Contains(id)) {
+          heap.Erase(id);
+          reference.erase(id);
+        }
+        break;
+    }
+
+    if (heap.GetSize() != reference.size() ||
+        (!reference.empty() && heap.Top() != *reference.rbegin())) {
+      std::cerr << "Top mismatch at operation " << i << std::endl;
+      return false;
+    }
+  }
+
+  heap.Clear();
+
+  for (const auto& id : reference) {
+    if (heap.Contains(id)) {
+      std::cerr << "Id " << id << " is not cleared" << std::endl;
+      return false;
+    }
+  }
+
+  return heap.IsEmpty();
+}
+
+}  // namespace
+
+int main() {
+  if (!CheckRandomOperations()) {
+    return 1;
+  }
+
+  std::cout << "OK" << std::endl;
+
+  return 0;
+}
@@ -0,0 +1,127 @@
+#include <math/linalg_kernels.h>
+
+#include <chrono>
+#include <functional>
+#include <iomanip>
+#include <iostream>
+#include <random>
+#include <string>
+#include <vector>
+
+// Measures the performance of linear algebra kernels implemented with the
+// different instruction sets and reports the speedup over the scalar reference
+// implementation.
+
+namespace {
+
+// Each measurement is repeated until this time is elapsed
+const double kMinMeasurementTimeSeconds = 0.3;
+
+// Returns the average time of a single call in microseconds
+double Measure(const std::function<void()>& func) {
+  typedef std::chrono::steady_clock Clock;
+
+  size_t num_calls = 0;
+  const Clock::time_point begin = Clock::now();
+  double elapsed_seconds = 0;
+
+  do {
+    func();
+    ++num_calls;
+    elapsed_seconds =
+        std::chrono::duration<double>(Clock::now() - begin).count();
+  } while (elapsed_seconds < kMinMeasurementTimeSeconds);
+
+  return elapsed_seconds * 1e6 / num_calls;
+}
+
+void Benchmark(size_t n) {
+  std::mt19937 generator(42);
+  std::uniform_real_distribution<float> distribution(0, 1);
+
+  std::vector<float> a(n * n);
+  std::vector<float> x(n);
+  std::vector<float> y(n);
+  std::vector<float> ones(n, 1);
+
+  for (auto& element : a) {
+    element = distribution(generator);
+  }
+
+  for (auto& element : x) {
+    element = distribution(generator);
+  }
+
+  std::vector<const LinalgKernels*> kernels_list;
+
+  for (const auto& instruction_set :
+       {InstructionSet::kScalar, InstructionSet::kSse, InstructionSet::kAvx2,
+        InstructionSet::kAvx512}) {
+    if (const LinalgKernels* kernels = GetLinalgKernels(instruction_set)) {
+      kernels_list.push_back(kernels);
+    }
+  }
+
+  // Multipliers are chosen to be close to 1, so that the values stay normal
+  // floating point numbers after many repeated calls
+  const std::vector<std::pair<std::string,
+                              std::function<void(const LinalgKernels&)>>>
+      benchmarks = {
+          {"sum",
+           [&](const LinalgKernels& k) {
+             volatile float sum = k.sum(x.data(), n);
+             (void)sum;
+           }},
+          {"scale", [&](const LinalgKernels& k) { k.scale(1, y.data(), n); }},
+          {"add", [&](const LinalgKernels& k) { k.add(x.data(), y.data(), n); }},
+          {"mul",
+           [&](const LinalgKernels& k) { k.mul(ones.data(), y.data(), n); }},
+          {"axpy",
+           [&](const LinalgKernels& k) { k.axpy(1e-6f, x.data(), y.data(), n); }},
+          {"trans_mat_mul_vec", [&](const LinalgKernels& k) {
+             k.trans_mat_mul_vec(a.data(), n, n, n, x.data(), y.data());
+           }}};
+
+  for (const auto& benchmark : benchmarks) {
+    double reference_time = 0;
+
+    for (const auto& kernels : kernels_list) {
+      const double time = Measure([&]() { benchmark.second(*kernels); });
+
+      if (kernels == kernels_list.front()) {
+        reference_time = time;
+      }
+
+      std::cout << std::setw(18) << benchmark.first << std::setw(8) << n
+                << std::setw(8) << kernels->name << std::setw(14)
+                << std::fixed << std::setprecision(3) << time << " us"
+                << std::setw(10) << std::setprecision(2)
+                << reference_time / time << "x" << std::endl;
+    }
+  }
+}
+
+}  // namespace
+
+int main(int argc, char* argv[]) {
+  std::vector<size_t> sizes = {1000, 10000};
+
+  if (argc > 1) {
+    sizes.clear();
+
+    for (int i = 1; i < argc; ++i) {
+      sizes.push_back(std::stoll(argv[i]));
+    }
+  }
+
+  std::cout << "Selected kernels: " << GetLinalgKernels().name << std::endl;
+  std::cout << std::setw(18) << "kernel" << std::setw(8) << "n" << std::setw(8)
+            << "isa" << std::setw(17) << "time" << std::setw(11) << "speedup"
+            << std::endl;
+
+  for (const auto& n : sizes) {
+    Benchmark(n);
+  }
+
+  return 0;
+}
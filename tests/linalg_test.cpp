@@ -0,0 +1,258 @@
+#include <math/linalg_kernels.h>
+#include <math/matrix.h>
+#include <math/vector.h>
+
+#include <cmath>
+#include <iostream>
+#include <random>
+#include <utility>
+#include <vector>
+
+// Checks Vector and Matrix storage management (move semantics and preserving
+// of the matrix contents on resize) and validates the vectorized linear algebra
+// kernels against the scalar reference ones. Exits with non-zero code on
+// failure.
+
+namespace {
+
+float ElementValue(size_t row, size_t col) {
+  return static_cast<float>(row * 1000 + col + 1);
+}
+
+void FillMatrix(Matrix<float>* matrix) {
+  for (size_t i = 0; i < matrix->GetNumRows(); ++i) {
+    for (size_t j = 0; j < matrix->GetNumCols(); ++j) {
+      (*matrix)(i, j) = ElementValue(i, j);
+    }
+  }
+}
+
+// Checks that elements, which were present before resize, are preserved and
+// the new ones are zeros
+bool CheckResizedMatrix(const Matrix<float>& matrix, size_t old_num_rows,
+                        size_t old_num_cols) {
+  for (size_t i = 0; i < matrix.GetNumRows(); ++i) {
+    for (size_t j = 0; j < matrix.GetNumCols(); ++j) {
+      const float expected =
+          i < old_num_rows && j < old_num_cols ? ElementValue(i, j) : 0;
+
+      if (matrix(i, j) != expected) {
+        std::cerr << "Resize from " << old_num_rows << "x" << old_num_cols
+                  << " to " << matrix.GetNumRows() << "x"
+                  << matrix.GetNumCols() << ": element (" << i << ", " << j
+                  << ") is " << matrix(i, j) << ", expected " << expected
+                  << std::endl;
+        return false;
+      }
+    }
+  }
+
+  return true;
+}
+
+bool CheckCopyResize() {
+  const size_t sizes[][2] = {{4, 4}, {8, 8}, {8, 2}, {2, 8},
+                             {3, 3}, {6, 1}, {1, 6}, {5, 5}};
+
+  bool ok = true;
+
+  Matrix<float> matrix(4, 4);
+  FillMatrix(&matrix);
+
+  for (const auto& size : sizes) {
+    const size_t old_num_rows = matrix.GetNumRows();
+    const size_t old_num_cols = matrix.GetNumCols();
+
+    matrix.Resize(size[0], size[1], ResizeType::kCopy);
+    ok &= CheckResizedMatrix(matrix, old_num_rows, old_num_cols);
+
+    FillMatrix(&matrix);
+  }
+
+  return ok;
+}
+
+bool CheckAmortizedGrowth() {
+  Matrix<float> matrix(1, 1, FillType::kZeros);
+
+  size_t num_reallocations = 0;
+
+  for (size_t n = 2; n <= 1024; ++n) {
+    const float* data = matrix.GetData();
+
+    matrix.Resize(n, n, ResizeType::kCopy);
+
+    if (matrix.GetData() != data) {
+      ++num_reallocations;
+    }
+  }
+
+  // Capacity is doubled on each reallocation
+  if (num_reallocations > 10) {
+    std::cerr << "Too many reallocations: " << num_reallocations << std::endl;
+    return false;
+  }
+
+  // Only the exceeded dimension grows
+  Matrix<float> tall_matrix(4, 4, FillType::kZeros);
+  tall_matrix.Resize(5, 4, ResizeType::kCopy);
+
+  if (tall_matrix.GetRowsCapacity() != 8 ||
+      tall_matrix.GetColsCapacity() != 4) {
+    std::cerr << "Unexpected capacity after growing rows: "
+              << tall_matrix.GetRowsCapacity() << "x"
+              << tall_matrix.GetColsCapacity() << std::endl;
+    return false;
+  }
+
+  return true;
+}
+
+bool CheckMoves() {
+  Matrix<float> matrix(3, 5);
+  FillMatrix(&matrix);
+
+  const float* matrix_data = matrix.GetData();
+  Matrix<float> moved_matrix(std::move(matrix));
+
+  Vector<float> vector(7, FillType::kZeros);
+  vector(3) = 42;
+
+  const float* vector_data = vector.GetData();
+  Vector<float> moved_vector;
+  moved_vector = std::move(vector);
+
+  // Moving from non-owning view copies the data
+  Vector<float> view(moved_vector.GetData(), moved_vector.GetSize());
+  Vector<float> view_copy;
+  view_copy = std::move(view);
+
+  if (moved_matrix.GetData() != matrix_data || matrix.GetData() != nullptr ||
+      moved_matrix.GetNumRows() != 3 || moved_matrix.GetNumCols() != 5 ||
+      !CheckResizedMatrix(moved_matrix, 3, 5) ||
+      moved_vector.GetData() != vector_data || moved_vector(3) != 42 ||
+      view_copy.GetData() == vector_data || view_copy(3) != 42) {
+    std::cerr << "Move semantics check failed" << std::endl;
+    return false;
+  }
+
+  return true;
+}
+
+bool CheckClose(const LinalgKernels& kernels, const char* kernel_name,
+                size_t n, const std::vector<float>& actual,
+                const std::vector<float>& expected) {
+  for (size_t i = 0; i < expected.size(); ++i) {
+    // Vectorized kernels sum the elements in a different order and may use
+    // fused multiply-add, so the results are not bitwise equal
+    if (std::fabs(actual[i] - expected[i]) >
+        1e-5f * (1 + std::fabs(expected[i]))) {
+      std::cerr << kernels.name << " " << kernel_name << " (n = " << n
+                << "): element " << i << " is " << actual[i] << ", expected "
+                << expected[i] << std::endl;
+      return false;
+    }
+  }
+
+  return true;
+}
+
+bool CheckKernels(const LinalgKernels& kernels) {
+  const LinalgKernels& reference = *GetLinalgKernels(InstructionSet::kScalar);
+
+  std::mt19937 generator(42);
+  std::uniform_real_distribution<float> distribution(0, 1);
+
+  bool ok = true;
+
+  // Sizes cover empty inputs and the remainders after vectorized loops
+  for (size_t n = 0; n < 100; n += 7) {
+    std::vector<float> x(n);
+    std::vector<float> y(n);
+
+    for (size_t i = 0; i < n; ++i) {
+      x[i] = distribution(generator);
+      y[i] = distribution(generator);
+    }
+
+    std::vector<float> actual(1, kernels.sum(x.data(), n));
+    std::vector<float> expected(1, reference.sum(x.data(), n));
+    ok &= CheckClose(kernels, "sum", n, actual, expected);
+
+    actual = y;
+    expected = y;
+    kernels.scale(0.3f, actual.data(), n);
+    reference.scale(0.3f, expected.data(), n);
+    ok &= CheckClose(kernels, "scale", n, actual, expected);
+
+    actual = y;
+    expected = y;
+    kernels.add(x.data(), actual.data(), n);
+    reference.add(x.data(), expected.data(), n);
+    ok &= CheckClose(kernels, "add", n, actual, expected);
+
+    actual = y;
+    expected = y;
+    kernels.mul(x.data(), actual.data(), n);
+    reference.mul(x.data(), expected.data(), n);
+    ok &= CheckClose(kernels, "mul", n, actual, expected);
+
+    actual = y;
+    expected = y;
+    kernels.axpy(0.3f, x.data(), actual.data(), n);
+    reference.axpy(0.3f, x.data(), expected.data(), n);
+    ok &= CheckClose(kernels, "axpy", n, actual, expected);
+  }
+
+  // Matrix is stored with the stride greater than the number of columns and
+  // some of the coefficients are zero to exercise the skipping of rows
+  const size_t sizes[][2] = {{1, 1}, {3, 5}, {17, 33}, {64, 3000}, {250, 70}};
+
+  for (const auto& size : sizes) {
+    const size_t rows = size[0];
+    const size_t cols = size[1];
+    const size_t stride = cols + 3;
+
+    std::vector<float> a(rows * stride);
+    std::vector<float> x(rows);
+
+    for (auto& element : a) {
+      element = distribution(generator);
+    }
+
+    for (size_t i = 0; i < rows; ++i) {
+      x[i] = i % 5 < 2 ? 0 : distribution(generator);
+    }
+
+    std::vector<float> actual(cols, -1);
+    std::vector<float> expected(cols, -1);
+
+    kernels.trans_mat_mul_vec(a.data(), rows, cols, stride, x.data(),
+                              actual.data());
+    reference.trans_mat_mul_vec(a.data(), rows, cols, stride, x.data(),
+                                expected.data());
+    ok &= CheckClose(kernels, "trans_mat_mul_vec", rows * cols, actual,
+                     expected);
+  }
+
+  return ok;
+}
+
+}  // namespace
+
+int main() {
+  bool ok = true;
+
+  ok &= CheckCopyResize();
+  ok &= CheckAmortizedGrowth();
+  ok &= CheckMoves();
+
+  for (const auto& instruction_set :
+       {InstructionSet::kSse, InstructionSet::kAvx2, InstructionSet::kAvx512}) {
+    if (const LinalgKernels* kernels = GetLinalgKernels(instruction_set)) {
+      ok &= CheckKernels(*kernels);
+    }
+  }
+
+  return ok ? 0 : 1;
+}
@@ -0,0 +1,189 @@
+#include <markov_chain_cache.h>
+
+#include <algorithm>
+#include <iostream>
+#include <unordered_set>
+#include <vector>
+
+#include "test_delegates.h"
+
+// Replays a cyclic workload, which does not fit into the cache, with and
+// without prefetch. Checks that prefetch improves the hit ratio, that the
+// prefetched items are reported to the delegate and in the batch results, that
+// the items in cache always fit into the cache capacity and that the prefetch
+// statistics are consistent. Also checks that the delegate, which has no
+// PrefetchItem, is notified about the prefetched items with AdmitItem.
+
+namespace {
+
+const size_t kNumKeys = 100;
+const size_t kNumRounds = 50;
+const size_t kBatchSize = 8;
+const float kCacheCapacity = 60;
+
+// Minimal delegate, which is not derived from CacheDelegate and has no
+// PrefetchItem
+class MinimalDelegate {
+ public:
+  void AdmitItem(const size_t& key) { resident_items_.insert(key); }
+
+  void EvictItem(const size_t& key) { resident_items_.erase(key); }
+
+  bool IsResident(size_t key) const { return resident_items_.count(key) != 0; }
+
+ private:
+  std::unordered_set<size_t> resident_items_;
+};
+
+MarkovChainCacheConfig GetConfig(size_t prefetch_max_items) {
+  MarkovChainCacheConfig cfg;
+
+  cfg.cache_capacity = kCacheCapacity;
+  cfg.prefetch_max_items = prefetch_max_items;
+
+  return cfg;
+}
+
+// Returns the number of hits or a negative value on failure. All the items
+// have unit sizes.
+long RunSequential(size_t prefetch_max_items) {
+  TrackingDelegate delegate;
+  MarkovChainCache<size_t> cache(GetConfig(prefetch_max_items), &delegate);
+  long num_hits = 0;
+
+  for (size_t key = 0; key < kNumKeys; ++key) {
+    cache.ProcessSetRequest(key, 1);
+  }
+
+  for (size_t i = 0; i < kNumRounds; ++i) {
+    for (size_t key = 0; key < kNumKeys; ++key) {
+      num_hits += cache.ProcessGetRequest(key);
+
+      if (delegate.GetCacheSize() > kCacheCapacity) {
+        std::cerr << "Cache size exceeds the capacity: "
+                  << delegate.GetCacheSize() << std::endl;
+        return -1;
+      }
+    }
+  }
+
+  const CachePrefetchStats& stats = cache.GetPrefetchStats();
+
+  if (stats.num_prefetched_items != delegate.PopPrefetchedKeys().size() ||
+      stats.prefetched_bytes != stats.num_prefetched_items ||
+      stats.num_prefetch_hits > stats.num_prefetched_items ||
+      stats.wasted_bytes > stats.prefetched_bytes ||
+      (prefetch_max_items == 0 && stats.num_prefetched_items != 0)) {
+    std::cerr << "Inconsistent prefetch stats: "
+              << stats.num_prefetched_items << " prefetched items, "
+              << stats.num_prefetch_hits << " prefetch hits, "
+              << stats.wasted_bytes << " wasted bytes" << std::endl;
+    return -1;
+  }
+
+  return num_hits;
+}
+
+// Returns false on failure
+bool RunBatched(size_t prefetch_max_items) {
+  TrackingDelegate delegate;
+  MarkovChainCache<size_t> cache(GetConfig(prefetch_max_items), &delegate);
+  CacheBatchResult<size_t> result;
+
+  std::vector<size_t> keys(kNumKeys);
+  std::vector<float> sizes(kNumKeys, 1);
+
+  for (size_t key = 0; key < kNumKeys; ++key) {
+    keys[key] = key;
+  }
+
+  cache.ProcessSetBatch(keys.data(), sizes.data(), keys.size(), &result);
+
+  size_t num_prefetched_items = 0;
+
+  for (size_t i = 0; i < kNumRounds; ++i) {
+    for (size_t begin = 0; begin < kNumKeys; begin += kBatchSize) {
+      cache.ProcessGetBatch(keys.data() + begin,
+                            std::min(kBatchSize, kNumKeys - begin), &result);
+
+      if (result.prefetched_keys != delegate.PopPrefetchedKeys()) {
+        std::cerr << "Prefetched keys do not match the notifications"
+                  << std::endl;
+        return false;
+      }
+
+      if (delegate.GetCacheSize() > kCacheCapacity) {
+        std::cerr << "Cache size exceeds the capacity: "
+                  << delegate.GetCacheSize() << std::endl;
+        return false;
+      }
+
+      num_prefetched_items += result.prefetched_keys.size();
+    }
+  }
+
+  if (num_prefetched_items == 0) {
+    std::cerr << "Nothing is prefetched in batches" << std::endl;
+    return false;
+  }
+
+  return true;
+}
+
+// Returns false on failure
+bool RunWithMinimalDelegate(size_t prefetch_max_items) {
+  MinimalDelegate delegate;
+  MarkovChainCache<size_t, StatsAccumulator, kRuntimeForecastLength,
+                   MinimalDelegate>
+      cache(GetConfig(prefetch_max_items), &delegate);
+
+  for (size_t key = 0; key < kNumKeys; ++key) {
+    cache.ProcessSetRequest(key, 1);
+  }
+
+  // Prefetched items are reported as admitted, so every hit is resident for
+  // the delegate
+  for (size_t i = 0; i < kNumRounds; ++i) {
+    for (size_t key = 0; key < kNumKeys; ++key) {
+      if (cache.ProcessGetRequest(key) && !delegate.IsResident(key)) {
+        std::cerr << "Minimal delegate is not notified about item " << key
+                  << std::endl;
+        return false;
+      }
+    }
+  }
+
+  if (cache.GetPrefetchStats().num_prefetch_hits == 0) {
+    std::cerr << "No prefetch hits with minimal delegate" << std::endl;
+    return false;
+  }
+
+  return true;
+}
+
+}  // namespace
+
+int main() {
+  const long num_hits = RunSequential(0);
+  const long num_prefetch_hits = RunSequential(2);
+
+  if (num_hits < 0 || num_prefetch_hits < 0) {
+    return 1;
+  }
+
+  if (num_prefetch_hits <= num_hits) {
+    std::cerr << "Prefetch does not improve hits: " << num_prefetch_hits
+              << " vs " << num_hits << std::endl;
+    return 1;
+  }
+
+  if (!RunBatched(2) || !RunWithMinimalDelegate(2)) {
+    return 1;
+  }
+
+  std::cout << "Hits: " << num_hits << " without prefetch, "
+            << num_prefetch_hits << " with prefetch" << std::endl;
+  std::cout << "OK" << std::endl;
+
+  return 0;
+}
@@ -0,0 +1,124 @@
+#include <sharded_markov_chain_cache.h>
+
+#include <atomic>
+#include <iostream>
+#include <random>
+#include <thread>
+#include <vector>
+
+#include "test_delegates.h"
+
+// Checks that the sharded cache with a single shard behaves exactly as the
+// plain cache, and that concurrent requests to the sharded cache keep each
+// shard within its capacity.
+
+namespace {
+
+const size_t kNumItems = 500;
+const size_t kNumRequests = 20000;
+const size_t kNumShards = 8;
+const size_t kNumThreads = 4;
+const float kCacheCapacity = 4000;
+
+float ItemSize(size_t key) { return 1 + key % 50; }
+
+std::vector<size_t> GenerateRequests() {
+  std::mt19937 generator(42);
+  std::geometric_distribution<size_t> distribution(0.05);
+
+  std::vector<size_t> requests;
+  size_t item = 0;
+
+  for (size_t i = 0; i < kNumRequests; ++i) {
+    item = (item + distribution(generator)) % kNumItems;
+    requests.push_back(item);
+  }
+
+  return requests;
+}
+
+bool CheckSingleShard(const std::vector<size_t>& requests) {
+  MarkovChainCacheConfig cfg;
+  cfg.cache_capacity = kCacheCapacity;
+
+  MarkovChainCache<size_t> cache(cfg);
+  ShardedMarkovChainCache<size_t> sharded_cache(cfg, 1);
+
+  for (size_t i = 0; i < kNumItems; ++i) {
+    cache.ProcessSetRequest(i, ItemSize(i));
+    sharded_cache.ProcessSetRequest(i, ItemSize(i));
+  }
+
+  for (const auto& key : requests) {
+    if (cache.ProcessGetRequest(key) != sharded_cache.ProcessGetRequest(key)) {
+      std::cerr << "Single shard cache mismatch" << std::endl;
+      return false;
+    }
+  }
+
+  return true;
+}
+
+bool CheckConcurrentRequests(const std::vector<size_t>& requests) {
+  MarkovChainCacheConfig cfg;
+  cfg.cache_capacity = kCacheCapacity;
+
+  TrackingDelegate delegate(ItemSize);
+  ShardedMarkovChainCache<size_t> cache(cfg, kNumShards, &delegate);
+
+  for (size_t i = 0; i < kNumItems; ++i) {
+    cache.ProcessSetRequest(i, ItemSize(i));
+  }
+
+  std::atomic<size_t> num_hits(0);
+  std::vector<std::thread> threads;
+
+  for (size_t t = 0; t < kNumThreads; ++t) {
+    threads.emplace_back([&, t]() {
+      for (size_t i = t; i < requests.size(); i += kNumThreads) {
+        if (cache.ProcessGetRequest(requests[i])) {
+          num_hits++;
+        }
+      }
+    });
+  }
+
+  for (auto& thread : threads) {
+    thread.join();
+  }
+
+  if (num_hits == 0) {
+    std::cerr << "No hits in concurrent replay" << std::endl;
+    return false;
+  }
+
+  std::vector<float> shard_sizes(kNumShards);
+
+  for (const auto& key : delegate.GetResidentKeys()) {
+    shard_sizes[cache.GetShardIndex(key)] += ItemSize(key);
+  }
+
+  for (size_t shard = 0; shard < kNumShards; ++shard) {
+    if (shard_sizes[shard] > kCacheCapacity / kNumShards) {
+      std::cerr << "Shard " << shard << " exceeds its capacity: "
+                << shard_sizes[shard] << std::endl;
+      return false;
+    }
+  }
+
+  return true;
+}
+
+}  // namespace
+
+int main() {
+  const std::vector<size_t> requests = GenerateRequests();
+
+  if (!CheckSingleShard(requests) || !CheckConcurrentRequests(requests)) {
+    return 1;
+  }
+
+  std::cout << "OK" << std::endl;
+
+  return 0;
+}
\ No newline at end of file
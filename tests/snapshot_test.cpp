@@ -0,0 +1,214 @@
+#include <markov_chain_cache.h>
+
+#include <chrono>
+#include <cstdio>
+#include <fstream>
+#include <iostream>
+#include <random>
+#include <vector>
+
+// Checks that the cache restored from a snapshot behaves exactly as the
+// original one with the flushed memory, and that the malformed snapshots and
+// the snapshots of the other stats accumulator type are rejected. Exits with
+// non-zero code on failure.
+
+namespace {
+
+const size_t kNumKeys = 2000;
+const size_t kNumRequests = 50000;
+const size_t kNumDeletes = 100;
+const float kCacheCapacity = 2000;
+
+const char kSnapshotPath[] = "mccache_snapshot_test.bin";
+
+struct Request {
+  size_t key;
+  float size;
+};
+
+// Each key is followed by one of two fixed successors
+std::vector<Request> GenerateRequests(std::mt19937* generator) {
+  std::uniform_int_distribution<size_t> keys_distribution(0, kNumKeys - 1);
+  std::uniform_int_distribution<int> sizes_distribution(1, 10);
+  std::bernoulli_distribution successors_distribution(0.8);
+
+  std::vector<float> sizes(kNumKeys);
+  std::vector<size_t> successors(2 * kNumKeys);
+
+  for (auto& size : sizes) {
+    size = sizes_distribution(*generator);
+  }
+
+  for (auto& successor : successors) {
+    successor = keys_distribution(*generator);
+  }
+
+  std::vector<Request> requests(kNumRequests);
+  size_t key = 0;
+
+  for (auto& request : requests) {
+    key = successors[2 * key + successors_distribution(*generator)];
+    request = {key, sizes[key]};
+  }
+
+  return requests;
+}
+
+size_t Run(const std::vector<Request>& requests,
+           MarkovChainCache<size_t>* cache) {
+  size_t num_hits = 0;
+
+  for (const auto& request : requests) {
+    if (!cache->Contains(request.key)) {
+      cache->ProcessSetRequest(request.key, request.size);
+    } else {
+      num_hits += cache->ProcessGetRequest(request.key);
+    }
+  }
+
+  return num_hits;
+}
+
+// Writes the prefix of the saved snapshot to the file at the given path
+bool WriteTruncatedSnapshot(const char* path, size_t size) {
+  std::ifstream input(kSnapshotPath, std::ios::binary);
+  std::vector<char> data(size);
+
+  if (!input.read(data.data(), size)) {
+    return false;
+  }
+
+  std::ofstream output(path, std::ios::binary | std::ios::trunc);
+  output.write(data.data(), size);
+
+  return static_cast<bool>(output);
+}
+
+bool CheckSnapshot(const std::string& stats_accumulator_type,
+                   const std::string& other_stats_accumulator_type) {
+  std::mt19937 generator(42);
+
+  const std::vector<Request> warm_up_requests = GenerateRequests(&generator);
+  const std::vector<Request> requests(
+      warm_up_requests.begin() + warm_up_requests.size() / 2,
+      warm_up_requests.end());
+
+  MarkovChainCacheConfig cfg;
+
+  cfg.cache_capacity = kCacheCapacity;
+  cfg.stats_accumulator_type = stats_accumulator_type;
+  cfg.max_states = kNumKeys / 2;
+  cfg.decay_half_life = 10000;
+
+  MarkovChainCache<size_t> cache(cfg);
+
+  Run(warm_up_requests, &cache);
+
+  // Deleted items leave the states to be removed from Markov chain
+  for (size_t key = 0; key < kNumDeletes; ++key) {
+    cache.ProcessDeleteRequest(key);
+  }
+
+  if (!cache.SaveSnapshot(kSnapshotPath)) {
+    std::cerr << "Failed to save snapshot" << std::endl;
+    return false;
+  }
+
+  typedef std::chrono::steady_clock Clock;
+
+  MarkovChainCache<size_t> restored_cache(cfg);
+
+  const Clock::time_point begin = Clock::now();
+  const bool is_loaded = restored_cache.LoadSnapshot(kSnapshotPath);
+  const double elapsed_milliseconds =
+      std::chrono::duration<double, std::milli>(Clock::now() - begin).count();
+
+  if (!is_loaded) {
+    std::cerr << "Failed to load snapshot" << std::endl;
+    return false;
+  }
+
+  std::cout << stats_accumulator_type << ": " << restored_cache.GetNumStates()
+            << " states loaded in " << elapsed_milliseconds << " ms"
+            << std::endl;
+
+  if (restored_cache.GetNumTrackedItems() != cache.GetNumTrackedItems() ||
+      restored_cache.GetNumStates() != cache.GetNumStates()) {
+    std::cerr << "Tracked items mismatch" << std::endl;
+    return false;
+  }
+
+  // Items in cache are not saved, so the original cache is flushed to compare
+  cache.Flush();
+
+  const size_t num_hits = Run(requests, &cache);
+  const size_t restored_num_hits = Run(requests, &restored_cache);
+
+  if (num_hits == 0 || restored_num_hits != num_hits) {
+    std::cerr << "Hits mismatch: " << restored_num_hits << " vs " << num_hits
+              << std::endl;
+    return false;
+  }
+
+  MarkovChainCache<size_t> cold_cache(cfg);
+
+  std::cout << stats_accumulator_type << ": " << restored_num_hits
+            << " hits after warm start, " << Run(requests, &cold_cache)
+            << " hits after cold start" << std::endl;
+
+  // Snapshot of another stats accumulator type is rejected
+  MarkovChainCacheConfig other_cfg = cfg;
+  other_cfg.stats_accumulator_type = other_stats_accumulator_type;
+
+  MarkovChainCache<size_t> other_cache(other_cfg);
+
+  if (other_cache.LoadSnapshot(kSnapshotPath)) {
+    std::cerr << "Snapshot of another accumulator type is loaded" << std::endl;
+    return false;
+  }
+
+  // Truncated snapshots are rejected and the cache stays empty
+  const char truncated_snapshot_path[] = "mccache_snapshot_test_truncated.bin";
+  std::ifstream snapshot(kSnapshotPath, std::ios::binary | std::ios::ate);
+  const size_t snapshot_size = snapshot.tellg();
+
+  for (const auto& size : {size_t(4), snapshot_size / 2, snapshot_size - 1}) {
+    MarkovChainCache<size_t> truncated_cache(cfg);
+
+    if (!WriteTruncatedSnapshot(truncated_snapshot_path, size) ||
+        truncated_cache.LoadSnapshot(truncated_snapshot_path) ||
+        truncated_cache.GetNumStates() != 0 ||
+        truncated_cache.GetNumTrackedItems() != 0) {
+      std::cerr << "Snapshot truncated to " << size << " bytes is loaded"
+                << std::endl;
+      return false;
+    }
+  }
+
+  std::remove(truncated_snapshot_path);
+
+  // Missing snapshot is reported as well
+  MarkovChainCache<size_t> missing_cache(cfg);
+
+  if (missing_cache.LoadSnapshot("mccache_missing_snapshot.bin")) {
+    std::cerr << "Missing snapshot is loaded" << std::endl;
+    return false;
+  }
+
+  std::remove(kSnapshotPath);
+
+  return true;
+}
+
+}  // namespace
+
+int main() {
+  if (!CheckSnapshot("transitions", "states") ||
+      !CheckSnapshot("states", "transitions")) {
+    return 1;
+  }
+
+  std::cout << "OK" << std::endl;
+
+  return 0;
+}
@@ -0,0 +1,147 @@
+#include <math/evolving_markov_chain.h>
+#include <math/sparse_forecast_engine.h>
+
+#include <cmath>
+#include <iostream>
+#include <random>
+#include <vector>
+
+// Compares forecasts generated by SparseForecastEngine with the ones generated
+// by the dense prediction method. Truncated forecasts are expected to never
+// exceed the exact ones and to stay within the documented error bound. One step
+// predictions gathered for a subset of states are expected to match the dense
+// ones exactly. Exits with non-zero code on mismatch.
+
+namespace {
+
+const size_t kNumStates = 300;
+const size_t kNumTransitions = 20000;
+const size_t kForecastLength = 10;
+
+// Some of the states will have less accesses than this threshold, so both
+// stats accumulator and transitions matrix are employed for predictions
+const size_t kAccessesThreshold = 70;
+
+// Tolerance for floating point rounding errors
+const float kTolerance = 1e-4f;
+
+void FillChain(EvolvingMarkovChain* chain) {
+  std::mt19937 generator(42);
+
+  // Skewed distribution makes some of the states hot and leaves others cold
+  std::geometric_distribution<size_t> distribution(0.02);
+
+  for (size_t i = 0; i < kNumStates; ++i) {
+    chain->AddState();
+  }
+
+  size_t state = 0;
+
+  for (size_t i = 0; i < kNumTransitions; ++i) {
+    const size_t next_state = (state + distribution(generator)) % kNumStates;
+    chain->RegisterTransition(state, next_state);
+    state = next_state;
+  }
+}
+
+Vector<float> DenseForecast(EvolvingMarkovChain* chain, size_t current_state) {
+  Vector<float> state(kNumStates, FillType::kZeros);
+  Vector<float> accumulated_states(kNumStates, FillType::kZeros);
+
+  state(current_state) = 1;
+
+  for (size_t i = 0; i < kForecastLength; ++i) {
+    state = chain->PredictNextState(state);
+    accumulated_states.AddElements(state);
+  }
+
+  return accumulated_states;
+}
+
+bool CheckForecast(const std::string& stats_accumulator_type, float epsilon,
+                   size_t max_states) {
+  EvolvingMarkovChain chain(stats_accumulator_type, kAccessesThreshold);
+  FillChain(&chain);
+
+  SparseForecastEngine engine(epsilon, max_states);
+  Vector<float> accumulated_states(kNumStates);
+
+  for (size_t current_state = 0; current_state < kNumStates;
+       current_state += 37) {
+    const Vector<float> expected = DenseForecast(&chain, current_state);
+
+    engine.Forecast(chain, current_state, kForecastLength,
+                    &accumulated_states);
+
+    const float max_error =
+        kForecastLength * engine.GetDroppedProbabilityMass() + kTolerance;
+
+    for (size_t i = 0; i < kNumStates; ++i) {
+      if (std::fabs(accumulated_states(i) - expected(i)) > max_error ||
+          accumulated_states(i) > expected(i) + kTolerance) {
+        std::cerr << stats_accumulator_type << " (epsilon = " << epsilon
+                  << ", max states = " << max_states
+                  << "): mismatch for state " << i << " starting from state "
+                  << current_state << ": " << accumulated_states(i)
+                  << " != " << expected(i) << std::endl;
+        return false;
+      }
+    }
+  }
+
+  return true;
+}
+
+bool CheckGatheredPrediction(const std::string& stats_accumulator_type) {
+  EvolvingMarkovChain chain(stats_accumulator_type, kAccessesThreshold);
+  FillChain(&chain);
+
+  std::vector<size_t> states;
+
+  for (size_t i = 0; i < kNumStates; i += 7) {
+    states.push_back(i);
+  }
+
+  Vector<float> expected(kNumStates);
+  std::vector<float> probabilities(states.size());
+
+  for (size_t current_state = 0; current_state < kNumStates;
+       current_state += 13) {
+    chain.PredictNextState(current_state, &expected);
+    chain.PredictNextState(current_state, states.data(), states.size(),
+                           probabilities.data());
+
+    for (size_t i = 0; i < states.size(); ++i) {
+      if (probabilities[i] != expected(states[i])) {
+        std::cerr << stats_accumulator_type
+                  << ": gathered prediction mismatch for state " << states[i]
+                  << " starting from state " << current_state << ": "
+                  << probabilities[i] << " != " << expected(states[i])
+                  << std::endl;
+        return false;
+      }
+    }
+  }
+
+  return true;
+}
+
+}  // namespace
+
+int main() {
+  bool ok = true;
+
+  for (const auto& type : {"states", "transitions"}) {
+    // Exact forecast
+    ok &= CheckForecast(type, 0, 0);
+
+    // Truncated forecasts
+    ok &= CheckForecast(type, 1e-3f, 0);
+    ok &= CheckForecast(type, 0, 250);
+    ok &= CheckForecast(type, 1e-3f, 250);
+
+    ok &= CheckGatheredPrediction(type);
+  }
+
+  return ok ? 0 : 1;
+}
@@ -0,0 +1,218 @@
+#include <markov_chain_cache.h>
+
+#include <cmath>
+#include <iostream>
+#include <random>
+
+// Checks that removed Markov chain states are scrubbed from the transitions
+// statistics and reused, and that the cache with a cap on tracked items keeps
+// the number of states bounded on a workload with unbounded number of keys,
+// including the states retired before the first get request. Exits with
+// non-zero code on failure.
+
+namespace {
+
+const size_t kNumStates = 200;
+const size_t kNumTransitions = 20000;
+const size_t kAccessesThreshold = 20;
+
+const size_t kMaxStates = 100;
+const size_t kNumKeys = 5000;
+
+const float kTolerance = 1e-4f;
+
+bool CheckChainStatesRemoval(const std::string& stats_accumulator_type) {
+  EvolvingMarkovChain chain(stats_accumulator_type, kAccessesThreshold);
+
+  std::mt19937 generator(42);
+  std::geometric_distribution<size_t> distribution(0.05);
+
+  for (size_t i = 0; i < kNumStates; ++i) {
+    chain.AddState();
+  }
+
+  size_t state = 0;
+
+  for (size_t i = 0; i < kNumTransitions; ++i) {
+    const size_t next_state = (state + distribution(generator)) % kNumStates;
+    chain.RegisterTransition(state, next_state);
+    state = next_state;
+  }
+
+  // Remove every third state
+  std::vector<size_t> removed_states;
+
+  for (size_t i = 1; i < kNumStates; i += 3) {
+    removed_states.push_back(i);
+  }
+
+  chain.RemoveStates(removed_states.data(), removed_states.size());
+
+  Vector<float> current_state(kNumStates, FillType::kZeros);
+  Vector<float> next_state(kNumStates);
+
+  for (size_t i = 0; i < kNumStates; ++i) {
+    if (chain.IsStateRemoved(i) != (i % 3 == 1)) {
+      std::cerr << "Unexpected removed state mask" << std::endl;
+      return false;
+    }
+
+    if (chain.IsStateRemoved(i)) {
+      if (chain.GetStateAccessesCount(i) != 0) {
+        std::cerr << "Removed state " << i << " has accesses" << std::endl;
+        return false;
+      }
+
+      continue;
+    }
+
+    // Hot rows should not refer to removed states and still be normalized
+    if (chain.GetStateAccessesCount(i) < kAccessesThreshold) {
+      continue;
+    }
+
+    current_state(i) = 1;
+    chain.PredictNextState(current_state, &next_state);
+    current_state(i) = 0;
+
+    float sum = 0;
+
+    for (size_t j = 0; j < kNumStates; ++j) {
+      if (chain.IsStateRemoved(j) && next_state(j) != 0) {
+        std::cerr << "Row " << i << " refers to removed state " << j
+                  << std::endl;
+        return false;
+      }
+
+      sum += next_state(j);
+    }
+
+    if (std::fabs(sum - 1) > kTolerance) {
+      std::cerr << "Row " << i << " is not normalized: " << sum << std::endl;
+      return false;
+    }
+  }
+
+  // Removed states are reused before new ones are added
+  for (size_t i = 0; i < removed_states.size(); ++i) {
+    const size_t reused_state = chain.AddState();
+
+    if (reused_state % 3 != 1 || chain.IsStateRemoved(reused_state)) {
+      std::cerr << "Removed state is not reused" << std::endl;
+      return false;
+    }
+  }
+
+  if (chain.AddState() != kNumStates || chain.GetNumStates() != kNumStates + 1) {
+    std::cerr << "New state is not appended" << std::endl;
+    return false;
+  }
+
+  return true;
+}
+
+bool CheckCacheStatesCap(const std::string& stats_accumulator_type) {
+  MarkovChainCacheConfig cfg;
+
+  cfg.cache_capacity = 100;
+  cfg.stats_accumulator_type = stats_accumulator_type;
+  cfg.max_states = kMaxStates;
+
+  MarkovChainCache<size_t> cache(cfg);
+
+  std::mt19937 generator(42);
+  std::uniform_int_distribution<size_t> distribution(0, 20);
+
+  size_t num_hits = 0;
+
+  for (size_t key = 0; key < kNumKeys; ++key) {
+    cache.ProcessSetRequest(key, 1 + key % 10);
+
+    // Request some of the recent keys, which might be retired already
+    const size_t requested_key = key - std::min(key, distribution(generator));
+
+    if (cache.ProcessGetRequest(requested_key)) {
+      num_hits++;
+    } else if (!cache.Contains(requested_key)) {
+      cache.ProcessSetRequest(requested_key, 1 + requested_key % 10);
+    }
+
+    if (cache.GetNumTrackedItems() > kMaxStates) {
+      std::cerr << "Number of tracked items exceeds the cap: "
+                << cache.GetNumTrackedItems() << std::endl;
+      return false;
+    }
+  }
+
+  if (!cache.Contains(kNumKeys - 1)) {
+    std::cerr << "The most recent item is retired" << std::endl;
+    return false;
+  }
+
+  if (num_hits == 0) {
+    std::cerr << "No hits with the cap on tracked items" << std::endl;
+    return false;
+  }
+
+  return true;
+}
+
+// Returns false on failure
+bool CheckRetirementBeforeFirstGet(const std::string& stats_accumulator_type) {
+  MarkovChainCacheConfig cfg;
+
+  cfg.cache_capacity = 10;
+  cfg.stats_accumulator_type = stats_accumulator_type;
+  cfg.max_states = kMaxStates;
+
+  MarkovChainCache<size_t> cache(cfg);
+
+  // The first item is unloaded and retired while there is no previous state
+  // yet, and its state is not reused before the first get request
+  cache.ProcessSetRequest(0, 1);
+  cache.Flush();
+
+  for (size_t key = 1; key <= kMaxStates; ++key) {
+    cache.ProcessSetRequest(key, 1);
+  }
+
+  if (cache.Contains(0)) {
+    std::cerr << "The first item is not retired" << std::endl;
+    return false;
+  }
+
+  // The most recent item is requested first
+  for (size_t i = 0; i <= kMaxStates; ++i) {
+    const size_t key = kMaxStates - i;
+
+    if (!cache.ProcessGetRequest(key) && !cache.Contains(key)) {
+      cache.ProcessSetRequest(key, 1);
+    }
+
+    if (cache.GetNumTrackedItems() > kMaxStates) {
+      std::cerr << "Number of tracked items exceeds the cap: "
+                << cache.GetNumTrackedItems() << std::endl;
+      return false;
+    }
+  }
+
+  return true;
+}
+
+}  // namespace
+
+int main() {
+  for (const auto& stats_accumulator_type : {"transitions", "states"}) {
+    if (!CheckChainStatesRemoval(stats_accumulator_type) ||
+        !CheckCacheStatesCap(stats_accumulator_type) ||
+        !CheckRetirementBeforeFirstGet(stats_accumulator_type)) {
+      std::cerr << "Failed with " << stats_accumulator_type
+                << " stats accumulator" << std::endl;
+      return 1;
+    }
+  }
+
+  std::cout << "OK" << std::endl;
+
+  return 0;
+}
\ No newline at end of file
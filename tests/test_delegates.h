@@ -0,0 +1,129 @@
+#pragma once
+
+#include <markov_chain_cache.h>
+
+#include <functional>
+#include <mutex>
+#include <unordered_map>
+#include <utility>
+#include <vector>
+
+// Cache delegate shared by the cache tests. The tests are plain executables,
+// which exit with non-zero code on failure, and check the cache against what
+// this delegate was notified about.
+
+// Tracks the items in cache, their total size and the notifications. Sizes of
+// the items are taken on admission, so overwritten items are unloaded with
+// their old sizes. Notifications may come from several threads (see
+// ShardedMarkovChainCache).
+class TrackingDelegate : public CacheDelegate<size_t> {
+ public:
+  typedef std::function<float(size_t)> ItemSizeFunction;
+
+  // All the items have unit sizes by default
+  explicit TrackingDelegate(
+      ItemSizeFunction item_size = [](size_t) { return 1.0f; })
+      : item_size_(std::move(item_size)) {}
+
+  void AdmitItem(const size_t& key) const override {
+    std::lock_guard<std::mutex> lock(mutex_);
+
+    Insert(key);
+    admitted_keys_.push_back(key);
+  }
+
+  void EvictItem(const size_t& key) const override {
+    std::lock_guard<std::mutex> lock(mutex_);
+
+    Erase(key);
+    evicted_keys_.push_back(key);
+    num_evictions_++;
+  }
+
+  void PrefetchItem(const size_t& key) const override {
+    std::lock_guard<std::mutex> lock(mutex_);
+
+    Insert(key);
+    prefetched_keys_.push_back(key);
+  }
+
+  // Deleted items are unloaded without notification
+  void DeleteItem(size_t key) {
+    std::lock_guard<std::mutex> lock(mutex_);
+
+    Erase(key);
+  }
+
+  bool IsResident(size_t key) const {
+    std::lock_guard<std::mutex> lock(mutex_);
+
+    return resident_items_sizes_.count(key) != 0;
+  }
+
+  std::vector<size_t> GetResidentKeys() const {
+    std::lock_guard<std::mutex> lock(mutex_);
+
+    std::vector<size_t> keys;
+
+    for (const auto& item : resident_items_sizes_) {
+      keys.push_back(item.first);
+    }
+
+    return keys;
+  }
+
+  float GetCacheSize() const {
+    std::lock_guard<std::mutex> lock(mutex_);
+
+    return static_cast<float>(cache_size_);
+  }
+
+  size_t GetNumEvictions() const {
+    std::lock_guard<std::mutex> lock(mutex_);
+
+    return num_evictions_;
+  }
+
+  // Return the keys of the corresponding notifications since the last call
+  std::vector<size_t> PopAdmittedKeys() { return Pop(&admitted_keys_); }
+
+  std::vector<size_t> PopEvictedKeys() { return Pop(&evicted_keys_); }
+
+  std::vector<size_t> PopPrefetchedKeys() { return Pop(&prefetched_keys_); }
+
+ private:
+  void Insert(size_t key) const {
+    const float size = item_size_(key);
+
+    resident_items_sizes_[key] = size;
+    cache_size_ += size;
+  }
+
+  void Erase(size_t key) const {
+    const auto it = resident_items_sizes_.find(key);
+
+    if (it != resident_items_sizes_.end()) {
+      cache_size_ -= it->second;
+      resident_items_sizes_.erase(it);
+    }
+  }
+
+  std::vector<size_t> Pop(std::vector<size_t>* keys) {
+    std::lock_guard<std::mutex> lock(mutex_);
+
+    std::vector<size_t> popped_keys;
+    popped_keys.swap(*keys);
+
+    return popped_keys;
+  }
+
+  const ItemSizeFunction item_size_;
+
+  mutable std::mutex mutex_;
+  mutable std::unordered_map<size_t, float> resident_items_sizes_;
+  mutable double cache_size_ = 0;
+  mutable size_t num_evictions_ = 0;
+  mutable std::vector<size_t> admitted_keys_;
+  mutable std::vector<size_t> evicted_keys_;
+  mutable std::vector<size_t> prefetched_keys_;
+};